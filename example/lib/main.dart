@@ -2,7 +2,6 @@ import 'dart:async';
 import 'dart:convert';
 import 'dart:developer';
 import 'dart:io';
-import 'dart:isolate';
 import 'dart:typed_data';
 
 import 'package:flutter/material.dart';
@@ -307,41 +306,23 @@ class _MyHomePageState extends State<MyHomePage> {
     final Directory tempDir = await getTemporaryDirectory();
     final String tempPath = '${tempDir.path}/temp.jpg';
 
-    final port = ReceivePort();
     final args = ProcessImageArguments(
       file.path,
       tempPath,
       jsonArgs: jsonEncode({}),
     );
 
+    final String message;
     try {
-      await Isolate.spawn(
-        (List args) {
-          final sendPort = args[0] as SendPort;
-          final processArgs = args[1] as ProcessImageArguments;
-          processImage(sendPort, processArgs);
-        },
-        [port.sendPort, args],
-        onError: port.sendPort,
-        onExit: port.sendPort,
-      );
+      message = await NativeOpencvWorker.instance.processImage(args);
     } catch (e) {
-      log('Isolate spawn failed: $e');
+      log('Processing failed: $e');
       return;
     }
 
-    late StreamSubscription sub;
-
-    sub = port.listen((message) async {
-      await sub.cancel();
-      port.close();
-
-      if (message == null) return;
+    final result = jsonDecode(message);
 
-      final result = jsonDecode(message);
-
-      handleResult(result, tempPath);
-    });
+    handleResult(result, tempPath);
   }
 
   Future<void> handleResult(result, tempPath) async {
@@ -4,7 +4,38 @@
 #include <vector>
 #include <string>
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include "cjson/cJSON.h"
+#include "omr/alloc_tracking.h"
+#include "omr/block_frame.h"
+#include "omr/cancel_token.h"
+#include "omr/capture_check.h"
+#include "omr/coarse_blocks.h"
+#include "omr/dart_port.h"
+#include "omr/detection_ladder.h"
+#include "omr/engine.h"
+#include "omr/engine_options.h"
+#include "omr/engine_stats.h"
+#include "omr/frame_analysis.h"
+#include "omr/grade_result.h"
+#include "omr/header_grids.h"
+#include "omr/memory_budget.h"
+#include "omr/page_stream.h"
+#include "omr/pipeline.h"
+#include "omr/result_cache.h"
+#include "omr/result_struct.h"
+#include "omr/result_writer.h"
+#include "omr/ring_log.h"
+#include "omr/sheet_regions.h"
+#include "omr/skew.h"
+#include "omr/trace_events.h"
+#include "omr/worker_pool.h"
 
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32)
 #define IS_WIN32
@@ -63,65 +94,21 @@ void platform_log(const char *fmt, ...) {
 
 // ___________________________
 // Define bounding box and answer structs for better code organization
-unordered_map<int, string> choicePart1 = {{1, "A"},
-                                          {2, "B"},
-                                          {3, "C"},
-                                          {4, "D"}};
-unordered_map<int, string> subQuestionPart2 = {{1, "a"},
-                                               {2, "b"},
-                                               {3, "c"},
-                                               {4, "d"}};
-unordered_map<int, string> choicePart2 = {{1, "yes"},
-                                          {2, "no"}};
-unordered_map<int, string> subChoicePart3 = {{1,  "-"},
-                                             {2,  ","},
-                                             {3,  "0"},
-                                             {4,  "1"},
-                                             {5,  "2"},
-                                             {6,  "3"},
-                                             {7,  "4"},
-                                             {8,  "5"},
-                                             {9,  "6"},
-                                             {10, "7"},
-                                             {11, "8"},
-                                             {12, "9"}};
-unordered_map<string, int> subChoicePart3Reversed = {{"-", 1},
-                                                     {",", 2},
-                                                     {"0", 3},
-                                                     {"1", 4},
-                                                     {"2", 5},
-                                                     {"3", 6},
-                                                     {"4", 7},
-                                                     {"5", 8},
-                                                     {"6", 9},
-                                                     {"7", 10},
-                                                     {"8", 11},
-                                                     {"9", 12}};
-unordered_map<int, string> choicePart3 = {{1, "1"},
-                                          {2, "2"},
-                                          {3, "3"},
-                                          {4, "4"}};
-
-struct OptionalPoint {
-    bool hasValue;
-    Point value;
-};
-
-struct part1Answer {
-    string questionNumber;
-    string userChoiceResult;
-};
-
-struct part2Answer {
-    string questionNumber;
-    string subName;
-    bool userChoiceResult;
-};
-
-struct part3Answer {
-    string questionNumber;
-    string userResult;
-};
+// Labels by zero-based row/column. Read-only, so concurrent grades can share them.
+static constexpr const char *choicePart1[] = {"A", "B", "C", "D"};
+static constexpr const char *subQuestionPart2[] = {"a", "b", "c", "d"};
+static constexpr char subChoicePart3[] = {'-', ',', '0', '1', '2', '3', '4', '5', '6', '7', '8', '9'};
+static constexpr int subChoicePart3Count = sizeof(subChoicePart3) / sizeof(subChoicePart3[0]);
+
+// Row of a part 3 symbol, -1 for a character the grid does not have
+static int subChoicePart3Row(char symbol) {
+    for (int row = 0; row < subChoicePart3Count; row++) {
+        if (subChoicePart3[row] == symbol) {
+            return row;
+        }
+    }
+    return -1;
+}
 
 
 // Resize the image to a fixed height and calculate the target width
@@ -134,64 +121,17 @@ Mat resizeImage(const Mat &image, int targetHeight) {
 }
 
 // Hàm xoay ảnh dựa trên các đường thẳng đứng
-Mat rotateImageVertically(const Mat& inputImage, double minLengthPercentage = 20.0) {
-    // 1. Chuyển đổi sang ảnh xám
-    Mat gray;
-    cvtColor(inputImage, gray, COLOR_BGR2GRAY);
-
-    // 2. Làm mờ ảnh
-    Mat blurred;
-    GaussianBlur(gray, blurred, Size(5, 5), 0);
-
-    // 3. Phát hiện biên cạnh
-    Mat edges;
-    Canny(blurred, edges, 50, 150, 3);
-
-    // 4. Tìm các đường thẳng
-    vector<Vec4i> lines;
-    HoughLinesP(edges, lines, 1, CV_PI / 180, 50, 50, 10);
-
-    // 5. Tính toán góc xoay trung bình
-    double angle = 0.0;
-    int numLines = 0;
-
-    // Tính toán minLength dựa trên tỷ lệ phần trăm chiều rộng ảnh
-    double minLength = (minLengthPercentage / 100.0) * inputImage.cols;
-
-    for (const auto& line : lines) {
-        int x1 = line[0];
-        int y1 = line[1];
-        int x2 = line[2];
-        int y2 = line[3];
-
-        // Tính toán độ dài đường thẳng
-        double length = sqrt(pow(x2 - x1, 2) + pow(y2 - y1, 2));
-
-        // Lọc theo độ dài và hướng của đường thẳng (chọn đường thẳng đứng)
-        if (length >= minLength && abs(y2 - y1) > abs(x2 - x1)) {
-            double currentAngle = atan2(y2 - y1, x2 - x1) * 180.0 / CV_PI;
-
-            // Điều chỉnh góc
-            if (currentAngle > 0) {
-                currentAngle -= 90.0;
-            } else {
-                currentAngle += 90.0;
-            }
-
-            angle += currentAngle;
-            numLines++;
-        }
-    }
-    if (numLines > 0) {
-        angle /= numLines;
+Mat rotateImageVertically(const Mat& inputImage, double minLengthPercentage) {
+    // 1-4. Tìm các đường thẳng
+    vector<Vec4i> lines = detectLineSegments(inputImage);
+
+    // 5. Tính toán góc xoay trung bình, minLength theo tỷ lệ phần trăm chiều rộng ảnh
+    double angle = verticalSkewAngle(lines, (minLengthPercentage / 100.0) * inputImage.cols);
+    OMR_LOG_DEBUG("vertical skew %.2f deg from %d segments", angle, lines.size());
+    if (angle == 0) {
+        return inputImage;
     }
 
-    // Nếu góc xoay quá nhỏ, có thể coi là 0
-    if (abs(angle) < 0.2) {
-        angle = 0.0;
-    }
-
-
     // 6. Xoay ảnh
     Point2f center(inputImage.cols / 2.0, inputImage.rows / 2.0);
     Mat rotationMatrix = getRotationMatrix2D(center, angle, 1.0);
@@ -202,53 +142,15 @@ Mat rotateImageVertically(const Mat& inputImage, double minLengthPercentage = 20
 }
 
 // Hàm xoay ảnh dựa trên các đường thẳng nằm ngang
-Mat rotateImageHorizontally(const Mat& inputImage, double minLengthPercentage = 20.0) {
-    // 1. Chuyển đổi sang ảnh xám
-    Mat gray;
-    cvtColor(inputImage, gray, COLOR_BGR2GRAY);
-
-    // 2. Làm mờ ảnh
-    Mat blurred;
-    GaussianBlur(gray, blurred, Size(5, 5), 0);
-
-    // 3. Phát hiện biên cạnh
-    Mat edges;
-    Canny(blurred, edges, 50, 150, 3);
-
-    // 4. Tìm các đường thẳng
-    vector<Vec4i> lines;
-    HoughLinesP(edges, lines, 1, CV_PI / 180, 50, 50, 10);
-
-    // 5. Tính toán góc xoay trung bình
-    double angle = 0.0;
-    int numLines = 0;
-
-    // Tính toán minLength dựa trên tỷ lệ phần trăm chiều cao ảnh
-    double minLength = (minLengthPercentage / 100.0) * inputImage.rows;
-
-    for (const auto& line : lines) {
-        int x1 = line[0];
-        int y1 = line[1];
-        int x2 = line[2];
-        int y2 = line[3];
-
-        // Tính toán độ dài đường thẳng
-        double length = sqrt(pow(x2 - x1, 2) + pow(y2 - y1, 2));
-
-        // Lọc theo độ dài và hướng của đường thẳng (chọn đường nằm ngang)
-        if (length >= minLength && abs(y2 - y1) < abs(x2 - x1)) {
-            double currentAngle = atan2(y2 - y1, x2 - x1) * 180.0 / CV_PI;
-            angle += currentAngle;
-            numLines++;
-        }
-    }
-    if (numLines > 0) {
-        angle /= numLines;
-    }
-
-    // Nếu góc xoay quá nhỏ, có thể coi là 0
-    if (abs(angle) < 0.2) {
-        angle = 0.0;
+Mat rotateImageHorizontally(const Mat& inputImage, double minLengthPercentage) {
+    // 1-4. Tìm các đường thẳng
+    vector<Vec4i> lines = detectLineSegments(inputImage);
+
+    // 5. Tính toán góc xoay trung bình, minLength theo tỷ lệ phần trăm chiều cao ảnh
+    double angle = horizontalSkewAngle(lines, (minLengthPercentage / 100.0) * inputImage.rows);
+    OMR_LOG_DEBUG("horizontal skew %.2f deg from %d segments", angle, lines.size());
+    if (angle == 0) {
+        return inputImage;
     }
 
     // 6. Xoay ảnh
@@ -275,19 +177,21 @@ struct ContourPrecedenceComparator {
 };
 
 // Image preprocessing: Convert to grayscale, blur, and apply adaptive thresholding
-Mat preprocessOriginImage(const Mat &image) {
-    Mat gray, claheImage, blurred, sharpenedImage, thresh, dilated, closed;
-    cvtColor(image, gray, COLOR_BGR2GRAY);
-    GaussianBlur(gray, blurred, Size(5, 5), 0);
+// Two planes, each step writing into the one its input is not using
+Mat preprocessOriginImage(const Mat &image, const BlockParams &params) {
+    Mat plane, other;
+    cvtColor(image, plane, COLOR_BGR2GRAY);
+    GaussianBlur(plane, plane, Size(5, 5), 0);
     Ptr<CLAHE> clahe = createCLAHE();
-    clahe->setClipLimit(2.0);
+    clahe->setClipLimit(params.claheClipLimit);
     clahe->setTilesGridSize(Size(8, 8));
-    clahe->apply(blurred, claheImage);
-    adaptiveThreshold(claheImage, thresh, 255, ADAPTIVE_THRESH_MEAN_C, THRESH_BINARY_INV, 21, 15);
+    clahe->apply(plane, other);
+    adaptiveThreshold(other, plane, 255, ADAPTIVE_THRESH_MEAN_C, THRESH_BINARY_INV, params.thresholdBlockSize,
+                      params.thresholdOffset);
     Mat kernel = getStructuringElement(MORPH_RECT, Size(2, 2));
-    dilate(thresh, dilated, kernel, Point(-1, -1), 1);
-    morphologyEx(dilated, closed, MORPH_CLOSE, kernel);
-    return closed;
+    dilate(plane, other, kernel, Point(-1, -1), 1);
+    morphologyEx(other, plane, MORPH_CLOSE, kernel);
+    return plane;
 }
 
 bool areBoxSimilar(const Rect& box1, const Rect& box2, int threshold = 10) {
@@ -311,7 +215,7 @@ bool areBoxSimilar(const Rect& box1, const Rect& box2, int threshold = 10) {
 }
 
 // Processing part 3
-Mat preprocessPart3(const Mat& image) {
+Mat preprocessPart3(const Mat& image, const BlockParams &params) {
     // Chuyển ảnh sang ảnh xám
     Mat gray;
     cvtColor(image, gray, COLOR_BGR2GRAY);
@@ -322,7 +226,8 @@ Mat preprocessPart3(const Mat& image) {
 
     // Áp dụng adaptive thresholding
     Mat thresh;
-    adaptiveThreshold(blurred, thresh, 255, ADAPTIVE_THRESH_MEAN_C, THRESH_BINARY_INV, 21, 15);
+    adaptiveThreshold(blurred, thresh, 255, ADAPTIVE_THRESH_MEAN_C, THRESH_BINARY_INV, params.thresholdBlockSize,
+                      params.thresholdOffset);
 
     // Áp dụng phép giãn nở (dilate) để nối các đường nét bị đứt
     Mat kernel = getStructuringElement(MORPH_RECT, Size(3, 3));
@@ -341,7 +246,7 @@ Mat preprocessPart3(const Mat& image) {
     return edges;
 }
 
-vector<Rect> findContoursOrigin(const Mat& image) {
+vector<Rect> findContoursOrigin(const Mat& image, const BlockParams &params) {
     vector <vector<Point>> contours;
     findContours(image, contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
 
@@ -351,7 +256,7 @@ vector<Rect> findContoursOrigin(const Mat& image) {
     sort(contours.begin(), contours.end(), ContourPrecedenceComparator(image.cols));
 
     for (const auto &contour: contours) {
-        if (contourArea(contour) < 1000) continue;
+        if (contourArea(contour) < params.minBlockArea) continue;
         vector <Point> approx;
         double epsilon = 0.04 * arcLength(contour, true);
         approxPolyDP(contour, approx, epsilon, true);
@@ -367,7 +272,7 @@ vector<Rect> findContoursOrigin(const Mat& image) {
 }
 
 
-vector<Rect> findContoursPart3(const Mat& image) {
+vector<Rect> findContoursPart3(const Mat& image, const BlockParams &params) {
     vector<vector<Point>> contours;
     findContours(image, contours, RETR_TREE, CHAIN_APPROX_SIMPLE);
 
@@ -378,7 +283,7 @@ vector<Rect> findContoursPart3(const Mat& image) {
     vector<Rect> boundingBoxes;
     for (const auto& contour : contours) {
         double area = contourArea(contour);
-        if (area < 20000 || area > 50000) {
+        if (area < params.part3MinArea || area > params.part3MaxArea) {
             continue;
         }
 
@@ -392,7 +297,7 @@ vector<Rect> findContoursPart3(const Mat& image) {
 
         double aspectRatio = (double)boundRect.width / boundRect.height;
         
-        if (aspectRatio < 0.35 || aspectRatio > 0.45) {
+        if (aspectRatio < params.part3MinAspect || aspectRatio > params.part3MaxAspect) {
             continue;
         }
 
@@ -429,14 +334,22 @@ vector<Rect> findContoursPart3(const Mat& image) {
 
 
 // Find and filter contours based on area and height, returning bounding boxes
-vector <Rect> extractBoundingBoxes(const Mat &originalImage) {
+vector <Rect> extractBoundingBoxes(const Mat &originalImage, bool coarseToFine, const BlockParams &params) {
 
-    // Tiền xử lý ảnh
-    Mat processedImage = preprocessOriginImage(originalImage.clone());
+    vector <Rect> boundingBoxes;
+    if (coarseToFine) {
+        boundingBoxes = findBlocksCoarseToFine(originalImage);
+    }
 
+    // Fall back to full-resolution detection when the coarse pass misses blocks
+    if (boundingBoxes.size() != EXPECTED_TOP_BLOCKS) {
+        // Tiền xử lý ảnh
+        Mat processedImage = preprocessOriginImage(originalImage, params);
 
-    // Tìm contours và bounding boxes
-    vector <Rect> boundingBoxes = findContoursOrigin(processedImage);
+
+        // Tìm contours và bounding boxes
+        boundingBoxes = findContoursOrigin(processedImage, params);
+    }
 
 
      // Tách part 3 thành các box riêng biệt
@@ -451,8 +364,8 @@ vector <Rect> extractBoundingBoxes(const Mat &originalImage) {
         Mat cropImage8 = originalImage(roi);
 
 
-        cropImage8 = preprocessPart3(cropImage8);
-        vector<Rect> boundingBoxesPart3 = findContoursPart3(cropImage8);
+        cropImage8 = preprocessPart3(cropImage8, params);
+        vector<Rect> boundingBoxesPart3 = findContoursPart3(cropImage8, params);
 
 
         // Xóa bounding box cũ của part 3
@@ -467,7 +380,7 @@ vector <Rect> extractBoundingBoxes(const Mat &originalImage) {
         // Kiểm ra aspect ratio của bounding box
         for (const auto& box : boundingBoxes) {
             double aspectRatio = (double)box.width / box.height;
-            if (aspectRatio < 0.35 || aspectRatio > 1.5) {
+            if (aspectRatio < params.part3MinAspect || aspectRatio > 1.5) {
                 // Xóa bounding box không hợp lệ
                 boundingBoxes.erase(remove(boundingBoxes.begin(), boundingBoxes.end(), box), boundingBoxes.end());
             }
@@ -476,15 +389,121 @@ vector <Rect> extractBoundingBoxes(const Mat &originalImage) {
     return boundingBoxes;
 }
 
-bool isContourFilled(const vector<Point>& contour, const Mat& image_threshold) {
+// A detected block in warp-free mode, with its centre in the sheet's own
+// axes (the image turned back by the sheet's tilt)
+struct TiltedBlock {
+    BlockFrame frame;
+    Rect box;
+    Point2f upright;
+};
+
+// Reading order on a tilted sheet: ContourPrecedenceComparator's rows of
+// 60 px, but measured on the upright centres, so a tilt cannot move a
+// block into the next row's band
+static void sortTiltedBlocks(vector<TiltedBlock> &blocks, double sheetAngle) {
+    double theta = sheetAngle * CV_PI / 180.0;
+    double c = cos(theta), s = sin(theta);
+    for (auto &block: blocks) {
+        Point2f center = block.frame.map(block.frame.width / 2, block.frame.height / 2);
+        block.upright = Point2f(static_cast<float>(center.x * c + center.y * s),
+                                static_cast<float>(center.y * c - center.x * s));
+    }
+    sort(blocks.begin(), blocks.end(), [](const TiltedBlock &a, const TiltedBlock &b) {
+        return a.upright.y < b.upright.y;
+    });
+    // Rows start wherever a centre is more than the tolerance below the row's first
+    size_t rowStart = 0;
+    for (size_t i = 1; i <= blocks.size(); i++) {
+        if (i == blocks.size() || blocks[i].upright.y - blocks[rowStart].upright.y > 60) {
+            sort(blocks.begin() + rowStart, blocks.begin() + i, [](const TiltedBlock &a, const TiltedBlock &b) {
+                return a.upright.x < b.upright.x;
+            });
+            rowStart = i;
+        }
+    }
+}
+
+// Warp-free variant of extractBoundingBoxes: keeps each block's tilt as a
+// BlockFrame so cells can be sampled from the unrotated image
+vector<BlockFrame> extractBlockFrames(const Mat &originalImage, const BlockParams &params) {
+    Mat processedImage = preprocessOriginImage(originalImage, params);
+
+    vector <vector<Point>> contours;
+    findContours(processedImage, contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
+
+    // Same filters as findContoursOrigin, keeping the 4 corners
+    vector<TiltedBlock> blocks;
+    for (const auto &contour: contours) {
+        if (contourArea(contour) < params.minBlockArea) continue;
+        vector <Point> approx;
+        approxPolyDP(contour, approx, 0.04 * arcLength(contour, true), true);
+        if (approx.size() == 4) {
+            Rect boundRect = boundingRect(approx);
+            if (boundRect.y > processedImage.rows * 2 / 11) {
+                TiltedBlock block;
+                block.frame = BlockFrame::fromQuad(approx);
+                block.box = boundRect;
+                blocks.push_back(block);
+            }
+        }
+    }
+    if (blocks.empty()) {
+        return vector<BlockFrame>();
+    }
+
+    // Sheet rotation: median tilt of the blocks, needed before they can be ordered
+    vector<double> angles;
+    for (const auto &block: blocks) {
+        angles.push_back(block.frame.angle());
+    }
+    nth_element(angles.begin(), angles.begin() + angles.size() / 2, angles.end());
+    double sheetAngle = angles[angles.size() / 2];
+    sortTiltedBlocks(blocks, sheetAngle);
+
+    vector<BlockFrame> frames;
+    for (const auto &block: blocks) {
+        frames.push_back(block.frame);
+    }
+    if (frames.size() > 8) {
+        // Part 3 columns are located as in extractBoundingBoxes and given the sheet's tilt
+        Rect box8 = blocks[8].box;
+        Rect roi(max(0, box8.x - 10), max(0, box8.y - 10),
+                    min(originalImage.cols - (box8.x - 10), box8.width + 20),
+                    min(originalImage.rows - (box8.y - 10), box8.height + 20));
+        vector<Rect> boundingBoxesPart3 = findContoursPart3(preprocessPart3(originalImage(roi), params), params);
+
+        // The columns form one row of the upright sheet
+        vector<TiltedBlock> columns;
+        for (const auto &box: boundingBoxesPart3) {
+            TiltedBlock column;
+            column.box = Rect(box.x + roi.x, box.y + roi.y, box.width, box.height);
+            column.frame = BlockFrame::fromBoundingRect(column.box, sheetAngle);
+            columns.push_back(column);
+        }
+        sortTiltedBlocks(columns, sheetAngle);
+        frames.erase(frames.begin() + 8);
+        for (const auto &column: columns) {
+            frames.push_back(column.frame);
+        }
+
+        frames.erase(remove_if(frames.begin(), frames.end(), [&params](const BlockFrame &frame) {
+            double aspectRatio = frame.width / frame.height;
+            return aspectRatio < params.part3MinAspect || aspectRatio > 1.5;
+        }), frames.end());
+    }
+    return frames;
+}
+
+// Fraction of the contour's bounding box that is inked in the threshold image
+double contourFillRatio(const vector<Point>& contour, const Mat& image_threshold) {
     Rect boundingBox = boundingRect(contour);
     Mat image_roi = image_threshold(boundingBox);
     double filledArea = countNonZero(image_roi);
-    return filledArea / (boundingBox.width*boundingBox.height) > 0.5;
+    return filledArea / (boundingBox.width*boundingBox.height);
 }
 
 // Check for a circular mark indicating an answer in the choice image
-OptionalPoint detectChoiceCircle(const Mat &choiceImage, int binaryThreshold = 200) {
+OptionalPoint detectChoiceCircle(const Mat &choiceImage, int binaryThreshold) {
     Mat gray, thresh;
     cvtColor(choiceImage, gray, COLOR_BGR2GRAY);
     // threshold(blurred, thresh, 220, 255, THRESH_BINARY_INV);
@@ -500,15 +519,34 @@ OptionalPoint detectChoiceCircle(const Mat &choiceImage, int binaryThreshold = 2
             Point2f center;
             float radius;
             minEnclosingCircle(contour, center, radius);
-            if(isContourFilled(contour, thresh)) {
-                return {true, Point(static_cast<int>(center.x), static_cast<int>(center.y))};
+            float fill = static_cast<float>(contourFillRatio(contour, thresh));
+            if(fill > 0.5) {
+                return {true, Point(static_cast<int>(center.x), static_cast<int>(center.y)), fill};
             }
             else{
-                return {false, Point(static_cast<int>(center.x), static_cast<int>(center.y))};
+                return {false, Point(static_cast<int>(center.x), static_cast<int>(center.y)), fill};
             }
         }
     }
-    return {false, Point(0, 0)};
+    return {false, Point(0, 0), 0};
+}
+
+// Detection result in working-image coordinates for the block-local `cell`
+// it was sampled from; an empty cell without a bubble outline falls back to
+// the cell centre
+static CellMark markCell(const BlockFrame &frame, const Rect &cell, const OptionalPoint &detected) {
+    CellMark mark;
+    mark.filled = detected.hasValue;
+    mark.fill = detected.fill;
+    Point2f at;
+    if (detected.hasValue || (detected.value.x != 0 && detected.value.y != 0)) {
+        at = frame.map(cell.x + detected.value.x, cell.y + detected.value.y);
+    } else {
+        at = frame.map(cell.x + cell.width / 2, cell.y + cell.height / 2);
+    }
+    mark.x = cvRound(at.x);
+    mark.y = cvRound(at.y);
+    return mark;
 }
 
 int findCorrectIndex(const vector<int>& correctChoices) {
@@ -560,8 +598,10 @@ void parseCorrectAnswers(const char* json, vector<vector<int>>& part1CorrectChoi
         const char* correctResult = questionPart3->valuestring;
         int index = 0;
         for (char c : string(correctResult)) {
-            int choiceIndex = subChoicePart3Reversed[string(1, c)];
-            part3CorrectChoices[questionNumber - 1][choiceIndex - 1][index] = 1;
+            int row = subChoicePart3Row(c);
+            if (row >= 0) {
+                part3CorrectChoices[questionNumber - 1][row][index] = 1;
+            }
             index++;
         }
         questionPart3 = questionPart3->next;
@@ -572,73 +612,270 @@ void parseCorrectAnswers(const char* json, vector<vector<int>>& part1CorrectChoi
 
 
 
-// ___________________________
-// Avoiding name mangling for cross-platform compatibility
-extern "C"
-{
+// All stages on the calling thread. Taking the image by value lets callers
+// that own the only reference move it in, so it is freed once deskewed.
+static void gradeDecoded(Mat image, const char *outputPath, const EngineOptions &options, AllocTracker &alloc,
+                         GradeResult &result) {
+    RegisteredSheet sheet;
+    sheet.annotate = outputPath != nullptr && outputPath[0] != '\0';
+    bool registered;
+    {
+        TraceSpan span("register");
+        AllocScope scope(alloc, ALLOC_STAGE_REGISTER);
+        registered = registerSheet(std::move(image), options, sheet, result);
+    }
+    if (registered && !stopIfCancelled(result)) {
+        {
+            TraceSpan span("grade");
+            AllocScope scope(alloc, ALLOC_STAGE_GRADE);
+            gradeCells(sheet, result);
+        }
+        if (result.graded && !stopIfCancelled(result)) {
+            TraceSpan span("encode");
+            AllocScope scope(alloc, ALLOC_STAGE_ENCODE);
+            writeAnnotated(outputPath, sheet, result);
+        }
+    }
+    alloc.report(result.allocations);
+}
 
-FUNCTION_ATTRIBUTE
-const char *version() {
-    return CV_VERSION;
+// Run the full grading pipeline, filling `result` at whichever stage it stops.
+// Untraced: only the outermost entry point opens the TraceCall, so a trace
+// file is written once per call
+static void gradeImageFile(const char *imgPath, const char *outputPath, const EngineOptions &options,
+                           GradeResult &result) {
+    TraceSpan traceSpan("grade_image", imgPath);
+    CancelScope cancelScope(options.cancelToken);
+    auto begin = chrono::steady_clock::now();
+    if (stopIfCancelled(result)) {
+        recordGrade(result, begin);
+        return;
+    }
+    AllocTracker alloc;
+    if (options.allocStats) {
+        alloc.start();
+    }
+    // Đọc ảnh từ đường dẫn
+    Mat originalImage;
+    {
+        TraceSpan span("decode");
+        AllocScope scope(alloc, ALLOC_STAGE_DECODE);
+        originalImage = decodeImage(imgPath, options, result);
+    }
+
+    if (originalImage.empty()) {
+        result.statusCode = STATUS_ERROR;
+        result.error = "Image not found";
+        recordGrade(result, begin);
+        return;
+
+    }
+    gradeDecoded(std::move(originalImage), outputPath, options, alloc, result);
+    recordGrade(result, begin);
 }
 
-// Main function for processing the image
-FUNCTION_ATTRIBUTE
-const char *process_image(const char *imgPath, const char *outputPath, const char * json) {
-    // Initialize vectors to store correct choices for each part
-    // vector<vector<int>> part1CorrectChoices(40, vector<int>(4, 0));
-    // vector<vector<vector<int>>> part2CorrectChoices(8, vector<vector<int>>(4, vector<int>(2, 0)));
-    // vector<vector<vector<int>>> part3CorrectChoices(6, vector<vector<int>>(12, vector<int>(4, 0)));
+void gradeImage(const char *imgPath, const char *outputPath, const EngineOptions &options, GradeResult &result) {
+    TraceCall traceCall(options.tracePath);
+    gradeImageFile(imgPath, outputPath, options, result);
+}
 
-    // Parse the correct answers from the provided JSON string
-    // parseCorrectAnswers(json, part1CorrectChoices, part2CorrectChoices, part3CorrectChoices);
+static void beginMemoryReport(const Size &fullSize, const Mat &decoded, const EngineOptions &options,
+                              GradeResult &result) {
+    result.memory.budgetBytes = options.memoryBudget;
+    if (!decoded.empty() && fullSize.width > 0) {
+        result.memory.scale = static_cast<double>(decoded.cols) / fullSize.width;
+    }
+    result.memory.modelledPeakBytes = max(result.memory.modelledPeakBytes, matBytes(decoded));
+}
 
-    // Create a JSON object to store the results
-    cJSON *root = cJSON_CreateObject();
-    cJSON_AddStringToObject(root, "version", "15");
-    cJSON *answersJson = cJSON_AddObjectToObject(root, "answers");
+Mat decodeImage(const char *path, const EngineOptions &options, GradeResult &result) {
+    StageTimer timer(STATS_STAGE_DECODE);
+    Size fullSize;
+    int flags = IMREAD_COLOR;
+    if (options.memoryBudget > 0 && peekImageSize(path, fullSize)) {
+        flags = reducedReadFlag(budgetScale(fullSize, options.memoryBudget, !options.warpFree));
+    }
+    Mat image = imread(path, flags);
+    if (image.empty()) {
+        recordFailure(STATS_FAILURE_DECODE);
+    }
+    if (options.memoryBudget > 0) {
+        beginMemoryReport(fullSize, image, options, result);
+    }
+    return image;
+}
 
-    // Đọc ảnh từ đường dẫn
-    Mat originalImage = imread(imgPath);
+Mat decodeImage(const vector<uchar> &bytes, const EngineOptions &options, GradeResult &result) {
+    StageTimer timer(STATS_STAGE_DECODE);
+    Size fullSize;
+    int flags = IMREAD_COLOR;
+    if (options.memoryBudget > 0 && peekImageSize(bytes.data(), bytes.size(), fullSize)) {
+        flags = reducedReadFlag(budgetScale(fullSize, options.memoryBudget, !options.warpFree));
+    }
+    Mat image = imdecode(bytes, flags);
+    if (image.empty()) {
+        recordFailure(STATS_FAILURE_DECODE);
+    }
+    if (options.memoryBudget > 0) {
+        beginMemoryReport(fullSize, image, options, result);
+    }
+    return image;
+}
 
-    if (originalImage.empty()) {
-        cJSON_AddNumberToObject(root, "status_code", 1);
-        cJSON_AddStringToObject(root, "error", "Image not found");
-    
-        // Chuyển object JSON thành chuỗi
-        char* jsonString = cJSON_Print(root);
-        
-        // Cấp phát bộ nhớ động cho chuỗi JSON (nhớ giải phóng sau khi sử dụng)
-        char* jsonResult = (char*)malloc(strlen(jsonString) + 1);
-        strcpy(jsonResult, jsonString);
-        
-        // Giải phóng bộ nhớ
-        cJSON_Delete(root);
-        free(jsonString); // Giải phóng chuỗi cJSON tạo ra
-        
-        return jsonResult;
+// One rung of the retry ladder
+static vector<BlockFrame> detectBlocks(const Mat &image, const EngineOptions &options, int variant) {
+    const BlockParams &params = detectionVariant(variant).params;
+    if (options.warpFree) {
+        return extractBlockFrames(image, params);
+    }
+    // The coarse pass only knows the default parameters
+    vector<BlockFrame> frames;
+    for (const auto &box: extractBoundingBoxes(image, options.coarseToFine && variant == 0, params)) {
+        frames.push_back(BlockFrame::fromRect(box));
+    }
+    return frames;
+}
 
+// Walk the retry ladder on the deskewed image until a rung finds every block
+// or options.retryBudgetMs has passed since the default attempt. Only block
+// detection is repeated. When no rung succeeds `frames` keeps the default
+// attempt's blocks and its exception, if any, is rethrown, so the failure
+// reads as it did without retries.
+static void findBlocks(const Mat &image, const EngineOptions &options, vector<BlockFrame> &frames,
+                       DetectionReport &report) {
+    exception_ptr defaultError;
+    chrono::steady_clock::time_point retriesBegin;
+    for (int variant = 0; variant < DETECTION_VARIANT_COUNT; variant++) {
+        if (variant > 0) {
+            if (options.retryBudgetMs <= 0 || cancelRequested()) {
+                break;
+            }
+            if (chrono::steady_clock::now() - retriesBegin >= chrono::milliseconds(options.retryBudgetMs)) {
+                report.budgetExhausted = true;
+                break;
+            }
+        }
+        vector<BlockFrame> found;
+        bool failed = false;
+        try {
+            TraceSpan span(variant == 0 ? "detect_blocks" : "detect_retry", variant);
+            found = detectBlocks(image, options, variant);
+        } catch (const exception &) {
+            if (variant == 0) {
+                defaultError = current_exception();
+            }
+            failed = true;
+        }
+        report.attempts++;
+        if (variant == 0) {
+            frames = found;
+            retriesBegin = chrono::steady_clock::now();
+        }
+        if (!failed && found.size() == EXPECTED_BLOCKS) {
+            report.variant = variant;
+            frames = std::move(found);
+            break;
+        }
+    }
+    if (report.attempts > 1) {
+        report.retryMs = chrono::duration<double, milli>(chrono::steady_clock::now() - retriesBegin).count();
+        OMR_LOG_INFO("block retry: variant %s after %d attempts, %.1f ms",
+                     report.variant >= 0 ? detectionVariant(report.variant).name : "none", report.attempts,
+                     report.retryMs);
+    }
+    if (report.variant < 0 && defaultError) {
+        rethrow_exception(defaultError);
     }
-    // Rotate the image
-    originalImage = rotateImageVertically(originalImage.clone(), 20.0);
-    originalImage = rotateImageHorizontally(originalImage.clone(), 20.0);
+}
 
-    // Resize the image to a fixed height
-    originalImage = resizeImage(originalImage, 1280);
-    
+bool registerSheet(Mat image, const EngineOptions &options, RegisteredSheet &sheet, GradeResult &result) {
+    StageTimer timer(STATS_STAGE_REGISTER);
+    Mat originalImage = image;
+    image.release();
+    MemoryTrace trace;
+    trace.note(max(result.memory.modelledPeakBytes, matBytes(originalImage)));
+    result.memory.budgetBytes = options.memoryBudget;
 
+    if (stopIfCancelled(result)) {
+        return false;
+    }
+    // Bail out early on photos the pipeline cannot possibly grade
+    if (options.precheck) {
+        TraceSpan span("precheck");
+        result.checked = true;
+        result.capture = checkCapture(originalImage);
+        if (result.capture.reason != CAPTURE_OK) {
+            result.statusCode = STATUS_REJECTED;
+            result.error = captureReasonMessage(result.capture.reason);
+            OMR_LOG_INFO("capture rejected: %s", result.error);
+            return false;
+        }
+    }
+    // Over budget: finish shrinking what the decoder could not (non-JPEG, or
+    // between its power-of-two steps) before any full-resolution work
+    if (options.memoryBudget > 0) {
+        double scale = budgetScale(originalImage.size(), options.memoryBudget, !options.warpFree);
+        if (scale < 1) {
+            Mat scaled;
+            resize(originalImage, scaled, Size(), scale, scale, INTER_AREA);
+            trace.note(matBytes(originalImage) + matBytes(scaled));
+            originalImage = scaled;
+            result.memory.scale *= scale;
+        }
+    }
 
-    Mat outputImage = originalImage.clone();
+    if (stopIfCancelled(result)) {
+        return false;
+    }
+    // Rotate the image; warp-free mode maps cell geometry onto the tilted sheet instead.
+    // Each step replaces originalImage, so at most the input and its rotated copy are alive
+    if (!options.warpFree) {
+        TraceSpan span("deskew");
+        // Line detection adds a gray and an edge plane
+        trace.note(matBytes(originalImage) + 2 * static_cast<long long>(originalImage.total()));
+        Mat rotated = rotateImageVertically(originalImage, 20.0);
+        trace.note(matBytes(originalImage) + (rotated.data != originalImage.data ? matBytes(rotated) : 0));
+        originalImage = rotated;
+        rotated = rotateImageHorizontally(originalImage, 20.0);
+        trace.note(matBytes(originalImage) + (rotated.data != originalImage.data ? matBytes(rotated) : 0));
+        originalImage = rotated;
+    }
 
-    vector <Rect> boundingBoxes;
+    // Resize the image to a fixed height
+    Mat resized = resizeImage(originalImage, 1280);
+    trace.note(matBytes(originalImage) + matBytes(resized));
+    originalImage = resized;
+    resized.release();
+
+    sheet.image = originalImage;
+    // Annotations are drawn on a copy, only made when an output image is wanted
+    if (sheet.annotate) {
+        sheet.annotated = originalImage.clone();
+    }
+    Mat &outputImage = sheet.annotated;
+    // Working image, annotated copy and the two binarization planes
+    trace.note(matBytes(sheet.image) + matBytes(sheet.annotated) + 2 * static_cast<long long>(sheet.image.total()));
+    result.memory.modelledPeakBytes = trace.peakBytes;
+    result.memory.overBudget = options.memoryBudget > 0 && trace.peakBytes > options.memoryBudget;
+
+    if (stopIfCancelled(result)) {
+        return false;
+    }
+    vector <BlockFrame> &blockFrames = sheet.blockFrames;
+    TraceSpan blocksSpan("find_blocks");
+    bool countMismatch = false;
     try {
-        // Extract bounding boxes from the image
-        boundingBoxes = extractBoundingBoxes(originalImage);
+        // Extract bounding boxes from the image, retrying other parameters when blocks are missed
+        findBlocks(originalImage, options, blockFrames, result.detection);
+        if (stopIfCancelled(result)) {
+            return false;
+        }
         
         // Vẽ bounding boxes lên ảnh
-        if (DRAW_BOXES) {
+        if (DRAW_BOXES && !outputImage.empty()) {
             int count = 1;
-            for (const auto &box: boundingBoxes) {
+            for (const auto &frame: blockFrames) {
+                Rect box = frame.cellRect(0, 0, static_cast<int>(frame.width), static_cast<int>(frame.height));
                 rectangle(outputImage, Point(box.x, box.y), Point(box.x + box.width, box.y + box.height),
                         Scalar(0, 255, 0), 2);
                 putText(outputImage, to_string(count), Point(box.x, box.y), FONT_HERSHEY_SIMPLEX, 1,
@@ -646,33 +883,91 @@ const char *process_image(const char *imgPath, const char *outputPath, const cha
                 count++;
             }
         }
-        if(boundingBoxes.size() != 14) {
-            throw runtime_error("Found " + to_string(boundingBoxes.size()) + " bounding boxes, expected 14");
+        if(blockFrames.size() != EXPECTED_BLOCKS) {
+            countMismatch = true;
+            throw runtime_error("Found " + to_string(blockFrames.size()) + " bounding boxes, expected 14");
         }
     } catch (const exception &e) {
-        cJSON_AddNumberToObject(root, "status_code", 1);
-        cJSON_AddStringToObject(root, "error", e.what());
-        // Chuyển object JSON thành chuỗi
-        char* jsonString = cJSON_Print(root);
-        
-        // Cấp phát bộ nhớ động cho chuỗi JSON (nhớ giải phóng sau khi sử dụng)
-        char* jsonResult = (char*)malloc(strlen(jsonString) + 1);
-        strcpy(jsonResult, jsonString);
-        
-        // Giải phóng bộ nhớ
-        cJSON_Delete(root);
-        free(jsonString); // Giải phóng chuỗi cJSON tạo ra
-        
-        return jsonResult;
+        result.statusCode = STATUS_ERROR;
+        result.error = e.what();
+        recordFailure(countMismatch ? STATS_FAILURE_BLOCK_COUNT : STATS_FAILURE_REGISTER);
+        if (countMismatch) {
+            recordBlockCount(static_cast<int>(blockFrames.size()));
+        }
+        OMR_LOG_WARN("register: %s", result.error);
+        return false;
+    }
+
+    // Warp-free: the header grids are as tilted as the blocks
+    if (options.warpFree) {
+        vector<double> angles;
+        for (const auto &frame: blockFrames) {
+            angles.push_back(frame.angle());
+        }
+        nth_element(angles.begin(), angles.begin() + angles.size() / 2, angles.end());
+        sheet.sheetAngle = angles[angles.size() / 2];
+    }
+
+    // The header grids sit above part 1, which extractBoundingBoxes skips
+    int headerBottom = originalImage.rows;
+    for (int i = 0; i < 4; i++) {
+        headerBottom = min(headerBottom, blockFrames[i].cellRect(0, 0, 1, 1).y);
     }
+    sheet.hasHeader = findHeaderGrids(originalImage, headerBottom, sheet.studentIdGrid, sheet.examCodeGrid);
+    return true;
+}
+
+// One digit per column: the row of its single marked bubble. `grid` is the
+// bounding box of a table tilted by sheetAngle; its cells are sampled
+// through a BlockFrame like the answer cells.
+static string readHeaderGrid(const Mat &image, const Rect &grid, double sheetAngle, int columns, Mat &outputImage) {
+    BlockFrame frame = BlockFrame::fromBoundingRect(grid, sheetAngle);
+    Rect local(0, 0, cvRound(frame.width), cvRound(frame.height));
+    Rect bounds(0, 0, image.cols, image.rows);
+    string digits;
+    for (int col = 0; col < columns; col++) {
+        int marked = -1, marks = 0;
+        for (int row = 0; row < HEADER_GRID_ROWS; row++) {
+            Rect cell = headerCell(local, columns, col, row);
+            if (frame.ux == Point2f(1, 0)) {
+                // An upright grid is sampled as a view, which must stay inside the image
+                cell &= Rect(-grid.x, -grid.y, image.cols, image.rows);
+            }
+            if (cell.area() == 0 || (frame.cellRect(cell.x, cell.y, cell.width, cell.height) & bounds).area() == 0) {
+                continue;
+            }
+            Mat digitRegion = frame.sampleCell(image, cell.x, cell.y, cell.width, cell.height);
+            OptionalPoint detectedCircle = detectChoiceCircle(digitRegion, 200);
+            if (detectedCircle.hasValue) {
+                marked = row;
+                marks++;
+                if (DRAW_USER_CHOICE && !outputImage.empty()) {
+                    CellMark mark = markCell(frame, cell, detectedCircle);
+                    circle(outputImage, Point{mark.x, mark.y},
+                            DRAW_CIRCLE_RADIUS,
+                            DRAW_CHOICE_COLOR, DRAW_CIRCLE_THICKNESS);
+                }
+            }
+        }
+        digits += marks == 1 ? static_cast<char>('0' + marked) : HEADER_UNREADABLE;
+    }
+    return digits;
+}
+
+void gradeCells(RegisteredSheet &sheet, GradeResult &result) {
+    StageTimer timer(STATS_STAGE_GRADE);
+    const Mat &originalImage = sheet.image;
+    Mat &outputImage = sheet.annotated;
+    const vector<BlockFrame> &blockFrames = sheet.blockFrames;
 
     // Part 1
-    vector<part1Answer> part1Answers;
+    vector<part1Answer> &part1Answers = result.part1Answers;
     try {
-        vector<vector<int>> part1UserChoices(40, vector<int>(4, 0));
-        vector<vector<Point>> part1ChoicePoints(40, vector<Point>(4, Point(0, 0))); 
-        for (int boundingBoxIndex = 0; boundingBoxIndex < min(4, static_cast<int>(boundingBoxes.size())); boundingBoxIndex++) {
-            Rect bbox = boundingBoxes[boundingBoxIndex];
+        for (int boundingBoxIndex = 0; boundingBoxIndex < min(4, static_cast<int>(blockFrames.size())); boundingBoxIndex++) {
+            if (stopIfCancelled(result)) {
+                return;
+            }
+            const BlockFrame &bbox = blockFrames[boundingBoxIndex];
             int yOffset = bbox.height * 0.09;
             int xOffset = bbox.width * 0.2;
             int yPadding = bbox.height*0.095, xPadding = bbox.width*0.154;
@@ -681,97 +976,75 @@ const char *process_image(const char *imgPath, const char *outputPath, const cha
                 bool choiceIsCorrectFlag = true;
                 for (int colIndex = 0; colIndex < 4; colIndex++) {
                     int linearIndex = boundingBoxIndex * 10 + rowIndex;
-                    int x = bbox.x + xPadding + xOffset * colIndex + 1;
-                    int y = bbox.y + yPadding + yOffset * rowIndex + 1;
+                    int x = xPadding + xOffset * colIndex + 1;
+                    int y = yPadding + yOffset * rowIndex + 1;
                     int width = xOffset + 1;
                     int height = yOffset + 1;
-                    Mat choiceRegion = originalImage(Rect(x, y, width, height));
+                    Rect cell(x, y, width, height);
+                    Mat choiceRegion = bbox.sampleCell(originalImage, x, y, width, height);
                     OptionalPoint detectedCircle = detectChoiceCircle(choiceRegion, 200);
+                    CellMark &mark = result.part1Cells[linearIndex][colIndex];
+                    mark = markCell(bbox, cell, detectedCircle);
+                    OMR_LOG_TRACE("part 1 q%d %s fill %.3f", linearIndex + 1, choicePart1[colIndex], mark.fill);
                     // bool isCorrect = part1CorrectChoices[linearIndex][colIndex] == 1;
                     if(detectedCircle.hasValue) {
-                        part1Answer answer = {to_string(boundingBoxIndex*10 + rowIndex + 1), choicePart1[colIndex + 1]};
+                        part1Answer answer = {to_string(boundingBoxIndex*10 + rowIndex + 1), choicePart1[colIndex]};
                         part1Answers.push_back(answer);
-                        part1UserChoices[linearIndex][colIndex] = 1;
-                        part1ChoicePoints[linearIndex][colIndex] = Point{x + detectedCircle.value.x, y + detectedCircle.value.y};
-                        if (DRAW_USER_CHOICE) {
-                            circle(outputImage, Point{x + detectedCircle.value.x, y + detectedCircle.value.y},
+                        if (DRAW_USER_CHOICE && !outputImage.empty()) {
+                            circle(outputImage, Point{mark.x, mark.y},
                                     DRAW_CIRCLE_RADIUS,
                                     DRAW_CHOICE_COLOR, DRAW_CIRCLE_THICKNESS);
                         }
                     }
-                    else{
-                        part1UserChoices[linearIndex][colIndex] = 0;
-                        if(detectedCircle.value.x!=0 && detectedCircle.value.y!=0){
-                            part1ChoicePoints[linearIndex][colIndex] = Point{x + detectedCircle.value.x, y + detectedCircle.value.y};
-                        }
-                        else{
-                            part1ChoicePoints[linearIndex][colIndex] = Point{x + width / 2, y + height / 2};
-                        }
-            
-                    }
                 }
 
             }
         }
     }
     catch (const exception &e) {
-        cJSON_AddNumberToObject(root, "status_code", 1);
-        cJSON_AddStringToObject(root, "error", e.what());
-        // Chuyển object JSON thành chuỗi
-        char* jsonString = cJSON_Print(root);
-        
-        // Cấp phát bộ nhớ động cho chuỗi JSON (nhớ giải phóng sau khi sử dụng)
-        char* jsonResult = (char*)malloc(strlen(jsonString) + 1);
-        strcpy(jsonResult, jsonString);
-        
-        // Giải phóng bộ nhớ
-        cJSON_Delete(root);
-        free(jsonString); // Giải phóng chuỗi cJSON tạo ra
-        
-        return jsonResult;
+        result.statusCode = STATUS_ERROR;
+        result.error = e.what();
+        recordFailure(STATS_FAILURE_GRADE);
+        return;
     }
     
 
     // Part 2
-    vector<part2Answer> part2Answers;
+    vector<part2Answer> &part2Answers = result.part2Answers;
     try{
-        vector<vector<vector<int>>> part2UserChoices(8, vector<vector<int>>(4, vector<int>(2, 0)));
-        vector<vector<vector<Point>>> part2ChoicePoints(8, vector<vector<Point>>(4, vector<Point>(2, Point(0, 0))));
-        for (int boundingBoxIndex = 4; boundingBoxIndex < 8 && boundingBoxIndex < boundingBoxes.size(); boundingBoxIndex++) {
-            Rect bbox = boundingBoxes[boundingBoxIndex];
+        for (int boundingBoxIndex = 4; boundingBoxIndex < 8 && boundingBoxIndex < blockFrames.size(); boundingBoxIndex++) {
+            if (stopIfCancelled(result)) {
+                return;
+            }
+            const BlockFrame &bbox = blockFrames[boundingBoxIndex];
             int yOffset = bbox.height * 0.15;
             int xOffset = bbox.width * 0.21;
             int yPadding = bbox.height*0.347, xPadding = bbox.width*0.123;
             int blockIndex = boundingBoxIndex - 4;
             for (int rowIndex = 0; rowIndex < 4; rowIndex++) {
                 for (int colIndex = 0; colIndex < 4; colIndex++) {
-                    int x = bbox.x + xPadding + xOffset * colIndex + 1;
-                    int y = bbox.y + yPadding + yOffset * rowIndex + 1;
+                    int x = xPadding + xOffset * colIndex + 1;
+                    int y = yPadding + yOffset * rowIndex + 1;
                     int width = xOffset + 1;
                     int height = yOffset + 1;
-                    Mat choiceRegion = originalImage(Rect(x, y, width, height));
+                    Rect cell(x, y, width, height);
+                    Mat choiceRegion = bbox.sampleCell(originalImage, x, y, width, height);
                     int questionNumberIndex = blockIndex * 2 + colIndex / 2;
                     OptionalPoint detectedCircle = detectChoiceCircle(choiceRegion, 200);
 
                     int choiceIndex = colIndex % 2;
+                    CellMark &mark = result.part2Cells[questionNumberIndex][rowIndex][choiceIndex];
+                    mark = markCell(bbox, cell, detectedCircle);
+                    OMR_LOG_TRACE("part 2 q%d%s %s fill %.3f", questionNumberIndex + 1, subQuestionPart2[rowIndex],
+                                  choiceIndex == 0 ? "yes" : "no", mark.fill);
                     if (detectedCircle.hasValue) {
-                        part2UserChoices[questionNumberIndex][rowIndex][choiceIndex] = 1;
-                        part2ChoicePoints[questionNumberIndex][rowIndex][choiceIndex] = Point{x + detectedCircle.value.x, y + detectedCircle.value.y};
-                        part2Answer answer = {to_string(questionNumberIndex + 1), subQuestionPart2[rowIndex + 1], choiceIndex==0};
+                        part2Answer answer = {to_string(questionNumberIndex + 1), subQuestionPart2[rowIndex], choiceIndex==0};
                         part2Answers.push_back(answer);
-                        if (DRAW_USER_CHOICE) {
-                            circle(outputImage, Point{x + detectedCircle.value.x, y + detectedCircle.value.y},
+                        if (DRAW_USER_CHOICE && !outputImage.empty()) {
+                            circle(outputImage, Point{mark.x, mark.y},
                                     DRAW_CIRCLE_RADIUS,
                                     DRAW_CHOICE_COLOR, DRAW_CIRCLE_THICKNESS);
                         }
-                    } else{
-                        part2UserChoices[questionNumberIndex][rowIndex][choiceIndex] = 0;
-                        if(detectedCircle.value.x!=0 && detectedCircle.value.y!=0){
-                            part2ChoicePoints[questionNumberIndex][rowIndex][choiceIndex] = Point{x + detectedCircle.value.x, y + detectedCircle.value.y};
-                        }
-                        else{
-                            part2ChoicePoints[questionNumberIndex][rowIndex][choiceIndex] = Point{x + width / 2, y + height / 2};
-                        }
                     }
                 }        
             }
@@ -786,29 +1059,20 @@ const char *process_image(const char *imgPath, const char *outputPath, const cha
         return a.subName < b.subName; });
     }
     catch (const exception &e) {
-        cJSON_AddNumberToObject(root, "status_code", 1);
-        cJSON_AddStringToObject(root, "error", e.what());
-        // Chuyển object JSON thành chuỗi
-        char* jsonString = cJSON_Print(root);
-        
-        // Cấp phát bộ nhớ động cho chuỗi JSON (nhớ giải phóng sau khi sử dụng)
-        char* jsonResult = (char*)malloc(strlen(jsonString) + 1);
-        strcpy(jsonResult, jsonString);
-        
-        // Giải phóng bộ nhớ
-        cJSON_Delete(root);
-        free(jsonString); // Giải phóng chuỗi cJSON tạo ra
-        
-        return jsonResult;
+        result.statusCode = STATUS_ERROR;
+        result.error = e.what();
+        recordFailure(STATS_FAILURE_GRADE);
+        return;
     }
 
     //Part 3
-    vector<part3Answer> part3Answers;
+    vector<part3Answer> &part3Answers = result.part3Answers;
     try {
-        vector<vector<vector<int>>> part3UserChoices(6, vector<vector<int>>(12, vector<int>(4, 0)));
-        vector<vector<vector<Point>>> part3ChoicePoints(6, vector<vector<Point>>(12, vector<Point>(4, Point(0, 0))));
-        for (int boundingBoxIndex = 8; boundingBoxIndex < min(14, static_cast<int>(boundingBoxes.size())); boundingBoxIndex++) {
-            Rect bbox = boundingBoxes[boundingBoxIndex];
+        for (int boundingBoxIndex = 8; boundingBoxIndex < min(14, static_cast<int>(blockFrames.size())); boundingBoxIndex++) {
+            if (stopIfCancelled(result)) {
+                return;
+            }
+            const BlockFrame &bbox = blockFrames[boundingBoxIndex];
             int yOffset = bbox.height * 0.07;
             int xOffset = bbox.width * 0.19;
             int yPadding = bbox.height*0.1625, xPadding = bbox.width*0.18;
@@ -817,33 +1081,28 @@ const char *process_image(const char *imgPath, const char *outputPath, const cha
             string userResult = "";
             for (int colIndex = 0; colIndex < 4; colIndex++) {
                 for (int rowIndex = 0; rowIndex < 12; rowIndex++) {
-                    int x = bbox.x + xPadding + xOffset * colIndex + 1;
-                    int y = bbox.y + yPadding + yOffset * rowIndex + 1;
+                    int x = xPadding + xOffset * colIndex + 1;
+                    int y = yPadding + yOffset * rowIndex + 1;
                     int width = xOffset + 1;
                     int height = yOffset + 1;
 
-                    Mat choiceRegion = originalImage(Rect(x, y, width, height));
+                    Rect cell(x, y, width, height);
+                    Mat choiceRegion = bbox.sampleCell(originalImage, x, y, width, height);
                     OptionalPoint detectedCircle = detectChoiceCircle(choiceRegion, 200);
+                    CellMark &mark = result.part3Cells[blockIndex][rowIndex][colIndex];
+                    mark = markCell(bbox, cell, detectedCircle);
+                    OMR_LOG_TRACE("part 3 q%d digit %d %c fill %.3f", blockIndex + 1, colIndex + 1,
+                                  subChoicePart3[rowIndex], mark.fill);
                     // bool isCorrect = part3CorrectChoices[blockIndex][rowIndex][colIndex] == 1;
 
                     if (detectedCircle.hasValue) {
-                        part3UserChoices[blockIndex][rowIndex][colIndex] = 1;
-                        part3ChoicePoints[blockIndex][rowIndex][colIndex] = Point{x + detectedCircle.value.x, y + detectedCircle.value.y};
-                        userResult += subChoicePart3[rowIndex + 1];
-                        if (DRAW_USER_CHOICE) {
-                            circle(outputImage, Point{x + detectedCircle.value.x, y + detectedCircle.value.y},
+                        userResult += subChoicePart3[rowIndex];
+                        if (DRAW_USER_CHOICE && !outputImage.empty()) {
+                            circle(outputImage, Point{mark.x, mark.y},
                                     DRAW_CIRCLE_RADIUS,
                                     DRAW_CHOICE_COLOR, DRAW_CIRCLE_THICKNESS);
                         }
 
-                    } else{
-                        part3UserChoices[blockIndex][rowIndex][colIndex] = 0;
-                        if(detectedCircle.value.x!=0 && detectedCircle.value.y!=0){
-                            part3ChoicePoints[blockIndex][rowIndex][colIndex] = Point{x + detectedCircle.value.x, y + detectedCircle.value.y};
-                        }
-                        else{
-                            part3ChoicePoints[blockIndex][rowIndex][colIndex] = Point{x + width / 2, y + height / 2};
-                        }
                     }
                 }
             }
@@ -854,91 +1113,663 @@ const char *process_image(const char *imgPath, const char *outputPath, const cha
         }
     }
     catch (const exception &e) {
-        cJSON_AddNumberToObject(root, "status_code", 1);
-        cJSON_AddStringToObject(root, "error", e.what());
-        // Chuyển object JSON thành chuỗi
-        char* jsonString = cJSON_Print(root);
-        
-        // Cấp phát bộ nhớ động cho chuỗi JSON (nhớ giải phóng sau khi sử dụng)
-        char* jsonResult = (char*)malloc(strlen(jsonString) + 1);
-        strcpy(jsonResult, jsonString);
-        
-        // Giải phóng bộ nhớ
-        cJSON_Delete(root);
-        free(jsonString); // Giải phóng chuỗi cJSON tạo ra
-        
-        return jsonResult;
+        result.statusCode = STATUS_ERROR;
+        result.error = e.what();
+        recordFailure(STATS_FAILURE_GRADE);
+        return;
+    }
+    // Identity, read in the same pass; a sheet without the grids still grades
+    if (stopIfCancelled(result)) {
+        return;
+    }
+    if (sheet.hasHeader) {
+        result.studentId = readHeaderGrid(originalImage, sheet.studentIdGrid, sheet.sheetAngle, HEADER_ID_DIGITS,
+                                          outputImage);
+        result.examCode = readHeaderGrid(originalImage, sheet.examCodeGrid, sheet.sheetAngle, HEADER_CODE_DIGITS,
+                                         outputImage);
+        result.headerRead = true;
     }
+
     if (part1Answers.size() + part2Answers.size() + part3Answers.size() == 0) {
-        cJSON_AddNumberToObject(root, "status_code", 2);
-        cJSON_AddStringToObject(root, "error", "No answers detected");
-        // Chuyển object JSON thành chuỗi
-        char* jsonString = cJSON_Print(root);
-        
-        // Cấp phát bộ nhớ động cho chuỗi JSON (nhớ giải phóng sau khi sử dụng)
-        char* jsonResult = (char*)malloc(strlen(jsonString) + 1);
-        strcpy(jsonResult, jsonString);
-        
-        // Giải phóng bộ nhớ
-        cJSON_Delete(root);
-        free(jsonString); // Giải phóng chuỗi cJSON tạo ra
-        
-        return jsonResult;
+        result.statusCode = STATUS_NO_ANSWERS;
+        result.error = "No answers detected";
+        return;
     }
 
-    cJSON *part1ResultJson = cJSON_AddObjectToObject(answersJson, "1");
-    cJSON *part2ResultJson = cJSON_AddObjectToObject(answersJson, "2");
-    cJSON *part3ResultJson = cJSON_AddObjectToObject(answersJson, "3");
+    result.graded = true;
+}
 
-    for (const auto &answer: part1Answers) {
-        cJSON_AddStringToObject(part1ResultJson, answer.questionNumber.c_str(), answer.userChoiceResult.c_str());
+void writeAnnotated(const char *outputPath, const RegisteredSheet &sheet, GradeResult &result) {
+    StageTimer timer(STATS_STAGE_ENCODE);
+    // An empty output path skips the annotated image (batch tools)
+    if (outputPath != nullptr && outputPath[0] != '\0' && !sheet.annotated.empty() &&
+        !imwrite(outputPath, sheet.annotated)) {
+        result.statusCode = STATUS_ERROR;
+        result.error = "Failed to save output image";
+        recordFailure(STATS_FAILURE_WRITE);
+        OMR_LOG_ERROR("cannot write %s", outputPath);
     }
+}
 
-    for (const auto& answer : part2Answers) {
-        cJSON *questionObj = cJSON_GetObjectItemCaseSensitive(part2ResultJson, answer.questionNumber.c_str());
-        if (questionObj == nullptr) {
-            questionObj = cJSON_CreateObject();
-            cJSON_AddItemToObject(part2ResultJson, answer.questionNumber.c_str(), questionObj);
+void gradeImage(const Mat &image, const char *outputPath, const EngineOptions &options, GradeResult &result) {
+    CancelScope cancelScope(options.cancelToken);
+    auto begin = chrono::steady_clock::now();
+    AllocTracker alloc;
+    if (options.allocStats) {
+        alloc.start();
+    }
+    gradeDecoded(image, outputPath, options, alloc, result);
+    recordGrade(result, begin);
+}
+
+static shared_ptr<ResultCache> resultCache;
+static mutex resultCacheMutex;
+
+bool setResultCache(const string &dir, long long maxBytes) {
+    shared_ptr<ResultCache> cache;
+    if (!dir.empty()) {
+        cache = make_shared<ResultCache>(dir, maxBytes);
+        if (!cache->valid()) {
+            return false;
         }
+    }
+    lock_guard<mutex> lock(resultCacheMutex);
+    resultCache = cache;
+    return true;
+}
+
+static shared_ptr<ResultCache> currentResultCache() {
+    lock_guard<mutex> lock(resultCacheMutex);
+    return resultCache;
+}
 
-        cJSON *boolValue = cJSON_CreateBool(answer.userChoiceResult);
-        cJSON_AddItemToObject(questionObj, answer.subName.c_str(), boolValue);
+static bool readFileBytes(const char *path, vector<uchar> &bytes) {
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    uchar chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        bytes.insert(bytes.end(), chunk, chunk + n);
     }
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
 
-    for (const auto &answer: part3Answers) {
-        cJSON_AddStringToObject(part3ResultJson, answer.questionNumber.c_str(), answer.userResult.c_str());
+// gradeEncodedJson without its TraceCall, for gradeImageJson
+static void gradeEncoded(vector<uchar> &bytes, const char *outputPath, const EngineOptions &options,
+                         ResultWriter &writer) {
+    // Allocation counts describe this run, never a cached one
+    shared_ptr<ResultCache> cache = options.allocStats ? nullptr : currentResultCache();
+    string key;
+    if (cache) {
+        TraceSpan span("cache_lookup");
+        key = cache->key(bytes, options);
+        string json;
+        if (cache->lookup(key, outputPath, json)) {
+            OMR_LOG_DEBUG("result cache hit %s", key);
+            recordCacheHit();
+            vector<uchar>().swap(bytes);
+            writer.raw(json.data(), json.size());
+            return;
+        }
     }
 
-    
-    if (!imwrite(outputPath, outputImage)) {
-        cJSON_AddNumberToObject(root, "status_code", 1);
-        cJSON_AddStringToObject(root, "error", "Failed to save output image");
-        // Chuyển object JSON thành chuỗi
-        char* jsonString = cJSON_Print(root);
-        
-        // Cấp phát bộ nhớ động cho chuỗi JSON (nhớ giải phóng sau khi sử dụng)
-        char* jsonResult = (char*)malloc(strlen(jsonString) + 1);
-        strcpy(jsonResult, jsonString);
-        
-        // Giải phóng bộ nhớ
-        cJSON_Delete(root);
-        free(jsonString); // Giải phóng chuỗi cJSON tạo ra
-        
-        return jsonResult;
+    GradeResult result;
+    CancelScope cancelScope(options.cancelToken);
+    auto begin = chrono::steady_clock::now();
+    AllocTracker alloc;
+    if (options.allocStats) {
+        alloc.start();
+    }
+    Mat image;
+    if (!stopIfCancelled(result)) {
+        TraceSpan span("decode");
+        AllocScope scope(alloc, ALLOC_STAGE_DECODE);
+        image = decodeImage(bytes, options, result);
+    }
+    vector<uchar>().swap(bytes);
+    bool decoded = !image.empty();
+    if (result.statusCode == STATUS_CANCELLED) {
+        decoded = false;
+    } else if (!decoded) {
+        result.statusCode = STATUS_ERROR;
+        result.error = "Image not found";
+    } else {
+        gradeDecoded(std::move(image), outputPath, options, alloc, result);
+    }
+    recordGrade(result, begin);
+    // Undecodable bytes, failed output writes, cancelled calls and retries
+    // cut short by the time budget say nothing lasting about the photo
+    if (!cache || !decoded || (result.graded && result.statusCode != STATUS_OK) ||
+        result.statusCode == STATUS_CANCELLED || result.detection.budgetExhausted) {
+        writeGradeResult(writer, result);
+        return;
     }
+    ResultWriter full;
+    writeGradeResult(full, result);
+    char *json = full.release();
+    {
+        TraceSpan span("cache_store");
+        cache->store(key, outputPath, result.graded, json);
+    }
+    writer.raw(json, strlen(json));
+    free(json);
+}
 
-    cJSON_AddNumberToObject(root, "status_code", 0);
-    // Chuyển object JSON thành chuỗi
-    char* jsonString = cJSON_Print(root);
-    
-    // Cấp phát bộ nhớ động cho chuỗi JSON (nhớ giải phóng sau khi sử dụng)
-    char* jsonResult = (char*)malloc(strlen(jsonString) + 1);
-    strcpy(jsonResult, jsonString);
-    
-    // Giải phóng bộ nhớ
-    cJSON_Delete(root);
-    free(jsonString); // Giải phóng chuỗi cJSON tạo ra
-    
-    return jsonResult;
+void gradeEncodedJson(vector<uchar> &bytes, const char *outputPath, const EngineOptions &options,
+                      ResultWriter &writer) {
+    TraceCall traceCall(options.tracePath);
+    gradeEncoded(bytes, outputPath, options, writer);
+}
+
+void gradeImageJson(const char *imgPath, const char *outputPath, const EngineOptions &options, ResultWriter &writer) {
+    TraceCall traceCall(options.tracePath);
+    TraceSpan traceSpan("process_image", imgPath);
+    GradeResult result;
+    if (options.allocStats || !currentResultCache()) {
+        gradeImageFile(imgPath, outputPath, options, result);
+        writeGradeResult(writer, result);
+        return;
+    }
+    vector<uchar> bytes;
+    if (!readFileBytes(imgPath, bytes) || bytes.empty()) {
+        result.statusCode = STATUS_ERROR;
+        result.error = "Image not found";
+        recordFailure(STATS_FAILURE_DECODE);
+        recordGrade(result, chrono::steady_clock::now());
+        writeGradeResult(writer, result);
+        return;
+    }
+    gradeEncoded(bytes, outputPath, options, writer);
+}
+
+string numberedOutputPath(const char *outputPath, size_t index) {
+    if (outputPath == nullptr || outputPath[0] == '\0') {
+        return "";
+    }
+    string path(outputPath);
+    size_t slash = path.find_last_of("/\\");
+    size_t dot = path.find_last_of('.');
+    if (dot == string::npos || (slash != string::npos && dot < slash)) {
+        dot = path.size();
+    }
+    return path.substr(0, dot) + "_" + to_string(index + 1) + path.substr(dot);
+}
+
+int gradeSheets(const char *imgPath, const char *outputPath, const EngineOptions &options,
+                vector<SheetResult> &sheets, string &error) {
+    TraceCall traceCall(options.tracePath);
+    TraceSpan traceSpan("process_sheets", imgPath);
+    CancelScope cancelScope(options.cancelToken);
+    if (cancelRequested()) {
+        error = "Cancelled";
+        return STATUS_CANCELLED;
+    }
+    Mat image;
+    {
+        TraceSpan span("decode");
+        image = imread(imgPath);
+    }
+    if (image.empty()) {
+        error = "Image not found";
+        recordFailure(STATS_FAILURE_DECODE);
+        return STATUS_ERROR;
+    }
+
+    vector<Rect> regions;
+    try {
+        regions = findSheetRegions(image);
+    } catch (const exception &e) {
+        error = e.what();
+        return STATUS_ERROR;
+    }
+    sheets.assign(regions.size(), SheetResult());
+    {
+        WorkerPool pool(static_cast<int>(min<size_t>(regions.size(), max(1u, thread::hardware_concurrency()))));
+        for (size_t i = 0; i < regions.size(); i++) {
+            pool.submit([&, i]() {
+                TraceSpan span("sheet", static_cast<long long>(i));
+                SheetResult &sheet = sheets[i];
+                sheet.x = regions[i].x;
+                sheet.y = regions[i].y;
+                sheet.width = regions[i].width;
+                sheet.height = regions[i].height;
+                string sheetOutput = numberedOutputPath(outputPath, i);
+                // One sheet failing leaves the others to be graded
+                try {
+                    gradeImage(image(regions[i]), sheetOutput.c_str(), options, sheet.result);
+                } catch (const exception &e) {
+                    sheet.result = GradeResult();
+                    sheet.result.statusCode = STATUS_ERROR;
+                    sheet.result.error = e.what();
+                } catch (...) {
+                    sheet.result = GradeResult();
+                    sheet.result.statusCode = STATUS_ERROR;
+                    sheet.result.error = "Unexpected error";
+                }
+            });
+        }
+    }
+
+    for (const auto &sheet: sheets) {
+        if (sheet.result.graded) {
+            return STATUS_OK;
+        }
+    }
+    if (cancelRequested()) {
+        error = "Cancelled";
+        return STATUS_CANCELLED;
+    }
+    error = "No sheet could be graded";
+    return STATUS_ERROR;
+}
+
+// ___________________________
+// Persistent worker pool shared by every isolate in the process
+static mutex workerMutex;
+static WorkerPool *workerPool = nullptr;
+static Dart_PostCObjectFunc workerPostCObject = nullptr;
+static atomic<long long> workerNextRequestId(1);
+static int workerStreams = 0;
+static condition_variable workerStreamsDone;
+
+// Post [requestId, resultJson] to a Dart port; Dart copies the string
+static void postWorkerResult(Dart_Port port, long long requestId, const char *json) {
+    Dart_CObject id;
+    id.type = Dart_CObject_kInt64;
+    id.value.as_int64 = requestId;
+
+    Dart_CObject result;
+    result.type = Dart_CObject_kString;
+    result.value.as_string = json;
+
+    Dart_CObject *values[2] = {&id, &result};
+    Dart_CObject message;
+    message.type = Dart_CObject_kArray;
+    message.value.as_array.length = 2;
+    message.value.as_array.values = values;
+
+    workerPostCObject(port, &message);
+}
+
+// Result JSON for a request that failed outside the grading pipeline
+static char *errorResultJson(const char *message) {
+    GradeResult result;
+    result.statusCode = STATUS_ERROR;
+    result.error = message;
+    ResultWriter writer;
+    writeGradeResult(writer, result);
+    return writer.release();
+}
+
+// Post one page of a streamed file as [requestId, page, json]
+static void postWorkerPageResult(Dart_Port port, long long requestId, int page, const char *json) {
+    Dart_CObject id;
+    id.type = Dart_CObject_kInt64;
+    id.value.as_int64 = requestId;
+
+    Dart_CObject pageIndex;
+    pageIndex.type = Dart_CObject_kInt64;
+    pageIndex.value.as_int64 = page;
+
+    Dart_CObject result;
+    result.type = Dart_CObject_kString;
+    result.value.as_string = json;
+
+    Dart_CObject *values[3] = {&id, &pageIndex, &result};
+    Dart_CObject message;
+    message.type = Dart_CObject_kArray;
+    message.value.as_array.length = 3;
+    message.value.as_array.values = values;
+
+    workerPostCObject(port, &message);
+}
+
+
+// ___________________________
+// Avoiding name mangling for cross-platform compatibility
+extern "C"
+{
+
+FUNCTION_ATTRIBUTE
+const char *version() {
+    return CV_VERSION;
+}
+
+// Main function for processing the image.
+// The returned string is owned by the caller and must be released with free_result.
+FUNCTION_ATTRIBUTE
+const char *process_image(const char *imgPath, const char *outputPath, const char * json) {
+    ResultWriter writer;
+    gradeImageJson(imgPath, outputPath, parseEngineOptions(json), writer);
+    return writer.release();
+}
+
+// Same as process_image, but writes the compact JSON into a caller-owned buffer.
+// Returns the full result length (excluding NUL); if it is >= capacity the
+// output was truncated. Repeating the call grades the sheet again (and
+// rewrites the annotated image), so start with RESULT_JSON_CAPACITY bytes,
+// which every result fits in.
+FUNCTION_ATTRIBUTE
+int process_image_into(const char *imgPath, const char *outputPath, const char *json, char *buffer, int capacity) {
+    ResultWriter writer(buffer, capacity > 0 ? static_cast<size_t>(capacity) : 0);
+    gradeImageJson(imgPath, outputPath, parseEngineOptions(json), writer);
+    return static_cast<int>(writer.length());
+}
+
+// Same as process_image, but fills a caller-owned fixed-layout struct
+// (omr_result.h) instead of serializing JSON. Returns the status code.
+FUNCTION_ATTRIBUTE
+int process_image_struct(const char *imgPath, const char *outputPath, const char *json, OmrResult *out) {
+    GradeResult result;
+    gradeImage(imgPath, outputPath, parseEngineOptions(json), result);
+    if (out != nullptr) {
+        fillOmrResult(result, out);
+    }
+    return result.statusCode;
+}
+
+// Grade every answer sheet found in the image, in parallel. Returns
+// {"version":...,"sheets":[{"region":{...},"result":{...}},...],"status_code":...}
+// where each result has the process_image shape. Free with free_result.
+FUNCTION_ATTRIBUTE
+const char *process_sheets(const char *imgPath, const char *outputPath, const char *json) {
+    vector<SheetResult> sheets;
+    string error;
+    int statusCode = gradeSheets(imgPath, outputPath, parseEngineOptions(json), sheets, error);
+
+    ResultWriter writer;
+    writeSheetResults(writer, sheets, statusCode, error);
+    return writer.release();
+}
+
+// Release a result returned by process_image
+FUNCTION_ATTRIBUTE
+void free_result(const char *result) {
+    free(const_cast<char *>(result));
+}
+
+// Buffered engine log lines from every thread, oldest first (see drainLog).
+// Empty when nothing was logged since the last call. Free with free_result.
+FUNCTION_ATTRIBUTE
+const char *log_drain() {
+    string text = drainLog();
+    char *copy = static_cast<char *>(malloc(text.size() + 1));
+    if (copy != nullptr) {
+        memcpy(copy, text.c_str(), text.size() + 1);
+    }
+    return copy;
+}
+
+// Create a cancel token. Pass its id as "cancel_token" in the JSON
+// arguments of any grading call; cancel_token_cancel then makes the call
+// stop at its next check and return status_code 4 (see CancelToken).
+FUNCTION_ATTRIBUTE
+long long cancel_token_create() {
+    return createCancelToken();
+}
+
+// Cancel every call using the token, now and later. Safe from any thread.
+FUNCTION_ATTRIBUTE
+void cancel_token_cancel(long long token) {
+    cancelToken(token);
+}
+
+// Drop the token once no new call will use it
+FUNCTION_ATTRIBUTE
+void cancel_token_release(long long token) {
+    releaseCancelToken(token);
+}
+
+// Process-wide latency histograms and status/failure counters as JSON (see
+// writeEngineStats). A non-zero `reset` zeroes them as they are read, so
+// periodic calls return deltas. Free with free_result.
+FUNCTION_ATTRIBUTE
+const char *get_stats(int reset) {
+    ResultWriter writer;
+    writeEngineStats(writer, reset != 0);
+    return writer.release();
+}
+
+// Answer process_image, process_image_into and worker_submit from a
+// persistent cache in `dir` when the same image bytes were graded before
+// with the same options. Entries beyond maxBytes (<= 0: no limit) are
+// evicted least recently used first. Returns 1 on success, 0 if the
+// directory cannot be used.
+FUNCTION_ATTRIBUTE
+int result_cache_open(const char *dir, long long maxBytes) {
+    if (dir == nullptr || dir[0] == '\0') {
+        return 0;
+    }
+    return setResultCache(dir, maxBytes) ? 1 : 0;
+}
+
+// Stop using the result cache; the files stay on disk
+FUNCTION_ATTRIBUTE
+void result_cache_close() {
+    setResultCache("", 0);
+}
+
+// Run only the capture pre-check on an image file.
+// Decodes at reduced resolution; release the result with free_result.
+FUNCTION_ATTRIBUTE
+const char *check_capture(const char *imgPath) {
+    Mat image = imread(imgPath, IMREAD_REDUCED_GRAYSCALE_4);
+    ResultWriter writer;
+    writer.beginObject();
+    writer.key("version");
+    writer.string(ENGINE_VERSION);
+    if (image.empty()) {
+        writer.key("status_code");
+        writer.number(static_cast<long long>(STATUS_ERROR));
+        writer.key("error");
+        writer.string("Image not found");
+    } else {
+        CaptureCheck check = checkCapture(image);
+        writer.key("status_code");
+        writer.number(static_cast<long long>(check.reason == CAPTURE_OK ? STATUS_OK : STATUS_REJECTED));
+        writer.key("reason_code");
+        writer.number(static_cast<long long>(check.reason));
+        if (check.reason != CAPTURE_OK) {
+            writer.key("error");
+            writer.string(captureReasonMessage(check.reason));
+        }
+        writer.key("capture");
+        writeCaptureCheck(writer, check);
+    }
+    writer.endObject();
+    return writer.release();
+}
+
+// {"version":...,"status_code":1,"error":message} for analyze_frame
+static char *frameErrorJson(const char *message) {
+    ResultWriter writer;
+    writer.beginObject();
+    writer.key("version");
+    writer.string(ENGINE_VERSION);
+    writer.key("status_code");
+    writer.number(static_cast<long long>(STATUS_ERROR));
+    writer.key("error");
+    writer.string(message);
+    writer.endObject();
+    return writer.release();
+}
+
+// Capture-quality metrics for a live preview frame, for camera guidance.
+// `pixels` holds `length` bytes: width x height in one of the FRAME_FORMAT_*
+// layouts with rows `stride` bytes apart (0 for tightly packed); the last
+// row need not be padded. Work stops after budgetMs (<= 0 for no limit).
+// Release the result with free_result.
+FUNCTION_ATTRIBUTE
+const char *analyze_frame(const unsigned char *pixels, long long length, int width, int height, int stride,
+                          int format, int budgetMs) {
+    if (width <= 0 || height <= 0 || format < FRAME_FORMAT_GRAY || format > FRAME_FORMAT_BGR) {
+        return frameErrorJson("Invalid frame");
+    }
+    int channels = frameFormatChannels(format);
+    size_t rowBytes = static_cast<size_t>(width) * channels;
+    size_t step = stride > 0 ? static_cast<size_t>(stride) : rowBytes;
+    if (step < rowBytes) {
+        return frameErrorJson("Row stride is shorter than a row of pixels");
+    }
+    // Checked before wrapping, as OpenCV would read past the end unnoticed
+    if (pixels == nullptr || length < 0 ||
+        static_cast<unsigned long long>(length) < step * static_cast<size_t>(height - 1) + rowBytes) {
+        return frameErrorJson("Frame buffer is smaller than width, height and stride need");
+    }
+    try {
+        // Wrap the caller's pixels without copying
+        Mat frame(height, width, CV_8UC(channels), const_cast<unsigned char *>(pixels), step);
+        FrameAnalysis analysis = analyzeFrame(frame, budgetMs, format == FRAME_FORMAT_RGBA);
+        ResultWriter writer;
+        writer.beginObject();
+        writer.key("version");
+        writer.string(ENGINE_VERSION);
+        writer.key("status_code");
+        writer.number(static_cast<long long>(STATUS_OK));
+        writer.key("frame");
+        writeFrameAnalysis(writer, analysis);
+        writer.endObject();
+        return writer.release();
+    } catch (const exception &e) {
+        return frameErrorJson(e.what());
+    } catch (...) {
+        return frameErrorJson("Unexpected error");
+    }
+}
+
+// Start the shared worker pool. postCObject is Dart's NativeApi.postCObject.
+// Calling it again while running keeps the existing pool.
+// Returns the number of worker threads.
+FUNCTION_ATTRIBUTE
+int worker_start(void *postCObject, int threads) {
+    lock_guard<mutex> lock(workerMutex);
+    workerPostCObject = reinterpret_cast<Dart_PostCObjectFunc>(postCObject);
+    if (workerPool == nullptr) {
+        workerPool = new WorkerPool(threads);
+    }
+    return workerPool->size();
+}
+
+// Queue an image for grading. The result JSON is posted to `port` as
+// [requestId, json]. Returns the request id, or -1 if the pool is not running.
+FUNCTION_ATTRIBUTE
+long long worker_submit(long long port, const char *imgPath, const char *outputPath, const char *json) {
+    lock_guard<mutex> lock(workerMutex);
+    if (workerPool == nullptr || workerPostCObject == nullptr) {
+        return -1;
+    }
+    long long requestId = workerNextRequestId++;
+    // Null paths are accepted like process_image does: no input, no output image
+    string input(imgPath != nullptr ? imgPath : ""), output(outputPath != nullptr ? outputPath : "");
+    EngineOptions options = parseEngineOptions(json);
+    workerPool->submit([port, requestId, input, output, options]() {
+        // Every request gets a reply, or its Dart future would never complete
+        char *json;
+        try {
+            ResultWriter writer;
+            gradeImageJson(input.c_str(), output.c_str(), options, writer);
+            json = writer.release();
+        } catch (const exception &e) {
+            json = errorResultJson(e.what());
+        } catch (...) {
+            json = errorResultJson("Unexpected error");
+        }
+        postWorkerResult(port, requestId, json);
+        free(json);
+    });
+    return requestId;
+}
+
+// Grade every page of a multi-page TIFF on the worker pool while it is read,
+// keeping only a few pages in memory. Each page's result JSON is posted to
+// `port` as [requestId, page, json] when it finishes (completion order), then
+// [requestId, -1, summary] once all are done, where summary is
+// {"version":...,"pages":N,"status_code":...}. Returns the request id, or -1
+// if the pool is not running.
+FUNCTION_ATTRIBUTE
+long long worker_submit_pages(long long port, const char *path, const char *outputPath, const char *json) {
+    lock_guard<mutex> lock(workerMutex);
+    if (workerPool == nullptr || workerPostCObject == nullptr) {
+        return -1;
+    }
+    long long requestId = workerNextRequestId++;
+    string input(path != nullptr ? path : ""), output(outputPath != nullptr ? outputPath : "");
+    EngineOptions options = parseEngineOptions(json);
+    WorkerPool *pool = workerPool;
+    workerStreams++;
+    // Pages are decoded on this thread and graded on the pool
+    thread([port, requestId, input, output, options, pool]() {
+        // Counted down however the stream ends, or worker_stop would wait forever
+        struct StreamDone {
+            ~StreamDone() {
+                lock_guard<mutex> streamLock(workerMutex);
+                workerStreams--;
+                workerStreamsDone.notify_all();
+            }
+        } done;
+        CancelScope cancelScope(options.cancelToken);
+        int pages;
+        string error = "Image not found";
+        try {
+            pages = gradePages(input.c_str(), output.c_str(), options, *pool,
+                               [port, requestId](int page, const GradeResult &result) {
+                ResultWriter writer;
+                writeGradeResult(writer, result);
+                char *pageJson = writer.release();
+                postWorkerPageResult(port, requestId, page, pageJson);
+                free(pageJson);
+            });
+        } catch (const exception &e) {
+            pages = -1;
+            error = e.what();
+        } catch (...) {
+            pages = -1;
+            error = "Unexpected error";
+        }
+
+        ResultWriter writer;
+        writer.beginObject();
+        writer.key("version");
+        writer.string(ENGINE_VERSION);
+        writer.key("pages");
+        writer.number(static_cast<long long>(max(pages, 0)));
+        bool cancelled = pages >= 0 && cancelRequested();
+        writer.key("status_code");
+        writer.number(static_cast<long long>(pages < 0 ? STATUS_ERROR : (cancelled ? STATUS_CANCELLED : STATUS_OK)));
+        if (pages < 0 || cancelled) {
+            writer.key("error");
+            writer.string(cancelled ? "Cancelled" : error.c_str());
+        }
+        writer.endObject();
+        char *summary = writer.release();
+        postWorkerPageResult(port, requestId, -1, summary);
+        free(summary);
+    }).detach();
+    return requestId;
+}
+
+// Number of requests waiting for a free worker
+FUNCTION_ATTRIBUTE
+int worker_pending() {
+    lock_guard<mutex> lock(workerMutex);
+    return workerPool == nullptr ? 0 : static_cast<int>(workerPool->pending());
+}
+
+// Finish queued requests and join the worker threads
+FUNCTION_ATTRIBUTE
+void worker_stop() {
+    WorkerPool *pool;
+    {
+        unique_lock<mutex> lock(workerMutex);
+        pool = workerPool;
+        workerPool = nullptr;
+        // Page streams keep submitting to the pool until their file is read
+        workerStreamsDone.wait(lock, [] { return workerStreams == 0; });
+    }
+    delete pool;
 }
 }
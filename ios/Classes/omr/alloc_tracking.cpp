@@ -0,0 +1,151 @@
+#include "alloc_tracking.h"
+
+#include <atomic>
+#include <mutex>
+#include <opencv2/opencv.hpp>
+
+using namespace cv;
+using namespace std;
+
+static const char *const kStageNames[ALLOC_STAGE_COUNT] = {"decode", "register", "grade", "encode"};
+
+const char *allocStageName(int stage) {
+    return stage >= 0 && stage < ALLOC_STAGE_COUNT ? kStageNames[stage] : "";
+}
+
+static void raiseTo(atomic<long long> &peak, long long value) {
+    long long seen = peak.load(memory_order_relaxed);
+    while (value > seen && !peak.compare_exchange_weak(seen, value, memory_order_relaxed)) {
+    }
+}
+
+// Counters of one sheet. Reference counted: the tracker holds one reference
+// and every buffer charged to it another, so a buffer that outlives the
+// tracker (a result image kept by the caller) can still be credited.
+class AllocLedger {
+public:
+    AllocLedger() : refs_(1), live_(0) {
+        for (int i = 0; i < ALLOC_STAGE_COUNT; i++) {
+            bytes_[i].store(0);
+            count_[i].store(0);
+            peak_[i].store(0);
+        }
+    }
+
+    void retain() { refs_.fetch_add(1, memory_order_relaxed); }
+
+    void release() {
+        if (refs_.fetch_sub(1, memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+    void charge(int stage, long long bytes) {
+        bytes_[stage].fetch_add(bytes, memory_order_relaxed);
+        count_[stage].fetch_add(1, memory_order_relaxed);
+        raiseTo(peak_[stage], live_.fetch_add(bytes, memory_order_relaxed) + bytes);
+    }
+
+    void credit(long long bytes) { live_.fetch_sub(bytes, memory_order_relaxed); }
+
+    void report(AllocReport &report) const {
+        report.tracked = true;
+        report.peakBytes = 0;
+        for (int i = 0; i < ALLOC_STAGE_COUNT; i++) {
+            report.stages[i].bytes = bytes_[i].load(memory_order_relaxed);
+            report.stages[i].count = count_[i].load(memory_order_relaxed);
+            report.stages[i].peakBytes = peak_[i].load(memory_order_relaxed);
+            report.peakBytes = max(report.peakBytes, report.stages[i].peakBytes);
+        }
+    }
+
+private:
+    atomic<int> refs_;
+    atomic<long long> live_;
+    atomic<long long> bytes_[ALLOC_STAGE_COUNT];
+    atomic<long long> count_[ALLOC_STAGE_COUNT];
+    atomic<long long> peak_[ALLOC_STAGE_COUNT];
+};
+
+static thread_local AllocLedger *currentLedger = nullptr;
+static thread_local int currentStage = ALLOC_STAGE_DECODE;
+
+// Charge an allocation to the sheet current on this thread. Returns its
+// ledger, with a reference held for the allocation, or null when untracked.
+static AllocLedger *chargeCurrent(long long bytes) {
+    AllocLedger *ledger = currentLedger;
+    if (ledger != nullptr) {
+        ledger->retain();
+        ledger->charge(currentStage, bytes);
+    }
+    return ledger;
+}
+
+static void creditLedger(AllocLedger *ledger, long long bytes) {
+    if (ledger != nullptr) {
+        ledger->credit(bytes);
+        ledger->release();
+    }
+}
+
+// OpenCV's own allocator underneath, with the charged ledger kept in
+// UMatData::userdata (unused by the CPU allocator). Taking over
+// currAllocator routes the buffer's release back through deallocate().
+class CountingAllocator : public MatAllocator {
+public:
+    UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step, AccessFlag flags,
+                       UMatUsageFlags usageFlags) const override {
+        UMatData *u = Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+        u->currAllocator = this;
+        // Buffers wrapped around caller memory are not allocations of ours
+        if (data == nullptr) {
+            u->userdata = chargeCurrent(static_cast<long long>(u->size));
+        }
+        return u;
+    }
+
+    bool allocate(UMatData *data, AccessFlag accessFlags, UMatUsageFlags usageFlags) const override {
+        return Mat::getStdAllocator()->allocate(data, accessFlags, usageFlags);
+    }
+
+    void deallocate(UMatData *u) const override {
+        if (u == nullptr) {
+            return;
+        }
+        creditLedger(static_cast<AllocLedger *>(u->userdata), static_cast<long long>(u->size));
+        u->userdata = nullptr;
+        Mat::getStdAllocator()->deallocate(u);
+    }
+};
+
+AllocTracker::~AllocTracker() {
+    if (ledger_ != nullptr) {
+        ledger_->release();
+    }
+}
+
+void AllocTracker::start() {
+    static once_flag installed;
+    // Never deleted: every buffer it allocated points back at it
+    call_once(installed, [] { Mat::setDefaultAllocator(new CountingAllocator()); });
+    if (ledger_ == nullptr) {
+        ledger_ = new AllocLedger();
+    }
+}
+
+void AllocTracker::report(AllocReport &report) const {
+    if (ledger_ != nullptr) {
+        ledger_->report(report);
+    }
+}
+
+AllocScope::AllocScope(const AllocTracker &tracker, int stage)
+        : previousLedger_(currentLedger), previousStage_(currentStage) {
+    currentLedger = tracker.ledger_;
+    currentStage = stage;
+}
+
+AllocScope::~AllocScope() {
+    currentLedger = previousLedger_;
+    currentStage = previousStage_;
+}
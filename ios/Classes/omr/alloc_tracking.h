@@ -0,0 +1,61 @@
+#ifndef NATIVE_OPENCV_ALLOC_TRACKING_H
+#define NATIVE_OPENCV_ALLOC_TRACKING_H
+
+#include "grade_result.h"
+
+// Grading stages allocations are charged to, in pipeline order
+enum AllocStage {
+    ALLOC_STAGE_DECODE,
+    ALLOC_STAGE_REGISTER,
+    ALLOC_STAGE_GRADE,
+    ALLOC_STAGE_ENCODE
+};
+
+// "decode", "register", "grade" or "encode"
+const char *allocStageName(int stage);
+
+class AllocLedger;
+
+// Allocation accounting for one sheet ("alloc_stats" engine option).
+//
+// start() installs a counting cv::MatAllocator as OpenCV's default allocator
+// (once per process; it stays installed), and from then on every Mat buffer
+// allocated on a thread inside an AllocScope of this tracker is charged to
+// the scope's stage. A buffer stays charged to the sheet until
+// it is freed, on whichever thread, so the high-water mark covers buffers
+// handed from one stage to the next. A tracker that was never started makes
+// its scopes no-ops.
+class AllocTracker {
+public:
+    AllocTracker() : ledger_(nullptr) {}
+    ~AllocTracker();
+
+    AllocTracker(const AllocTracker &) = delete;
+    AllocTracker &operator=(const AllocTracker &) = delete;
+
+    void start();
+
+    // Totals so far; `report` is left untouched when not started
+    void report(AllocReport &report) const;
+
+private:
+    friend class AllocScope;
+    AllocLedger *ledger_;
+};
+
+// Charges allocations made on the current thread to `stage` of the
+// tracker's sheet for the lifetime of the scope. Scopes nest.
+class AllocScope {
+public:
+    AllocScope(const AllocTracker &tracker, int stage);
+    ~AllocScope();
+
+    AllocScope(const AllocScope &) = delete;
+    AllocScope &operator=(const AllocScope &) = delete;
+
+private:
+    AllocLedger *previousLedger_;
+    int previousStage_;
+};
+
+#endif // NATIVE_OPENCV_ALLOC_TRACKING_H
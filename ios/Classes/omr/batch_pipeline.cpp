@@ -0,0 +1,193 @@
+#include "batch_pipeline.h"
+
+#include "cancel_token.h"
+#include "engine_stats.h"
+#include "trace_events.h"
+
+using namespace cv;
+using namespace std;
+
+// Same order as AllocStage, so a stage index doubles as its allocation stage
+enum {
+    STAGE_DECODE,
+    STAGE_REGISTER,
+    STAGE_GRADE,
+    STAGE_ENCODE,
+    STAGE_COUNT
+};
+
+PipelineConfig defaultPipelineConfig(int cores) {
+    if (cores <= 0) {
+        cores = static_cast<int>(thread::hardware_concurrency());
+    }
+    if (cores <= 0) {
+        cores = 1;
+    }
+    PipelineConfig config;
+    config.decodeThreads = max(1, cores / 4);
+    config.registerThreads = max(1, cores / 2);
+    config.gradeThreads = max(1, cores / 4);
+    config.encodeThreads = max(1, cores / 4);
+    return config;
+}
+
+BatchPipeline::BatchPipeline(const EngineOptions &options, const PipelineConfig &config, Callback onDone)
+        : options_(options), onDone_(std::move(onDone)), traceCall_(new TraceCall(options.tracePath)),
+          finished_(false) {
+    // Consumers first, so no stage can push into one that is not running yet
+    startStage(STAGE_ENCODE, "encode", config.encodeThreads);
+    startStage(STAGE_GRADE, "grade", config.gradeThreads);
+    startStage(STAGE_REGISTER, "register", config.registerThreads);
+    startStage(STAGE_DECODE, "decode", config.decodeThreads);
+}
+
+BatchPipeline::~BatchPipeline() {
+    finish();
+}
+
+void BatchPipeline::startStage(int index, const char *name, int threads) {
+    Stage &stage = stages_[index];
+    threads = max(1, threads);
+    stage.name = name;
+    stage.items = 0;
+    stage.busyMicros = 0;
+    stage.input.reset(new JobQueue(static_cast<size_t>(threads) * PIPELINE_QUEUE_PER_THREAD));
+    for (int i = 0; i < threads; i++) {
+        stage.threads.emplace_back(&BatchPipeline::runStage, this, index, i);
+    }
+}
+
+bool BatchPipeline::submit(size_t index, const string &inputPath, const string &outputPath) {
+    unique_ptr<PipelineJob> job(new PipelineJob());
+    job->index = index;
+    job->inputPath = inputPath;
+    job->outputPath = outputPath;
+    job->latencyMs = 0;
+    if (options_.allocStats) {
+        job->alloc.start();
+    }
+    return stages_[STAGE_DECODE].input->push(std::move(job));
+}
+
+void BatchPipeline::finish() {
+    if (finished_) {
+        return;
+    }
+    finished_ = true;
+    // Drain front to back: once a stage's threads are gone nothing more can
+    // reach the next queue, so it can be closed in turn
+    for (auto &stage: stages_) {
+        stage.input->close();
+        for (auto &thread: stage.threads) {
+            thread.join();
+        }
+    }
+    traceCall_.reset();
+}
+
+vector<StageStats> BatchPipeline::stats() const {
+    vector<StageStats> stats;
+    for (const auto &stage: stages_) {
+        StageStats entry;
+        entry.name = stage.name;
+        entry.threads = static_cast<int>(stage.threads.size());
+        entry.items = stage.items.load(memory_order_relaxed);
+        entry.busySeconds = stage.busyMicros.load(memory_order_relaxed) / 1e6;
+        entry.queued = stage.input->size();
+        stats.push_back(entry);
+    }
+    return stats;
+}
+
+void BatchPipeline::runStage(int index, int thread) {
+    Stage &stage = stages_[index];
+    traceNameThread(string(stage.name) + " " + to_string(thread + 1));
+    unique_ptr<PipelineJob> job;
+    while (stage.input->pop(job)) {
+        auto begin = chrono::steady_clock::now();
+        {
+            TraceSpan span(stage.name, static_cast<long long>(job->index));
+            process(index, *job);
+        }
+        auto busy = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin).count();
+        stage.busyMicros.fetch_add(busy, memory_order_relaxed);
+        stage.items.fetch_add(1, memory_order_relaxed);
+
+        if (index + 1 < STAGE_COUNT) {
+            stages_[index + 1].input->push(std::move(job));
+        } else {
+            job->latencyMs = chrono::duration<double, milli>(chrono::steady_clock::now() - job->started).count();
+            onDone_(*job);
+            job.reset();
+        }
+    }
+}
+
+// An exception fails only its own sheet, which later stages pass along
+static void failJob(PipelineJob &job, const char *message) {
+    job.result.graded = false;
+    job.result.statusCode = STATUS_ERROR;
+    job.result.error = message;
+    job.image.release();
+    job.sheet = RegisteredSheet();
+}
+
+void BatchPipeline::process(int index, PipelineJob &job) {
+    GradeResult &result = job.result;
+    AllocScope scope(job.alloc, index);
+    CancelScope cancelScope(options_.cancelToken);
+    // From then on every stage only passes the sheet along
+    if (result.statusCode == STATUS_OK) {
+        stopIfCancelled(result);
+    }
+    if (index == STAGE_DECODE) {
+        job.started = chrono::steady_clock::now();
+    }
+    try {
+        runStep(index, job);
+    } catch (const exception &e) {
+        failJob(job, e.what());
+    } catch (...) {
+        failJob(job, "Unexpected error");
+    }
+    if (index == STAGE_ENCODE) {
+        job.alloc.report(result.allocations);
+        job.sheet = RegisteredSheet();
+        recordGrade(result, job.started);
+    }
+}
+
+void BatchPipeline::runStep(int index, PipelineJob &job) {
+    GradeResult &result = job.result;
+    switch (index) {
+        case STAGE_DECODE:
+            if (result.statusCode == STATUS_CANCELLED) {
+                break;
+            }
+            job.image = decodeImage(job.inputPath.c_str(), options_, result);
+            if (job.image.empty()) {
+                result.statusCode = STATUS_ERROR;
+                result.error = "Image not found";
+            }
+            break;
+        case STAGE_REGISTER:
+            // A sheet that failed an earlier stage is only passed along
+            if (result.statusCode == STATUS_OK) {
+                job.sheet.annotate = !job.outputPath.empty();
+                registerSheet(std::move(job.image), options_, job.sheet, result);
+            }
+            job.image.release();
+            break;
+        case STAGE_GRADE:
+            if (result.statusCode == STATUS_OK) {
+                gradeCells(job.sheet, result);
+            }
+            job.sheet.image.release();
+            break;
+        case STAGE_ENCODE:
+            if (result.graded) {
+                writeAnnotated(job.outputPath.c_str(), job.sheet, result);
+            }
+            break;
+    }
+}
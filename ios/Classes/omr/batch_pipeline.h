@@ -0,0 +1,112 @@
+#ifndef NATIVE_OPENCV_BATCH_PIPELINE_H
+#define NATIVE_OPENCV_BATCH_PIPELINE_H
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+#include "alloc_tracking.h"
+#include "bounded_queue.h"
+#include "engine.h"
+#include "trace_events.h"
+
+// Sheets allowed to wait in front of a stage, per thread of that stage
+#define PIPELINE_QUEUE_PER_THREAD 2
+
+// Threads per stage. Decode and encode mostly wait on the file system and
+// the codecs, registration (deskew + block search) is the heaviest compute
+// step and reading the bubbles is comparatively cheap.
+struct PipelineConfig {
+    int decodeThreads;
+    int registerThreads;
+    int gradeThreads;
+    int encodeThreads;
+};
+
+// Split `cores` (<= 0: all hardware cores) between the stages
+PipelineConfig defaultPipelineConfig(int cores);
+
+// One image on its way through the pipeline. The decoded and registered
+// images are released as soon as the next stage is done with them.
+struct PipelineJob {
+    size_t index;
+    std::string inputPath;
+    std::string outputPath;
+    GradeResult result;
+    // Time from the start of decoding to the end of encoding
+    double latencyMs;
+
+    std::chrono::steady_clock::time_point started;
+    cv::Mat image;
+    RegisteredSheet sheet;
+    // Started when the options ask for allocation stats
+    AllocTracker alloc;
+};
+
+struct StageStats {
+    const char *name;
+    int threads;
+    long long items;
+    // Summed over the stage's threads, excluding time blocked on queues
+    double busySeconds;
+    size_t queued;
+};
+
+// Batch grader that runs decode -> registerSheet -> gradeCells ->
+// writeAnnotated as four stages, each with its own threads, connected by
+// bounded queues. While one sheet is being decoded others are being
+// registered, graded and encoded, so cores stay busy through the I/O-bound
+// steps. A full queue blocks the stage feeding it, all the way back to
+// submit(), so a slow disk or encoder throttles intake instead of piling up
+// decoded images.
+class BatchPipeline {
+public:
+    typedef std::function<void(PipelineJob &job)> Callback;
+
+    // onDone runs on an encode thread once per submitted image, in
+    // completion order
+    BatchPipeline(const EngineOptions &options, const PipelineConfig &config, Callback onDone);
+    ~BatchPipeline();
+
+    BatchPipeline(const BatchPipeline &) = delete;
+    BatchPipeline &operator=(const BatchPipeline &) = delete;
+
+    // Queue an image (outputPath may be empty). Blocks while the decode
+    // stage is backed up; fails after finish().
+    bool submit(size_t index, const std::string &inputPath, const std::string &outputPath);
+
+    // Stop accepting images and wait until every queued one reached onDone
+    void finish();
+
+    std::vector<StageStats> stats() const;
+
+private:
+    typedef BoundedQueue<std::unique_ptr<PipelineJob>> JobQueue;
+
+    struct Stage {
+        const char *name;
+        std::vector<std::thread> threads;
+        std::unique_ptr<JobQueue> input;
+        std::atomic<long long> items;
+        std::atomic<long long> busyMicros;
+    };
+
+    void startStage(int index, const char *name, int threads);
+    void runStage(int index, int thread);
+    // Runs one stage on a job; an exception marks it STATUS_ERROR
+    void process(int index, PipelineJob &job);
+    void runStep(int index, PipelineJob &job);
+
+    EngineOptions options_;
+    Callback onDone_;
+    // Open from construction until finish(), so options.tracePath covers the whole run
+    std::unique_ptr<TraceCall> traceCall_;
+    Stage stages_[4];
+    bool finished_;
+};
+
+#endif // NATIVE_OPENCV_BATCH_PIPELINE_H
@@ -0,0 +1,104 @@
+#include "block_frame.h"
+
+#include <cmath>
+
+using namespace cv;
+using namespace std;
+
+static double norm2(const Point2f &p) {
+    return sqrt(static_cast<double>(p.x) * p.x + static_cast<double>(p.y) * p.y);
+}
+
+BlockFrame BlockFrame::fromRect(const Rect &rect) {
+    BlockFrame frame;
+    frame.origin = Point2f(static_cast<float>(rect.x), static_cast<float>(rect.y));
+    frame.ux = Point2f(1, 0);
+    frame.uy = Point2f(0, 1);
+    frame.width = rect.width;
+    frame.height = rect.height;
+    return frame;
+}
+
+BlockFrame BlockFrame::fromQuad(const vector<Point> &quad) {
+    // Order corners: TL has the smallest x+y, BR the largest,
+    // TR the smallest y-x and BL the largest
+    Point tl = quad[0], tr = quad[0], br = quad[0], bl = quad[0];
+    for (const auto &p: quad) {
+        if (p.x + p.y < tl.x + tl.y) tl = p;
+        if (p.x + p.y > br.x + br.y) br = p;
+        if (p.y - p.x < tr.y - tr.x) tr = p;
+        if (p.y - p.x > bl.y - bl.x) bl = p;
+    }
+    Point2f top = Point2f(tr - tl), bottom = Point2f(br - bl);
+    Point2f left = Point2f(bl - tl), right = Point2f(br - tr);
+
+    BlockFrame frame;
+    frame.origin = Point2f(tl);
+    frame.width = (norm2(top) + norm2(bottom)) / 2;
+    frame.height = (norm2(left) + norm2(right)) / 2;
+    if (frame.width <= 0 || frame.height <= 0) {
+        return fromRect(boundingRect(quad));
+    }
+    Point2f across = top + bottom, down = left + right;
+    frame.ux = across * (1.0 / norm2(across));
+    frame.uy = down * (1.0 / norm2(down));
+    return frame;
+}
+
+BlockFrame BlockFrame::fromBoundingRect(const Rect &rect, double angleDegrees) {
+    double theta = angleDegrees * CV_PI / 180.0;
+    double c = cos(theta), s = abs(sin(theta));
+    double cos2 = c * c - s * s;
+    if (abs(theta) < 1e-6 || cos2 < 0.5) {
+        return fromRect(rect);
+    }
+    // Undo the growth of a w x h box's bounding rect under rotation
+    double width = (rect.width * c - rect.height * s) / cos2;
+    double height = (rect.height * c - rect.width * s) / cos2;
+
+    BlockFrame frame;
+    frame.ux = Point2f(static_cast<float>(cos(theta)), static_cast<float>(sin(theta)));
+    frame.uy = Point2f(-frame.ux.y, frame.ux.x);
+    frame.width = width;
+    frame.height = height;
+    Point2f center(rect.x + rect.width / 2.0f, rect.y + rect.height / 2.0f);
+    frame.origin = center - frame.ux * (width / 2) - frame.uy * (height / 2);
+    return frame;
+}
+
+Point2f BlockFrame::map(double u, double v) const {
+    return Point2f(static_cast<float>(origin.x + ux.x * u + uy.x * v),
+                   static_cast<float>(origin.y + ux.y * u + uy.y * v));
+}
+
+Rect BlockFrame::cellRect(int x, int y, int width, int height) const {
+    Point2f corners[4] = {map(x, y), map(x + width, y), map(x, y + height), map(x + width, y + height)};
+    float minX = corners[0].x, maxX = corners[0].x, minY = corners[0].y, maxY = corners[0].y;
+    for (const auto &p: corners) {
+        minX = min(minX, p.x);
+        maxX = max(maxX, p.x);
+        minY = min(minY, p.y);
+        maxY = max(maxY, p.y);
+    }
+    int left = static_cast<int>(floor(minX)), top = static_cast<int>(floor(minY));
+    return Rect(left, top, static_cast<int>(ceil(maxX)) - left, static_cast<int>(ceil(maxY)) - top);
+}
+
+Mat BlockFrame::sampleCell(const Mat &image, int x, int y, int width, int height) const {
+    if (ux == Point2f(1, 0) && uy == Point2f(0, 1)) {
+        return image(cellRect(x, y, width, height));
+    }
+    // Warp just the cell's bounding box; the inverse map takes each output
+    // pixel through the frame's axes back into the box
+    Rect box = cellRect(x, y, width, height) & Rect(0, 0, image.cols, image.rows);
+    Point2f start = map(x, y) - Point2f(static_cast<float>(box.x), static_cast<float>(box.y));
+    Matx23d toBox(ux.x, uy.x, start.x,
+                  ux.y, uy.y, start.y);
+    Mat cell;
+    warpAffine(image(box), cell, toBox, Size(width, height), INTER_LINEAR | WARP_INVERSE_MAP, BORDER_REPLICATE);
+    return cell;
+}
+
+double BlockFrame::angle() const {
+    return atan2(ux.y, ux.x) * 180.0 / CV_PI;
+}
@@ -0,0 +1,40 @@
+#ifndef NATIVE_OPENCV_BLOCK_FRAME_H
+#define NATIVE_OPENCV_BLOCK_FRAME_H
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+// Maps block-local pixel coordinates (u along the block's top edge, v along
+// its left edge) to image coordinates: origin + ux * u + uy * v.
+// A frame built from an axis-aligned Rect is an exact translation, so cell
+// ROIs come out identical to offsetting the Rect directly.
+struct BlockFrame {
+    cv::Point2f origin;
+    cv::Point2f ux;
+    cv::Point2f uy;
+    double width = 0;
+    double height = 0;
+
+    static BlockFrame fromRect(const cv::Rect &rect);
+
+    // From a block outline with 4 vertices in any order
+    static BlockFrame fromQuad(const std::vector<cv::Point> &quad);
+
+    // From the axis-aligned bounding box of a block rotated by angleDegrees
+    static BlockFrame fromBoundingRect(const cv::Rect &rect, double angleDegrees);
+
+    cv::Point2f map(double u, double v) const;
+
+    // Image-space bounding box of the block-local rect (x, y, width, height)
+    cv::Rect cellRect(int x, int y, int width, int height) const;
+
+    // The block-local rect (x, y, width, height) resampled upright, so a
+    // tilted cell holds only its own bubble. A view into `image` (no copy)
+    // for a translation-only frame.
+    cv::Mat sampleCell(const cv::Mat &image, int x, int y, int width, int height) const;
+
+    // Rotation of the block's top edge in degrees
+    double angle() const;
+};
+
+#endif // NATIVE_OPENCV_BLOCK_FRAME_H
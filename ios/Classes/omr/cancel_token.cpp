@@ -0,0 +1,68 @@
+#include "cancel_token.h"
+
+#include <mutex>
+#include <unordered_map>
+
+using namespace std;
+
+// Never destroyed, so calls still running during process exit stay safe
+static mutex &registryMutex = *new mutex();
+static unordered_map<long long, shared_ptr<CancelToken>> &tokens =
+        *new unordered_map<long long, shared_ptr<CancelToken>>();
+static long long nextTokenId = 1;
+
+static thread_local CancelToken *currentToken = nullptr;
+
+long long createCancelToken() {
+    lock_guard<mutex> lock(registryMutex);
+    long long id = nextTokenId++;
+    tokens[id] = make_shared<CancelToken>();
+    return id;
+}
+
+void cancelToken(long long id) {
+    shared_ptr<CancelToken> token = findCancelToken(id);
+    if (token) {
+        token->cancelled.store(true, memory_order_relaxed);
+    }
+}
+
+void releaseCancelToken(long long id) {
+    lock_guard<mutex> lock(registryMutex);
+    tokens.erase(id);
+}
+
+shared_ptr<CancelToken> findCancelToken(long long id) {
+    if (id <= 0) {
+        return nullptr;
+    }
+    lock_guard<mutex> lock(registryMutex);
+    auto it = tokens.find(id);
+    return it == tokens.end() ? nullptr : it->second;
+}
+
+CancelScope::CancelScope(const shared_ptr<CancelToken> &token) : token_(token), previous_(currentToken) {
+    // Without a token of its own a nested scope keeps the enclosing one
+    if (token_) {
+        currentToken = token_.get();
+    }
+}
+
+CancelScope::~CancelScope() {
+    currentToken = previous_;
+}
+
+bool cancelRequested() {
+    return currentToken != nullptr && currentToken->cancelled.load(memory_order_relaxed);
+}
+
+bool stopIfCancelled(GradeResult &result) {
+    if (!cancelRequested()) {
+        return false;
+    }
+    // Answers read before the cancel are dropped with the rest
+    result.graded = false;
+    result.statusCode = STATUS_CANCELLED;
+    result.error = "Cancelled";
+    return true;
+}
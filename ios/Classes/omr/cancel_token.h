@@ -0,0 +1,56 @@
+#ifndef NATIVE_OPENCV_CANCEL_TOKEN_H
+#define NATIVE_OPENCV_CANCEL_TOKEN_H
+
+#include <atomic>
+#include <memory>
+#include "grade_result.h"
+
+// Cooperative cancellation of grading calls.
+//
+// The app creates a token (cancel_token_create), passes its id in the call's
+// options as "cancel_token" and may cancel it from any thread while the call
+// runs. The id is resolved when the options are parsed, which for queued
+// work (worker requests, pages, batch jobs) is on submission, so the call
+// holds the token itself and sees a cancel even after the id is released.
+// The engine polls the token between stages, between retry rungs and
+// between blocks of the part loops, and gives up with STATUS_CANCELLED, so a
+// cancelled call returns within about one block's work. Cancelling is
+// permanent; one token may cover several calls (a batch).
+struct CancelToken {
+    std::atomic<bool> cancelled;
+
+    CancelToken() : cancelled(false) {}
+};
+
+// Register a new token and return its id (> 0)
+long long createCancelToken();
+// Unknown or released ids are ignored
+void cancelToken(long long id);
+// Forget the id; calls already submitted hold the token and keep it
+void releaseCancelToken(long long id);
+// nullptr for 0 or an unknown id
+std::shared_ptr<CancelToken> findCancelToken(long long id);
+
+// Makes a call's token the one cancelRequested() polls on this thread, for
+// the scope's lifetime. Nests; tasks on other threads open their own.
+class CancelScope {
+public:
+    explicit CancelScope(const std::shared_ptr<CancelToken> &token);
+    ~CancelScope();
+
+    CancelScope(const CancelScope &) = delete;
+    CancelScope &operator=(const CancelScope &) = delete;
+
+private:
+    std::shared_ptr<CancelToken> token_;
+    CancelToken *previous_;
+};
+
+// True once the token of the innermost CancelScope on this thread was
+// cancelled. One relaxed load; false outside any scope.
+bool cancelRequested();
+
+// cancelRequested(), also marking `result` cancelled (and not graded) when it is
+bool stopIfCancelled(GradeResult &result);
+
+#endif // NATIVE_OPENCV_CANCEL_TOKEN_H
@@ -0,0 +1,110 @@
+#include "capture_check.h"
+
+using namespace cv;
+using namespace std;
+
+double measureFocus(const Mat &gray) {
+    Mat laplacian;
+    Laplacian(gray, laplacian, CV_64F);
+    Scalar lapMean, lapStd;
+    meanStdDev(laplacian, lapMean, lapStd);
+    return lapStd[0] * lapStd[0];
+}
+
+double estimateSheetCoverage(const Mat &blurred, vector<Point> *outline) {
+    Mat bright;
+    threshold(blurred, bright, 0, 255, THRESH_BINARY | THRESH_OTSU);
+    vector<vector<Point>> contours;
+    findContours(bright, contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
+    double largest = 0;
+    size_t largestIndex = 0;
+    for (size_t i = 0; i < contours.size(); i++) {
+        double area = contourArea(contours[i]);
+        if (area > largest) {
+            largest = area;
+            largestIndex = i;
+        }
+    }
+    if (outline != nullptr && !contours.empty()) {
+        *outline = contours[largestIndex];
+    }
+    return largest / (static_cast<double>(blurred.rows) * blurred.cols);
+}
+
+// Same rectangle test as findContoursOrigin, with the area bound scaled down
+static int countBlocks(const Mat &blurred) {
+    Mat thresh;
+    adaptiveThreshold(blurred, thresh, 255, ADAPTIVE_THRESH_MEAN_C, THRESH_BINARY_INV, 11, 7);
+    vector<vector<Point>> contours;
+    findContours(thresh, contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
+
+    double scale = static_cast<double>(blurred.rows) / 1280;
+    double minArea = 1000 * scale * scale;
+    int count = 0;
+    for (const auto &contour: contours) {
+        if (contourArea(contour) < minArea) continue;
+        vector<Point> approx;
+        approxPolyDP(contour, approx, 0.04 * arcLength(contour, true), true);
+        if (approx.size() == 4 && boundingRect(approx).y > blurred.rows * 2 / 11) {
+            count++;
+        }
+    }
+    return count;
+}
+
+CaptureCheck checkCapture(const Mat &image) {
+    CaptureCheck check;
+
+    // Shrink before converting so only the thumbnail is ever converted
+    Mat small;
+    if (image.rows > PRECHECK_HEIGHT) {
+        int width = static_cast<int>(static_cast<double>(image.cols) * PRECHECK_HEIGHT / image.rows);
+        resize(image, small, Size(max(1, width), PRECHECK_HEIGHT), 0, 0, INTER_AREA);
+    } else {
+        small = image;
+    }
+    Mat thumb;
+    if (small.channels() == 1) {
+        thumb = small;
+    } else {
+        cvtColor(small, thumb, COLOR_BGR2GRAY);
+    }
+
+    check.focus = measureFocus(thumb);
+
+    // Exposure
+    check.brightness = mean(thumb)[0];
+    Mat clippedMask;
+    threshold(thumb, clippedMask, 249, 255, THRESH_BINARY);
+    check.clipped = static_cast<double>(countNonZero(clippedMask)) / thumb.total();
+
+    Mat blurred;
+    GaussianBlur(thumb, blurred, Size(3, 3), 0);
+    check.sheetCoverage = estimateSheetCoverage(blurred);
+    check.blockCount = countBlocks(blurred);
+
+    if (check.brightness < PRECHECK_MIN_BRIGHTNESS) {
+        check.reason = CAPTURE_TOO_DARK;
+    } else if (check.clipped > PRECHECK_MAX_CLIPPED) {
+        check.reason = CAPTURE_OVEREXPOSED;
+    } else if (check.focus < PRECHECK_MIN_FOCUS) {
+        check.reason = CAPTURE_BLURRY;
+    } else if (check.sheetCoverage < PRECHECK_MIN_SHEET_COVERAGE) {
+        check.reason = CAPTURE_NO_SHEET;
+    } else if (check.blockCount < PRECHECK_MIN_BLOCKS) {
+        check.reason = CAPTURE_BLOCKS_MISSING;
+    }
+    return check;
+}
+
+const char *captureReasonMessage(int reason) {
+    switch (reason) {
+        case CAPTURE_OK: return "";
+        case CAPTURE_BLURRY: return "Image is too blurry";
+        case CAPTURE_TOO_DARK: return "Image is too dark";
+        case CAPTURE_OVEREXPOSED: return "Image is overexposed";
+        case CAPTURE_NO_SHEET: return "No answer sheet found";
+        case CAPTURE_BLOCKS_MISSING: return "Answer blocks are not fully visible";
+        default: return "Unusable capture";
+    }
+}
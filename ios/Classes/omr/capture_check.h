@@ -0,0 +1,32 @@
+#ifndef NATIVE_OPENCV_CAPTURE_CHECK_H
+#define NATIVE_OPENCV_CAPTURE_CHECK_H
+
+#include <opencv2/opencv.hpp>
+#include "grade_result.h"
+
+// Height of the thumbnail the pre-check works on (1/4 of the working height)
+#define PRECHECK_HEIGHT 320
+
+// Rejection thresholds, deliberately lenient: a false reject costs a retake
+#define PRECHECK_MIN_FOCUS 15.0         // variance of the Laplacian
+#define PRECHECK_MIN_BRIGHTNESS 50.0    // mean gray level
+#define PRECHECK_MAX_CLIPPED 0.5        // fraction of pixels at >= 250
+#define PRECHECK_MIN_SHEET_COVERAGE 0.2 // fraction of the frame
+#define PRECHECK_MIN_BLOCKS 6           // of the 9 blocks found before part 3 is split
+
+// Variance of the Laplacian of a grayscale image; low when edges are soft
+double measureFocus(const cv::Mat &gray);
+
+// Largest bright region after Otsu thresholding, as a fraction of the frame.
+// The region's outline is stored in `outline` when given.
+double estimateSheetCoverage(const cv::Mat &blurredGray, std::vector<cv::Point> *outline = nullptr);
+
+// Estimate focus, exposure, sheet presence and block count on a small
+// thumbnail of `image` (BGR or grayscale, any size) and decide whether it
+// is worth running the full pipeline.
+CaptureCheck checkCapture(const cv::Mat &image);
+
+// Short human-readable explanation for a CAPTURE_* reason code
+const char *captureReasonMessage(int reason);
+
+#endif // NATIVE_OPENCV_CAPTURE_CHECK_H
@@ -0,0 +1,124 @@
+#include "coarse_blocks.h"
+
+using namespace cv;
+using namespace std;
+
+// Reading order used by ContourPrecedenceComparator, applied to rects
+struct RectPrecedenceComparator {
+    int cols;
+    RectPrecedenceComparator(int c) : cols(c) {}
+
+    bool operator()(const Rect &r1, const Rect &r2) const {
+        int tolerance_factor = 60;
+        return ((r1.y / tolerance_factor) * tolerance_factor) * cols + r1.x <
+               ((r2.y / tolerance_factor) * tolerance_factor) * cols + r2.x;
+    }
+};
+
+// preprocessOriginImage with kernel sizes scaled for the reduced image
+static Mat preprocessCoarse(const Mat &gray) {
+    Mat blurred, claheImage, thresh, closed;
+    GaussianBlur(gray, blurred, Size(3, 3), 0);
+    Ptr<CLAHE> clahe = createCLAHE();
+    clahe->setClipLimit(2.0);
+    clahe->setTilesGridSize(Size(8, 8));
+    clahe->apply(blurred, claheImage);
+    adaptiveThreshold(claheImage, thresh, 255, ADAPTIVE_THRESH_MEAN_C, THRESH_BINARY_INV, 7, 10);
+    Mat kernel = getStructuringElement(MORPH_RECT, Size(2, 2));
+    morphologyEx(thresh, closed, MORPH_CLOSE, kernel);
+    return closed;
+}
+
+// Binarize just one band of the working image (dark ink -> 255)
+static Mat bandInk(const Mat &gray, const Rect &band) {
+    Mat blurred, thresh;
+    GaussianBlur(gray(band), blurred, Size(5, 5), 0);
+    adaptiveThreshold(blurred, thresh, 255, ADAPTIVE_THRESH_MEAN_C, THRESH_BINARY_INV, 21, 15);
+    return thresh;
+}
+
+// Index of the first line (row or column) from the outside of the band that
+// is mostly ink, or -1 when the border is not visible in the band
+static int outermostInkLine(const Mat &ink, bool rows, bool fromEnd) {
+    Mat profile;
+    reduce(ink, profile, rows ? 1 : 0, REDUCE_SUM, CV_32S);
+    int count = rows ? ink.rows : ink.cols;
+    double needed = 0.5 * 255 * (rows ? ink.cols : ink.rows);
+    for (int i = 0; i < count; i++) {
+        int index = fromEnd ? count - 1 - i : i;
+        if (profile.at<int>(index) >= needed) {
+            return index;
+        }
+    }
+    return -1;
+}
+
+// Snap the four edges of a coarse rect to the printed border
+static Rect refineBlock(const Mat &gray, const Rect &coarse) {
+    Rect bounds(0, 0, gray.cols, gray.rows);
+    int top = coarse.y, bottom = coarse.y + coarse.height;
+    int left = coarse.x, right = coarse.x + coarse.width;
+
+    // Horizontal edges: sample the middle 80% of the width
+    int spanX = coarse.x + coarse.width / 10, spanW = coarse.width * 8 / 10;
+    Rect topBand = Rect(spanX, top - REFINE_BAND, spanW, 2 * REFINE_BAND) & bounds;
+    Rect bottomBand = Rect(spanX, bottom - REFINE_BAND, spanW, 2 * REFINE_BAND) & bounds;
+    // Vertical edges: the middle 80% of the height
+    int spanY = coarse.y + coarse.height / 10, spanH = coarse.height * 8 / 10;
+    Rect leftBand = Rect(left - REFINE_BAND, spanY, 2 * REFINE_BAND, spanH) & bounds;
+    Rect rightBand = Rect(right - REFINE_BAND, spanY, 2 * REFINE_BAND, spanH) & bounds;
+
+    if (!topBand.empty()) {
+        int row = outermostInkLine(bandInk(gray, topBand), true, false);
+        if (row >= 0) top = topBand.y + row;
+    }
+    if (!bottomBand.empty()) {
+        int row = outermostInkLine(bandInk(gray, bottomBand), true, true);
+        if (row >= 0) bottom = bottomBand.y + row + 1;
+    }
+    if (!leftBand.empty()) {
+        int col = outermostInkLine(bandInk(gray, leftBand), false, false);
+        if (col >= 0) left = leftBand.x + col;
+    }
+    if (!rightBand.empty()) {
+        int col = outermostInkLine(bandInk(gray, rightBand), false, true);
+        if (col >= 0) right = rightBand.x + col + 1;
+    }
+    return Rect(left, top, right - left, bottom - top) & bounds;
+}
+
+vector<Rect> findBlocksCoarseToFine(const Mat &image) {
+    Mat gray;
+    if (image.channels() == 1) {
+        gray = image;
+    } else {
+        cvtColor(image, gray, COLOR_BGR2GRAY);
+    }
+
+    Mat coarse;
+    resize(gray, coarse, Size(max(1, gray.cols / COARSE_SCALE), max(1, gray.rows / COARSE_SCALE)), 0, 0, INTER_AREA);
+    Mat processed = preprocessCoarse(coarse);
+
+    vector<vector<Point>> contours;
+    findContours(processed, contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
+
+    // Same filters as findContoursOrigin, in coarse units
+    double minArea = 1000.0 / (COARSE_SCALE * COARSE_SCALE);
+    double scaleX = static_cast<double>(gray.cols) / coarse.cols;
+    double scaleY = static_cast<double>(gray.rows) / coarse.rows;
+    vector<Rect> blocks;
+    for (const auto &contour: contours) {
+        if (contourArea(contour) < minArea) continue;
+        vector<Point> approx;
+        approxPolyDP(contour, approx, 0.04 * arcLength(contour, true), true);
+        if (approx.size() != 4) continue;
+        Rect box = boundingRect(approx);
+        if (box.y <= coarse.rows * 2 / 11) continue;
+        Rect scaled(static_cast<int>(box.x * scaleX), static_cast<int>(box.y * scaleY),
+                    static_cast<int>(box.width * scaleX), static_cast<int>(box.height * scaleY));
+        blocks.push_back(refineBlock(gray, scaled));
+    }
+
+    sort(blocks.begin(), blocks.end(), RectPrecedenceComparator(gray.cols));
+    return blocks;
+}
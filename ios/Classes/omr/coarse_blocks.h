@@ -0,0 +1,21 @@
+#ifndef NATIVE_OPENCV_COARSE_BLOCKS_H
+#define NATIVE_OPENCV_COARSE_BLOCKS_H
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+// Downscale factor of the coarse detection pass
+#define COARSE_SCALE 4
+// Half-height (px, working resolution) of the band searched around each coarse edge
+#define REFINE_BAND 12
+// Top-level blocks below the header: 4 for part 1, 4 for part 2, 1 for part 3
+#define EXPECTED_TOP_BLOCKS 9
+
+// Locate the answer blocks without preprocessing the whole working image:
+// candidate rectangles are found on a 1/COARSE_SCALE copy, then each edge is
+// snapped to the block's printed border inside a narrow band at full
+// resolution. Returns working-resolution rects in reading order, like
+// findContoursOrigin.
+std::vector<cv::Rect> findBlocksCoarseToFine(const cv::Mat &image);
+
+#endif // NATIVE_OPENCV_COARSE_BLOCKS_H
@@ -0,0 +1,40 @@
+#ifndef NATIVE_OPENCV_DART_PORT_H
+#define NATIVE_OPENCV_DART_PORT_H
+
+#include <cstdint>
+
+// Minimal mirror of the Dart_CObject ABI from dart_native_api.h, covering
+// only what the engine posts. The posting function itself is handed over
+// from Dart (NativeApi.postCObject), so no Dart SDK headers are needed.
+typedef int64_t Dart_Port;
+
+typedef enum {
+    Dart_CObject_kNull = 0,
+    Dart_CObject_kBool,
+    Dart_CObject_kInt32,
+    Dart_CObject_kInt64,
+    Dart_CObject_kDouble,
+    Dart_CObject_kString,
+    Dart_CObject_kArray,
+} Dart_CObject_Type;
+
+typedef struct _Dart_CObject {
+    Dart_CObject_Type type;
+    union {
+        bool as_bool;
+        int32_t as_int32;
+        int64_t as_int64;
+        double as_double;
+        const char *as_string;
+        struct {
+            intptr_t length;
+            struct _Dart_CObject **values;
+        } as_array;
+        // Keeps the union as large as the real one (as_external_typed_data)
+        void *reserved[5];
+    } value;
+} Dart_CObject;
+
+typedef bool (*Dart_PostCObjectFunc)(Dart_Port port_id, Dart_CObject *message);
+
+#endif // NATIVE_OPENCV_DART_PORT_H
@@ -0,0 +1,40 @@
+#include "detection_ladder.h"
+
+static DetectionVariant makeVariant(const char *name, int blockSize, double offset, double clipLimit) {
+    DetectionVariant variant;
+    variant.name = name;
+    variant.params.thresholdBlockSize = blockSize;
+    variant.params.thresholdOffset = offset;
+    variant.params.claheClipLimit = clipLimit;
+    return variant;
+}
+
+static DetectionVariant widenPart3(DetectionVariant variant) {
+    variant.params.part3MinArea = 15000;
+    variant.params.part3MaxArea = 60000;
+    variant.params.part3MinAspect = 0.30;
+    variant.params.part3MaxAspect = 0.50;
+    return variant;
+}
+
+static DetectionVariant looseBlocks(DetectionVariant variant) {
+    variant.params.minBlockArea = 600;
+    return variant;
+}
+
+const DetectionVariant &detectionVariant(int index) {
+    static const DetectionVariant ladder[DETECTION_VARIANT_COUNT] = {
+            makeVariant("default", 21, 15, 2.0),
+            // Wider neighbourhood: borders under a shadow or a lighting gradient
+            makeVariant("block_31", 31, 15, 2.0),
+            // Narrower one with a lower offset: thin borders of a small or distant sheet
+            makeVariant("block_15", 15, 10, 2.0),
+            // Stronger local contrast for faded print or a dim photo
+            makeVariant("clahe_4", 21, 10, 4.0),
+            // Looser part 3 bounds for a stretched or partly merged part 3 block
+            widenPart3(makeVariant("part3_wide", 21, 15, 2.0)),
+            // Everything at once, also keeping smaller top-level blocks
+            looseBlocks(widenPart3(makeVariant("loose", 31, 10, 3.0))),
+    };
+    return ladder[index < 0 || index >= DETECTION_VARIANT_COUNT ? 0 : index];
+}
@@ -0,0 +1,36 @@
+#ifndef NATIVE_OPENCV_DETECTION_LADDER_H
+#define NATIVE_OPENCV_DETECTION_LADDER_H
+
+// Blocks of a complete sheet: 4 part 1, 4 part 2 and 6 part 3 columns
+#define EXPECTED_BLOCKS 14
+// Time the retries may take once the default attempt missed blocks
+// ("retry_budget_ms"); 0 turns retrying off
+#define DEFAULT_RETRY_BUDGET_MS 400
+#define DETECTION_VARIANT_COUNT 6
+
+// Tunables of block detection (preprocessOriginImage, findContoursOrigin,
+// preprocessPart3, findContoursPart3). The defaults are what the engine
+// has always used.
+struct BlockParams {
+    double claheClipLimit = 2.0;
+    int thresholdBlockSize = 21;   // adaptiveThreshold neighbourhood (odd)
+    double thresholdOffset = 15;   // adaptiveThreshold C
+    double minBlockArea = 1000;    // contour area of a top-level block
+    double part3MinArea = 20000;   // contour area of one part 3 column
+    double part3MaxArea = 50000;
+    double part3MinAspect = 0.35;  // width / height of a part 3 column
+    double part3MaxAspect = 0.45;
+};
+
+struct DetectionVariant {
+    const char *name;
+    BlockParams params;
+};
+
+// Retry ladder for a sheet whose blocks were not all found. Index 0 holds
+// the defaults; the others are tried in order on the same deskewed image,
+// each aimed at a common cause of missed or extra blocks (shadows, a small
+// or distant sheet, low contrast, a stretched part 3).
+const DetectionVariant &detectionVariant(int index);
+
+#endif // NATIVE_OPENCV_DETECTION_LADDER_H
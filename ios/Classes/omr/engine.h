@@ -0,0 +1,79 @@
+#ifndef NATIVE_OPENCV_ENGINE_H
+#define NATIVE_OPENCV_ENGINE_H
+
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+#include "block_frame.h"
+#include "engine_options.h"
+#include "grade_result.h"
+
+// Run the full grading pipeline on an image file, writing the annotated
+// image to outputPath (skipped when empty) and filling `result` at whichever
+// stage it stops.
+// This is what process_image serializes; native tools call it directly.
+void gradeImage(const char *imgPath, const char *outputPath, const EngineOptions &options, GradeResult &result);
+
+// Same, for an image that is already decoded (BGR). The image is not modified.
+void gradeImage(const cv::Mat &image, const char *outputPath, const EngineOptions &options, GradeResult &result);
+
+// gradeImage split into the stages a batch pipeline runs on separate
+// threads: registerSheet (pre-check, deskew, resize, locate the 14 blocks
+// and the header grids), gradeCells (read every bubble) and writeAnnotated
+// (encode the output).
+struct RegisteredSheet {
+    cv::Mat image;      // deskewed working image, 1280 px high
+    cv::Mat annotated;  // copy of image that boxes and marks are drawn on
+    bool annotate = true;  // false: no annotated copy is made (no output image)
+    std::vector<BlockFrame> blockFrames;
+    // Median tilt of the blocks in degrees; 0 once deskewed (not warp-free)
+    double sheetAngle = 0;
+    // Student number and exam code grids, when found above part 1
+    bool hasHeader = false;
+    cv::Rect studentIdGrid;
+    cv::Rect examCodeGrid;
+};
+
+// Decode an image file or encoded bytes for grading. Under a memory budget
+// (EngineOptions::memoryBudget) a large JPEG is decoded directly at a
+// reduced size, and result.memory is started. Empty when undecodable.
+cv::Mat decodeImage(const char *path, const EngineOptions &options, GradeResult &result);
+cv::Mat decodeImage(const std::vector<uchar> &bytes, const EngineOptions &options, GradeResult &result);
+
+// Returns false when `result` is already final (rejected or blocks not found).
+// Pass the decoded image with std::move so it can be freed once deskewed.
+bool registerSheet(cv::Mat image, const EngineOptions &options, RegisteredSheet &sheet, GradeResult &result);
+// Sets result.graded, or a status code when nothing could be read
+void gradeCells(RegisteredSheet &sheet, GradeResult &result);
+// Skipped when outputPath is empty; sets STATUS_ERROR if the write fails
+void writeAnnotated(const char *outputPath, const RegisteredSheet &sheet, GradeResult &result);
+
+// Grade every sheet found in one image (two sheets photographed side by
+// side, an A3 scan of two A4 sheets, ...), each region on its own thread.
+// Annotated images go to outputPath with "_<n>" (1-based) inserted before
+// the extension. Returns STATUS_OK when at least one sheet was graded.
+int gradeSheets(const char *imgPath, const char *outputPath, const EngineOptions &options,
+                std::vector<SheetResult> &sheets, std::string &error);
+
+class ResultWriter;
+
+// Install the process-wide result cache (see ResultCache) in `dir`, bounded
+// to maxBytes (<= 0: unbounded); an empty dir removes it. Returns false when
+// the directory is unusable.
+bool setResultCache(const std::string &dir, long long maxBytes);
+
+// gradeImage followed by writeGradeResult, answered from the result cache
+// when one is installed and the image bytes were seen before. Without a
+// cache this is exactly the old process_image path.
+void gradeImageJson(const char *imgPath, const char *outputPath, const EngineOptions &options, ResultWriter &writer);
+
+// Same, for encoded image bytes (an upload). `bytes` is released before
+// grading starts.
+void gradeEncodedJson(std::vector<uchar> &bytes, const char *outputPath, const EngineOptions &options,
+                      ResultWriter &writer);
+
+// "<stem>_<n><ext>" for the 0-based index-th sheet or page of one input, n
+// counting from 1. An empty or null outputPath stays empty.
+std::string numberedOutputPath(const char *outputPath, size_t index);
+
+#endif // NATIVE_OPENCV_ENGINE_H
@@ -0,0 +1,51 @@
+#include "engine_options.h"
+
+#include "cancel_token.h"
+#include "../cjson/cJSON.h"
+
+static bool readBool(const cJSON *root, const char *name, bool fallback) {
+    const cJSON *item = cJSON_GetObjectItemCaseSensitive(root, name);
+    return cJSON_IsBool(item) ? cJSON_IsTrue(item) : fallback;
+}
+
+static std::string readString(const cJSON *root, const char *name, const std::string &fallback) {
+    const cJSON *item = cJSON_GetObjectItemCaseSensitive(root, name);
+    return cJSON_IsString(item) && item->valuestring != nullptr ? std::string(item->valuestring) : fallback;
+}
+
+static int readInt(const cJSON *root, const char *name, int fallback) {
+    const cJSON *item = cJSON_GetObjectItemCaseSensitive(root, name);
+    return cJSON_IsNumber(item) && item->valuedouble >= 0 ? static_cast<int>(item->valuedouble) : fallback;
+}
+
+static long long readId(const cJSON *root, const char *name, long long fallback) {
+    const cJSON *item = cJSON_GetObjectItemCaseSensitive(root, name);
+    return cJSON_IsNumber(item) && item->valuedouble > 0 ? static_cast<long long>(item->valuedouble) : fallback;
+}
+
+static long long readMegabytes(const cJSON *root, const char *name, long long fallback) {
+    const cJSON *item = cJSON_GetObjectItemCaseSensitive(root, name);
+    return cJSON_IsNumber(item) && item->valuedouble > 0 ? static_cast<long long>(item->valuedouble * (1 << 20))
+                                                          : fallback;
+}
+
+EngineOptions parseEngineOptions(const char *json) {
+    EngineOptions options;
+    if (json == nullptr) {
+        return options;
+    }
+    cJSON *root = cJSON_Parse(json);
+    if (root == nullptr) {
+        return options;
+    }
+    options.precheck = readBool(root, "precheck", options.precheck);
+    options.coarseToFine = readBool(root, "coarse_to_fine", options.coarseToFine);
+    options.warpFree = readBool(root, "warp_free", options.warpFree);
+    options.memoryBudget = readMegabytes(root, "memory_budget_mb", options.memoryBudget);
+    options.allocStats = readBool(root, "alloc_stats", options.allocStats);
+    options.retryBudgetMs = readInt(root, "retry_budget_ms", options.retryBudgetMs);
+    options.cancelToken = findCancelToken(readId(root, "cancel_token", 0));
+    options.tracePath = readString(root, "trace_path", options.tracePath);
+    cJSON_Delete(root);
+    return options;
+}
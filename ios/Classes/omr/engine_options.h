@@ -0,0 +1,38 @@
+#ifndef NATIVE_OPENCV_ENGINE_OPTIONS_H
+#define NATIVE_OPENCV_ENGINE_OPTIONS_H
+
+#include <memory>
+#include <string>
+#include "detection_ladder.h"
+
+struct CancelToken;
+
+// Per-call switches read from the JSON arguments of process_image.
+// Unknown keys are ignored and missing keys keep these defaults.
+struct EngineOptions {
+    // Reject unusable photos from a thumbnail before the full pipeline
+    // ("precheck"); off unless asked for, like coarseToFine
+    bool precheck = false;
+    // Locate blocks on a 1/4-scale image and refine edges locally
+    bool coarseToFine = false;
+    // Sample cells on the tilted sheet instead of rotating the whole image
+    bool warpFree = false;
+    // Bytes the image buffers may use ("memory_budget_mb"); 0 for no limit.
+    // Large photos are decoded and deskewed at reduced resolution to fit.
+    long long memoryBudget = 0;
+    // Count allocations per stage into the result ("alloc_stats", see AllocTracker)
+    bool allocStats = false;
+    // Time (ms) to retry block detection with other parameters when the
+    // default ones miss blocks ("retry_budget_ms"); 0 fails straight away
+    int retryBudgetMs = DEFAULT_RETRY_BUDGET_MS;
+    // Token to poll, looked up from the "cancel_token" id when the options
+    // are parsed (see CancelToken); null for none
+    std::shared_ptr<CancelToken> cancelToken;
+    // Write Chrome trace-event JSON of the call's spans here ("trace_path", see TraceCall)
+    std::string tracePath;
+};
+
+// Parse options from the JSON argument string (null or invalid JSON gives defaults)
+EngineOptions parseEngineOptions(const char *json);
+
+#endif // NATIVE_OPENCV_ENGINE_OPTIONS_H
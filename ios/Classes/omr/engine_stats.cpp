@@ -0,0 +1,209 @@
+#include "engine_stats.h"
+
+#include <atomic>
+#include <string>
+#include "result_writer.h"
+
+using namespace std;
+
+// Capture reason codes counted; higher codes go into the last one
+#define STATS_REASON_SLOTS 8
+
+struct LatencyHistogram {
+    atomic<long long> buckets[STATS_HISTOGRAM_BUCKETS];
+    atomic<long long> sumMicros;
+    atomic<long long> maxMicros;
+};
+
+// Zero-initialized as a static, so usable before any constructor runs
+static struct {
+    LatencyHistogram stages[STATS_STAGE_COUNT];
+    atomic<long long> statusCodes[STATS_STATUS_SLOTS];
+    atomic<long long> rejections[STATS_REASON_SLOTS];
+    atomic<long long> failures[STATS_FAILURE_COUNT];
+    atomic<long long> blocksFound[STATS_MAX_BLOCKS + 1];
+    atomic<long long> cacheHits;
+} stats;
+
+static const chrono::steady_clock::time_point statsEpoch = chrono::steady_clock::now();
+
+const char *statsStageName(int stage) {
+    switch (stage) {
+        case STATS_STAGE_DECODE: return "decode";
+        case STATS_STAGE_REGISTER: return "register";
+        case STATS_STAGE_GRADE: return "grade";
+        case STATS_STAGE_ENCODE: return "encode";
+        case STATS_STAGE_TOTAL: return "total";
+        default: return "unknown";
+    }
+}
+
+const char *statsFailureName(int failure) {
+    switch (failure) {
+        case STATS_FAILURE_DECODE: return "image_not_found";
+        case STATS_FAILURE_BLOCK_COUNT: return "block_count";
+        case STATS_FAILURE_REGISTER: return "register_exception";
+        case STATS_FAILURE_GRADE: return "grade_exception";
+        case STATS_FAILURE_WRITE: return "write_failed";
+        default: return "unknown";
+    }
+}
+
+static int clampSlot(int value, int slots) {
+    return value < 0 ? 0 : (value >= slots ? slots - 1 : value);
+}
+
+// 0-3 us map to themselves, then four buckets per power of two
+static int bucketIndex(long long micros) {
+    if (micros < 4) {
+        return micros < 0 ? 0 : static_cast<int>(micros);
+    }
+    int exponent = 2;
+    while (exponent < 62 && (micros >> (exponent + 1)) != 0) {
+        exponent++;
+    }
+    int index = 4 * (exponent - 1) + static_cast<int>((micros >> (exponent - 2)) & 3);
+    return index < STATS_HISTOGRAM_BUCKETS ? index : STATS_HISTOGRAM_BUCKETS - 1;
+}
+
+// Smallest value of the next bucket
+static long long bucketLimit(int index) {
+    if (index < 3) {
+        return index + 1;
+    }
+    int exponent = (index + 1) / 4 + 1;
+    long long sub = (index + 1) % 4;
+    return (4 + sub) << (exponent - 2);
+}
+
+void recordStageLatency(int stage, long long micros) {
+    if (stage < 0 || stage >= STATS_STAGE_COUNT) {
+        return;
+    }
+    LatencyHistogram &histogram = stats.stages[stage];
+    histogram.buckets[bucketIndex(micros)].fetch_add(1, memory_order_relaxed);
+    histogram.sumMicros.fetch_add(micros, memory_order_relaxed);
+    long long seen = histogram.maxMicros.load(memory_order_relaxed);
+    while (micros > seen && !histogram.maxMicros.compare_exchange_weak(seen, micros, memory_order_relaxed)) {
+    }
+}
+
+void recordGrade(const GradeResult &result, chrono::steady_clock::time_point begin) {
+    recordStageLatency(STATS_STAGE_TOTAL,
+                       chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin).count());
+    stats.statusCodes[clampSlot(result.statusCode, STATS_STATUS_SLOTS)].fetch_add(1, memory_order_relaxed);
+    if (result.statusCode == STATUS_REJECTED) {
+        stats.rejections[clampSlot(result.capture.reason, STATS_REASON_SLOTS)].fetch_add(1, memory_order_relaxed);
+    }
+}
+
+void recordFailure(int failure) {
+    if (failure >= 0 && failure < STATS_FAILURE_COUNT) {
+        stats.failures[failure].fetch_add(1, memory_order_relaxed);
+    }
+}
+
+void recordBlockCount(int found) {
+    stats.blocksFound[clampSlot(found, STATS_MAX_BLOCKS + 1)].fetch_add(1, memory_order_relaxed);
+}
+
+void recordCacheHit() {
+    stats.cacheHits.fetch_add(1, memory_order_relaxed);
+}
+
+static long long readCounter(atomic<long long> &counter, bool reset) {
+    return reset ? counter.exchange(0, memory_order_relaxed) : counter.load(memory_order_relaxed);
+}
+
+// Upper bound of the bucket holding the rank-th smallest sample
+static double percentileMs(const long long *buckets, long long count, double fraction, long long maxMicros) {
+    long long rank = static_cast<long long>(fraction * count + 0.5);
+    rank = rank < 1 ? 1 : rank;
+    long long seen = 0;
+    for (int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            long long limit = bucketLimit(i);
+            return (limit < maxMicros ? limit : maxMicros) / 1000.0;
+        }
+    }
+    return maxMicros / 1000.0;
+}
+
+static void writeHistogram(ResultWriter &writer, LatencyHistogram &histogram, bool reset) {
+    long long buckets[STATS_HISTOGRAM_BUCKETS];
+    long long count = 0;
+    for (int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++) {
+        buckets[i] = readCounter(histogram.buckets[i], reset);
+        count += buckets[i];
+    }
+    long long sum = readCounter(histogram.sumMicros, reset);
+    long long maxMicros = readCounter(histogram.maxMicros, reset);
+
+    writer.beginObject();
+    writer.key("count");
+    writer.number(count);
+    writer.key("mean_ms");
+    writer.number(count > 0 ? sum / 1000.0 / count : 0.0);
+    writer.key("p50_ms");
+    writer.number(count > 0 ? percentileMs(buckets, count, 0.50, maxMicros) : 0.0);
+    writer.key("p95_ms");
+    writer.number(count > 0 ? percentileMs(buckets, count, 0.95, maxMicros) : 0.0);
+    writer.key("p99_ms");
+    writer.number(count > 0 ? percentileMs(buckets, count, 0.99, maxMicros) : 0.0);
+    writer.key("max_ms");
+    writer.number(maxMicros / 1000.0);
+    writer.endObject();
+}
+
+// Counters as {"<index>": n}, leaving out zeros
+static void writeCounters(ResultWriter &writer, atomic<long long> *counters, int slots, bool reset,
+                          long long *total = nullptr) {
+    writer.beginObject();
+    for (int i = 0; i < slots; i++) {
+        long long value = readCounter(counters[i], reset);
+        if (total != nullptr) {
+            *total += value;
+        }
+        if (value > 0) {
+            writer.key(to_string(i).c_str());
+            writer.number(value);
+        }
+    }
+    writer.endObject();
+}
+
+void writeEngineStats(ResultWriter &writer, bool reset) {
+    writer.beginObject();
+    writer.key("engine_version");
+    writer.string(ENGINE_VERSION);
+    writer.key("uptime_s");
+    writer.number(chrono::duration<double>(chrono::steady_clock::now() - statsEpoch).count());
+    writer.key("cache_hits");
+    writer.number(readCounter(stats.cacheHits, reset));
+    // Keys are the status_code and reason_code values of the results
+    long long grades = 0;
+    writer.key("status_codes");
+    writeCounters(writer, stats.statusCodes, STATS_STATUS_SLOTS, reset, &grades);
+    writer.key("grades");
+    writer.number(grades);
+    writer.key("rejections");
+    writeCounters(writer, stats.rejections, STATS_REASON_SLOTS, reset);
+    writer.key("failures");
+    writer.beginObject();
+    for (int i = 0; i < STATS_FAILURE_COUNT; i++) {
+        writer.key(statsFailureName(i));
+        writer.number(readCounter(stats.failures[i], reset));
+    }
+    writer.endObject();
+    writer.key("blocks_found");
+    writeCounters(writer, stats.blocksFound, STATS_MAX_BLOCKS + 1, reset);
+    writer.key("stages");
+    writer.beginObject();
+    for (int i = 0; i < STATS_STAGE_COUNT; i++) {
+        writer.key(statsStageName(i));
+        writeHistogram(writer, stats.stages[i], reset);
+    }
+    writer.endObject();
+    writer.endObject();
+}
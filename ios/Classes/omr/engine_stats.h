@@ -0,0 +1,81 @@
+#ifndef NATIVE_OPENCV_ENGINE_STATS_H
+#define NATIVE_OPENCV_ENGINE_STATS_H
+
+#include <chrono>
+#include "grade_result.h"
+
+// Latency buckets per stage: four per power of two of microseconds, so a
+// reported percentile is within 25% of the true value, up to ~2^31 us
+#define STATS_HISTOGRAM_BUCKETS 124
+// Block counts tracked individually for "Found N bounding boxes"; more go
+// into the last one
+#define STATS_MAX_BLOCKS 32
+// Status codes counted; higher codes go into the last one
+#define STATS_STATUS_SLOTS 8
+
+// Process-wide health counters for field analytics (get_stats).
+//
+// Every grade, whichever entry point ran it, adds its stage latencies, its
+// final status code and, when it failed, the reason. Recording is a few
+// relaxed atomic adds with no lock, so it is always on. Counters are
+// read one by one, so a report taken while grades are running may be off
+// by the grades in flight.
+
+enum StatsStage {
+    STATS_STAGE_DECODE,
+    STATS_STAGE_REGISTER,
+    STATS_STAGE_GRADE,
+    STATS_STAGE_ENCODE,
+    // Whole grade, from decoding to the finished result
+    STATS_STAGE_TOTAL,
+    STATS_STAGE_COUNT
+};
+
+enum StatsFailure {
+    STATS_FAILURE_DECODE,        // image missing or undecodable
+    STATS_FAILURE_BLOCK_COUNT,   // "Found N bounding boxes, expected 14"
+    STATS_FAILURE_REGISTER,      // exception while locating the blocks
+    STATS_FAILURE_GRADE,         // exception while reading the bubbles
+    STATS_FAILURE_WRITE,         // annotated image could not be saved
+    STATS_FAILURE_COUNT
+};
+
+const char *statsStageName(int stage);
+const char *statsFailureName(int failure);
+
+void recordStageLatency(int stage, long long micros);
+// One finished grade: its total latency since `begin`, its status code and,
+// for a rejection, the capture reason
+void recordGrade(const GradeResult &result, std::chrono::steady_clock::time_point begin);
+void recordFailure(int failure);
+// Blocks found by a registration that did not find exactly 14
+void recordBlockCount(int found);
+void recordCacheHit();
+
+// Adds the lifetime of the scope to a stage's histogram
+class StageTimer {
+public:
+    explicit StageTimer(int stage) : stage_(stage), begin_(std::chrono::steady_clock::now()) {}
+
+    ~StageTimer() {
+        recordStageLatency(stage_, std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - begin_).count());
+    }
+
+    StageTimer(const StageTimer &) = delete;
+    StageTimer &operator=(const StageTimer &) = delete;
+
+private:
+    int stage_;
+    std::chrono::steady_clock::time_point begin_;
+};
+
+class ResultWriter;
+
+// {"engine_version", "uptime_s", "cache_hits", "status_codes", "grades",
+//  "rejections", "failures", "blocks_found", "stages"}, where each stage has
+// count, mean, p50, p95, p99 and max in milliseconds. With `reset` every
+// counter is zeroed as it is read, so successive reports hold deltas.
+void writeEngineStats(ResultWriter &writer, bool reset);
+
+#endif // NATIVE_OPENCV_ENGINE_STATS_H
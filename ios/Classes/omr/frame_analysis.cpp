@@ -0,0 +1,129 @@
+#include "frame_analysis.h"
+
+#include <chrono>
+#include "capture_check.h"
+#include "skew.h"
+
+using namespace cv;
+using namespace std;
+
+// Keystone estimate from the sheet outline: how much opposite edges of the
+// fitted quadrilateral differ in length (0 when viewed straight on)
+static double estimatePerspective(const vector<Point> &outline) {
+    if (outline.size() < 4) {
+        return 0;
+    }
+    vector<Point> quad;
+    approxPolyDP(outline, quad, 0.04 * arcLength(outline, true), true);
+    if (quad.size() != 4) {
+        return 0;
+    }
+    double sides[4];
+    for (int i = 0; i < 4; i++) {
+        Point d = quad[(i + 1) % 4] - quad[i];
+        sides[i] = sqrt(static_cast<double>(d.x) * d.x + static_cast<double>(d.y) * d.y);
+    }
+    double worst = 0;
+    for (int i = 0; i < 2; i++) {
+        double longer = max(sides[i], sides[i + 2]);
+        if (longer > 0) {
+            worst = max(worst, 1.0 - min(sides[i], sides[i + 2]) / longer);
+        }
+    }
+    return worst;
+}
+
+FrameAnalysis analyzeFrame(const Mat &frame, double budgetMs, bool rgb) {
+    auto start = chrono::steady_clock::now();
+    auto elapsed = [&start]() {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    };
+    auto overBudget = [&]() { return budgetMs > 0 && elapsed() >= budgetMs; };
+
+    FrameAnalysis analysis;
+
+    // Shrink first: converting the full-resolution frame would cost more
+    // than all of the analysis
+    Mat reduced;
+    if (frame.rows > ANALYZE_HEIGHT) {
+        int width = static_cast<int>(static_cast<double>(frame.cols) * ANALYZE_HEIGHT / frame.rows);
+        resize(frame, reduced, Size(max(1, width), ANALYZE_HEIGHT), 0, 0, INTER_AREA);
+    } else {
+        reduced = frame;
+    }
+    Mat small;
+    if (reduced.channels() == 1) {
+        small = reduced;
+    } else if (reduced.channels() == 4) {
+        cvtColor(reduced, small, rgb ? COLOR_RGBA2GRAY : COLOR_BGRA2GRAY);
+    } else {
+        cvtColor(reduced, small, COLOR_BGR2GRAY);
+    }
+
+    // Cheapest first, so a tight budget still yields the most useful hints
+    bool focused = false, framed = false;
+    do {
+        analysis.brightness = mean(small)[0];
+        if (overBudget()) break;
+
+        analysis.focus = measureFocus(small);
+        focused = true;
+        if (overBudget()) break;
+
+        Mat blurred;
+        GaussianBlur(small, blurred, Size(3, 3), 0);
+        vector<Point> outline;
+        analysis.sheetCoverage = estimateSheetCoverage(blurred, &outline);
+        analysis.perspective = estimatePerspective(outline);
+        framed = true;
+        if (overBudget()) break;
+
+        vector<Vec4i> lines = detectLineSegments(small);
+        analysis.skewAngle = horizontalSkewAngle(lines, 0.2 * small.rows);
+        analysis.verticalSkew = verticalSkewAngle(lines, 0.2 * small.cols);
+        analysis.complete = true;
+    } while (false);
+
+    // Only metrics that were measured count; "ok" needs all of them
+    if (analysis.brightness < PRECHECK_MIN_BRIGHTNESS) {
+        analysis.hint = "too_dark";
+    } else if (focused && analysis.focus < PRECHECK_MIN_FOCUS) {
+        analysis.hint = "hold_steady";
+    } else if (framed && analysis.sheetCoverage < HINT_MIN_COVERAGE) {
+        analysis.hint = "move_closer";
+    } else if (framed && analysis.perspective > HINT_MAX_PERSPECTIVE) {
+        analysis.hint = "tilted";
+    } else if (!analysis.complete) {
+        analysis.hint = "measuring";
+    } else if (abs(analysis.skewAngle) > HINT_MAX_SKEW || abs(analysis.verticalSkew) > HINT_MAX_SKEW) {
+        analysis.hint = "tilted";
+    } else {
+        analysis.hint = "ok";
+    }
+
+    analysis.elapsedMs = elapsed();
+    return analysis;
+}
+
+void writeFrameAnalysis(ResultWriter &writer, const FrameAnalysis &analysis) {
+    writer.beginObject();
+    writer.key("hint");
+    writer.string(analysis.hint);
+    writer.key("brightness");
+    writer.number(analysis.brightness);
+    writer.key("focus");
+    writer.number(analysis.focus);
+    writer.key("sheet_coverage");
+    writer.number(analysis.sheetCoverage);
+    writer.key("perspective");
+    writer.number(analysis.perspective);
+    writer.key("skew_angle");
+    writer.number(analysis.skewAngle);
+    writer.key("vertical_skew");
+    writer.number(analysis.verticalSkew);
+    writer.key("complete");
+    writer.boolean(analysis.complete);
+    writer.key("elapsed_ms");
+    writer.number(analysis.elapsedMs);
+    writer.endObject();
+}
@@ -0,0 +1,50 @@
+#ifndef NATIVE_OPENCV_FRAME_ANALYSIS_H
+#define NATIVE_OPENCV_FRAME_ANALYSIS_H
+
+#include <opencv2/opencv.hpp>
+#include "result_writer.h"
+
+// Height frames are reduced to before analysis
+#define ANALYZE_HEIGHT 240
+
+// Pixel layouts accepted by analyze_frame
+#define FRAME_FORMAT_GRAY 0   // 8-bit luma, e.g. the Y plane of a YUV frame
+#define FRAME_FORMAT_BGRA 1
+#define FRAME_FORMAT_RGBA 2
+#define FRAME_FORMAT_BGR 3
+
+// Bytes per pixel of a FRAME_FORMAT_* layout
+inline int frameFormatChannels(int format) {
+    return format == FRAME_FORMAT_GRAY ? 1 : (format == FRAME_FORMAT_BGR ? 3 : 4);
+}
+
+// Guidance thresholds
+#define HINT_MAX_SKEW 3.0          // degrees
+#define HINT_MAX_PERSPECTIVE 0.15  // relative difference of opposite sheet edges
+#define HINT_MIN_COVERAGE 0.45     // fraction of the frame covered by the sheet
+
+// Capture-quality metrics for one preview frame
+struct FrameAnalysis {
+    double brightness = 0;     // mean gray level, 0-255
+    double focus = 0;          // variance of the Laplacian
+    double sheetCoverage = 0;  // fraction of the frame covered by the sheet
+    double perspective = 0;    // 0 when the sheet is seen straight on
+    double skewAngle = 0;      // degrees, from near-horizontal lines
+    double verticalSkew = 0;   // degrees, from near-vertical lines
+    bool complete = false;     // false when the time budget cut analysis short
+    double elapsedMs = 0;
+    // "too_dark", "hold_steady", "move_closer", "tilted", "ok", or
+    // "measuring" when the metrics computed before the budget ran out are
+    // fine but the rest were not measured
+    const char *hint = "";
+};
+
+// Analyse a frame (gray, BGR or BGRA; RGBA when `rgb`), running stages from
+// cheapest to most expensive and stopping once budgetMs is spent (budgetMs
+// <= 0 means no limit). The frame is shrunk before anything else touches
+// its pixels.
+FrameAnalysis analyzeFrame(const cv::Mat &frame, double budgetMs, bool rgb = false);
+
+void writeFrameAnalysis(ResultWriter &writer, const FrameAnalysis &analysis);
+
+#endif // NATIVE_OPENCV_FRAME_ANALYSIS_H
@@ -0,0 +1,137 @@
+#ifndef NATIVE_OPENCV_GRADE_RESULT_H
+#define NATIVE_OPENCV_GRADE_RESULT_H
+
+#include <string>
+#include <vector>
+
+// Engine version reported in every result
+#define ENGINE_VERSION "15"
+
+// Status codes returned in "status_code"
+#define STATUS_OK 0
+#define STATUS_ERROR 1
+#define STATUS_NO_ANSWERS 2
+#define STATUS_REJECTED 3
+// The call's cancel token was cancelled (see CancelToken)
+#define STATUS_CANCELLED 4
+
+// Reason codes for a capture rejected by the pre-check ("reason_code")
+#define CAPTURE_OK 0
+#define CAPTURE_BLURRY 1
+#define CAPTURE_TOO_DARK 2
+#define CAPTURE_OVEREXPOSED 3
+#define CAPTURE_NO_SHEET 4
+#define CAPTURE_BLOCKS_MISSING 5
+
+// Header digit for a grid column left blank or marked more than once
+#define HEADER_UNREADABLE '?'
+
+struct part1Answer {
+    std::string questionNumber;
+    std::string userChoiceResult;
+};
+
+struct part2Answer {
+    std::string questionNumber;
+    std::string subName;
+    bool userChoiceResult;
+};
+
+struct part3Answer {
+    std::string questionNumber;
+    std::string userResult;
+};
+
+// Thumbnail measurements taken by the capture pre-check
+struct CaptureCheck {
+    int reason = CAPTURE_OK;
+    double focus = 0;          // variance of the Laplacian
+    double brightness = 0;     // mean gray level, 0-255
+    double clipped = 0;        // fraction of over-exposed pixels
+    double sheetCoverage = 0;  // fraction of the frame covered by the sheet
+    int blockCount = 0;        // answer blocks visible below the header
+};
+
+// Image memory of one grade, reported when a budget was given ("memory")
+struct MemoryReport {
+    long long budgetBytes = 0;
+    // Modelled high-water mark of the image buffers held at once (see
+    // MemoryTrace); an estimate from buffer sizes, not measured usage
+    long long modelledPeakBytes = 0;
+    // Resolution the input was deskewed at, relative to the decoded photo
+    double scale = 1;
+    // Even the 1280 px working resolution did not fit the budget
+    bool overBudget = false;
+};
+
+// Stages allocations are reported for (see AllocStage)
+#define ALLOC_STAGE_COUNT 4
+
+struct AllocStageReport {
+    long long bytes = 0;      // allocated while the stage ran
+    long long count = 0;      // number of allocations
+    long long peakBytes = 0;  // most bytes of the sheet alive at once during the stage
+};
+
+// OpenCV buffers allocated for one grade, reported when the "alloc_stats"
+// option is set ("allocations")
+struct AllocReport {
+    bool tracked = false;
+    AllocStageReport stages[ALLOC_STAGE_COUNT];
+    long long peakBytes = 0;
+};
+
+// Block detection beyond the default parameters, reported once a retry ran
+// ("detection")
+struct DetectionReport {
+    int attempts = 0;      // ladder rungs tried, the default one included
+    int variant = -1;      // rung that found every block, -1 when none did
+    double retryMs = 0;    // time spent after the default attempt
+    // Rungs were left untried because the retry budget ran out
+    bool budgetExhausted = false;
+};
+
+// Detection for one bubble, in pixels of the 1280 px working image. For an
+// empty bubble the point is its outline's centre, or the cell centre when no
+// outline was found.
+struct CellMark {
+    bool filled = false;
+    float fill = 0;
+    int x = 0;
+    int y = 0;
+};
+
+// Everything process_image reports back, collected before serialization
+struct GradeResult {
+    int statusCode = STATUS_OK;
+    std::string error;
+    // Set once all three parts were read; only then are the per-part objects written
+    bool graded = false;
+    // Set when the pre-check ran; written out when it rejected the capture
+    bool checked = false;
+    CaptureCheck capture;
+    std::vector<part1Answer> part1Answers;
+    std::vector<part2Answer> part2Answers;
+    std::vector<part3Answer> part3Answers;
+    // Every bubble, indexed [question][choice], [question][sub][yes/no] and
+    // [question][symbol row][digit column]; valid once graded
+    CellMark part1Cells[40][4];
+    CellMark part2Cells[8][4][2];
+    CellMark part3Cells[6][12][4];
+    // Student number and exam code from the header grids, one character per
+    // column; set when both grids were found. Not needed for "graded".
+    bool headerRead = false;
+    std::string studentId;
+    std::string examCode;
+    MemoryReport memory;
+    AllocReport allocations;
+    DetectionReport detection;
+};
+
+// One sheet of a multi-sheet image: its region in input pixels and result
+struct SheetResult {
+    int x = 0, y = 0, width = 0, height = 0;
+    GradeResult result;
+};
+
+#endif // NATIVE_OPENCV_GRADE_RESULT_H
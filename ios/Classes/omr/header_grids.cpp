@@ -0,0 +1,45 @@
+#include "header_grids.h"
+#include "pipeline.h"
+
+using namespace cv;
+using namespace std;
+
+bool findHeaderGrids(const Mat &image, int headerBottom, Rect &studentId, Rect &examCode) {
+    headerBottom = min(headerBottom, image.rows);
+    if (headerBottom <= 0) {
+        return false;
+    }
+    Mat mask = preprocessOriginImage(image(Rect(0, 0, image.cols, headerBottom)));
+    vector<vector<Point>> contours;
+    findContours(mask, contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
+
+    vector<Rect> grids;
+    for (const auto &contour: contours) {
+        if (contourArea(contour) < 1000) continue;
+        vector<Point> approx;
+        approxPolyDP(contour, approx, 0.04 * arcLength(contour, true), true);
+        if (approx.size() != 4) continue;
+        Rect box = boundingRect(approx);
+        double aspect = static_cast<double>(box.width) / box.height;
+        if (aspect >= HEADER_GRID_MIN_ASPECT && aspect <= HEADER_GRID_MAX_ASPECT &&
+            box.height >= headerBottom * HEADER_GRID_MIN_HEIGHT) {
+            grids.push_back(box);
+        }
+    }
+    if (grids.size() < 2) {
+        return false;
+    }
+    sort(grids.begin(), grids.end(), [](const Rect &a, const Rect &b) { return a.x < b.x; });
+    studentId = grids[grids.size() - 2];
+    examCode = grids[grids.size() - 1];
+    // Six digit columns against three
+    return studentId.width > examCode.width;
+}
+
+Rect headerCell(const Rect &grid, int columns, int col, int row) {
+    int x0 = grid.x + grid.width * col / columns;
+    int x1 = grid.x + grid.width * (col + 1) / columns;
+    int y0 = grid.y + grid.height * row / HEADER_GRID_ROWS;
+    int y1 = grid.y + grid.height * (row + 1) / HEADER_GRID_ROWS;
+    return Rect(x0 + 1, y0 + 1, max(1, x1 - x0 - 1), max(1, y1 - y0 - 1));
+}
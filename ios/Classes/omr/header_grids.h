@@ -0,0 +1,27 @@
+#ifndef NATIVE_OPENCV_HEADER_GRIDS_H
+#define NATIVE_OPENCV_HEADER_GRIDS_H
+
+#include <opencv2/opencv.hpp>
+
+// Digit columns of the student number ("Số báo danh") and exam code
+// ("Mã đề thi") grids; each column has one bubble per digit 0-9, top down
+#define HEADER_ID_DIGITS 6
+#define HEADER_CODE_DIGITS 3
+#define HEADER_GRID_ROWS 10
+// Both grids are tall, narrow tables: aspect (width / height) bounds and
+// minimum height as a fraction of the header strip
+#define HEADER_GRID_MIN_ASPECT 0.15
+#define HEADER_GRID_MAX_ASPECT 0.6
+#define HEADER_GRID_MIN_HEIGHT 0.4
+
+// Locate both grids in the header strip above part 1 (rows [0, headerBottom)
+// of the working image), binarized with preprocessOriginImage like the
+// answer blocks. Only the strip is processed, not the whole sheet. They are
+// the two rightmost tall tables, student number first. Returns false unless
+// both are found.
+bool findHeaderGrids(const cv::Mat &image, int headerBottom, cv::Rect &studentId, cv::Rect &examCode);
+
+// Cell of digit `row` in column `col` of a grid with `columns` columns
+cv::Rect headerCell(const cv::Rect &grid, int columns, int col, int row);
+
+#endif // NATIVE_OPENCV_HEADER_GRIDS_H
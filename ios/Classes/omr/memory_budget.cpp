@@ -0,0 +1,131 @@
+#include "memory_budget.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using namespace cv;
+using namespace std;
+
+static int readBigEndian16(const unsigned char *p) {
+    return (p[0] << 8) | p[1];
+}
+
+static int readExif16(const unsigned char *p, bool bigEndian) {
+    return bigEndian ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+}
+
+static long readExif32(const unsigned char *p, bool bigEndian) {
+    return bigEndian ? (static_cast<long>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3]
+                     : (static_cast<long>(p[3]) << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+}
+
+// EXIF orientation tag of an APP1 segment body, 1 (upright) when absent
+static int exifOrientation(const unsigned char *body, size_t length) {
+    if (length < 14 || memcmp(body, "Exif\0\0", 6) != 0) {
+        return 1;
+    }
+    const unsigned char *tiff = body + 6;
+    size_t tiffLength = length - 6;
+    bool bigEndian = tiff[0] == 'M';
+    long ifd = readExif32(tiff + 4, bigEndian);
+    if (ifd < 8 || static_cast<size_t>(ifd) + 2 > tiffLength) {
+        return 1;
+    }
+    int entries = readExif16(tiff + ifd, bigEndian);
+    for (int i = 0; i < entries; i++) {
+        size_t entry = ifd + 2 + 12 * static_cast<size_t>(i);
+        if (entry + 12 > tiffLength) {
+            break;
+        }
+        if (readExif16(tiff + entry, bigEndian) == 0x0112) {
+            return readExif16(tiff + entry + 8, bigEndian);
+        }
+    }
+    return 1;
+}
+
+// Walk the segments after SOI up to the first start-of-frame. The size is
+// as decoded, which turns the frame by its EXIF orientation.
+static bool peekJpegSize(const unsigned char *data, size_t length, Size &size) {
+    size_t at = 2;
+    int orientation = 1;
+    while (at + 4 <= length) {
+        if (data[at] != 0xFF) {
+            return false;
+        }
+        // Fill bytes before a marker
+        if (data[at + 1] == 0xFF) {
+            at++;
+            continue;
+        }
+        int type = data[at + 1];
+        int segment = readBigEndian16(data + at + 2);
+        bool startOfFrame = type >= 0xC0 && type <= 0xCF && type != 0xC4 && type != 0xC8 && type != 0xCC;
+        if (startOfFrame) {
+            if (at + 9 > length) return false;
+            size = Size(readBigEndian16(data + at + 7), readBigEndian16(data + at + 5));
+            // Orientations 5-8 swap the axes
+            if (orientation >= 5 && orientation <= 8) {
+                size = Size(size.height, size.width);
+            }
+            return size.width > 0 && size.height > 0;
+        }
+        if (segment < 2) {
+            return false;
+        }
+        if (type == 0xE1 && at + 2 + segment <= length) {
+            int tag = exifOrientation(data + at + 4, segment - 2);
+            if (tag != 1) {
+                orientation = tag;
+            }
+        }
+        at += 2 + segment;
+    }
+    return false;
+}
+
+bool peekImageSize(const unsigned char *data, size_t length, Size &size) {
+    if (length >= 2 && data[0] == 0xFF && data[1] == 0xD8) {
+        return peekJpegSize(data, length, size);
+    }
+    if (length >= 24 && data[0] == 0x89 && data[1] == 'P' && data[2] == 'N' && data[3] == 'G') {
+        // IHDR is always the first chunk
+        int width = (data[16] << 24) | (data[17] << 16) | (data[18] << 8) | data[19];
+        int height = (data[20] << 24) | (data[21] << 16) | (data[22] << 8) | data[23];
+        size = Size(width, height);
+        return width > 0 && height > 0;
+    }
+    return false;
+}
+
+bool peekImageSize(const char *path, Size &size) {
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    vector<unsigned char> head(MEMORY_PEEK_BYTES);
+    head.resize(fread(head.data(), 1, head.size(), file));
+    fclose(file);
+    return peekImageSize(head.data(), head.size(), size);
+}
+
+double budgetScale(const Size &size, long long budgetBytes, bool deskew) {
+    double pixels = static_cast<double>(size.width) * size.height;
+    if (budgetBytes <= 0 || pixels <= 0) {
+        return 1.0;
+    }
+    double perPixel = deskew ? MEMORY_DESKEW_BYTES_PER_PIXEL : MEMORY_FLAT_BYTES_PER_PIXEL;
+    double scale = sqrt(budgetBytes / (perPixel * pixels));
+    // Deskewing only straightens a few degrees, so the rows stay the sheet's height
+    double floorScale = static_cast<double>(MEMORY_WORKING_HEIGHT) / size.height;
+    return min(1.0, max(scale, floorScale));
+}
+
+int reducedReadFlag(double scale) {
+    if (scale <= 0.125) return IMREAD_REDUCED_COLOR_8;
+    if (scale <= 0.25) return IMREAD_REDUCED_COLOR_4;
+    if (scale <= 0.5) return IMREAD_REDUCED_COLOR_2;
+    return IMREAD_COLOR;
+}
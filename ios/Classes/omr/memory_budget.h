@@ -0,0 +1,50 @@
+#ifndef NATIVE_OPENCV_MEMORY_BUDGET_H
+#define NATIVE_OPENCV_MEMORY_BUDGET_H
+
+#include <cstddef>
+#include <opencv2/opencv.hpp>
+
+// Working-set model of the full-resolution steps, in bytes per input pixel:
+// deskewing holds the BGR input and its rotated copy (3 + 3), line
+// detection the input plus a gray and an edge plane (3 + 1 + 1).
+#define MEMORY_DESKEW_BYTES_PER_PIXEL 6
+#define MEMORY_FLAT_BYTES_PER_PIXEL 3
+// Sheet height everything is graded at; the budget never scales below it
+#define MEMORY_WORKING_HEIGHT 1280
+
+// Bytes read from the start of a file to find its dimensions; camera JPEGs
+// put up to 64 KB of EXIF and thumbnail ahead of the frame header
+#define MEMORY_PEEK_BYTES (256 * 1024)
+
+// Width and height from a JPEG or PNG header, without decoding the image,
+// with a JPEG's EXIF orientation applied as imread does. Returns false for
+// other formats, unreadable files or a frame header past the bytes given.
+bool peekImageSize(const unsigned char *data, size_t length, cv::Size &size);
+bool peekImageSize(const char *path, cv::Size &size);
+
+// Scale (<= 1) for an input of `size` so the full-resolution steps fit in
+// budgetBytes; 1 when they already fit or budgetBytes <= 0. The image
+// height, which becomes the sheet's, never drops below MEMORY_WORKING_HEIGHT.
+double budgetScale(const cv::Size &size, long long budgetBytes, bool deskew);
+
+// imread flag decoding a JPEG straight at 1/2, 1/4 or 1/8 size (DCT
+// scaling, so the full image is never allocated) for the largest power of
+// two not below `scale`; IMREAD_COLOR when scale is 1
+int reducedReadFlag(double scale);
+
+inline long long matBytes(const cv::Mat &mat) {
+    return static_cast<long long>(mat.total() * mat.elemSize());
+}
+
+// Running high-water mark of the image buffers one grade holds at once.
+// Steps report the buffers they keep alive together; the pipeline's own
+// small temporaries (cell crops, contours) are not counted.
+struct MemoryTrace {
+    long long peakBytes = 0;
+
+    void note(long long bytes) {
+        if (bytes > peakBytes) peakBytes = bytes;
+    }
+};
+
+#endif // NATIVE_OPENCV_MEMORY_BUDGET_H
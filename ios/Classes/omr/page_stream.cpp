@@ -0,0 +1,103 @@
+#include "page_stream.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <opencv2/opencv.hpp>
+#include "cancel_token.h"
+#include "engine.h"
+#include "trace_events.h"
+
+using namespace cv;
+using namespace std;
+
+int countPages(const char *path) {
+    try {
+        return static_cast<int>(imcount(path));
+    } catch (const cv::Exception &) {
+        return 0;
+    }
+}
+
+// Counts a page as done however its task ends, or gradePages would wait forever
+struct PageDone {
+    mutex &inFlightMutex;
+    condition_variable &pageDone;
+    int &inFlight;
+
+    ~PageDone() {
+        // Notify under the lock: the waiting caller owns the condition
+        // variable and returns as soon as it sees the last page done
+        lock_guard<mutex> lock(inFlightMutex);
+        inFlight--;
+        pageDone.notify_all();
+    }
+};
+
+int gradePages(const char *path, const char *outputPath, const EngineOptions &options, WorkerPool &pool,
+               const function<void(int page, const GradeResult &result)> &onPage) {
+    TraceCall traceCall(options.tracePath);
+    TraceSpan traceSpan("process_pages", path);
+    CancelScope cancelScope(options.cancelToken);
+    int total = countPages(path);
+    if (total <= 0) {
+        return -1;
+    }
+
+    mutex inFlightMutex;
+    condition_variable pageDone;
+    int inFlight = 0;
+    const int limit = pool.size() + PAGES_AHEAD;
+
+    for (int page = 0; page < total; page++) {
+        {
+            unique_lock<mutex> lock(inFlightMutex);
+            pageDone.wait(lock, [&] { return inFlight < limit; });
+            inFlight++;
+        }
+
+        // Decodes only this page; earlier pages are skipped by directory,
+        // not decoded. Once cancelled the remaining pages are only reported.
+        vector<Mat> decoded;
+        try {
+            if (!cancelRequested()) {
+                TraceSpan span("decode_page", page);
+                imreadmulti(path, decoded, page, 1, IMREAD_COLOR);
+            }
+        } catch (const cv::Exception &) {
+            decoded.clear();
+        }
+        Mat image = decoded.empty() ? Mat() : decoded[0];
+        string pageOutput = numberedOutputPath(outputPath, page);
+
+        pool.submit([&, page, image, pageOutput]() {
+            PageDone done = {inFlightMutex, pageDone, inFlight};
+            TraceSpan span("page", page);
+            GradeResult result;
+            CancelScope pageCancelScope(options.cancelToken);
+            if (stopIfCancelled(result)) {
+                // Not decoded, or cancelled while queued
+            } else if (image.empty()) {
+                result.statusCode = STATUS_ERROR;
+                result.error = "Page could not be decoded";
+            } else {
+                // A page that throws is reported like one that failed
+                try {
+                    gradeImage(image, pageOutput.c_str(), options, result);
+                } catch (const exception &e) {
+                    result = GradeResult();
+                    result.statusCode = STATUS_ERROR;
+                    result.error = e.what();
+                } catch (...) {
+                    result = GradeResult();
+                    result.statusCode = STATUS_ERROR;
+                    result.error = "Unexpected error";
+                }
+            }
+            onPage(page, result);
+        });
+    }
+
+    unique_lock<mutex> lock(inFlightMutex);
+    pageDone.wait(lock, [&] { return inFlight == 0; });
+    return total;
+}
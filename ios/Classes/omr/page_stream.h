@@ -0,0 +1,29 @@
+#ifndef NATIVE_OPENCV_PAGE_STREAM_H
+#define NATIVE_OPENCV_PAGE_STREAM_H
+
+#include <functional>
+#include "engine_options.h"
+#include "grade_result.h"
+#include "worker_pool.h"
+
+// Pages decoded ahead of grading, on top of one per worker thread
+#define PAGES_AHEAD 1
+
+// Number of pages in a (multi-page) image file, 0 when it cannot be read
+int countPages(const char *path);
+
+// Grade every page of a multi-page image, e.g. a scanner-feeder TIFF, while
+// it is being read. Pages are decoded one at a time on the calling thread
+// and graded on `pool`; decoding waits while pool.size() + PAGES_AHEAD
+// pages are in flight, so memory stays at a few pages whatever the file
+// size. onPage runs on a pool thread as each page finishes (completion
+// order, 0-based page). Annotated pages go to outputPath numbered like
+// gradeSheets. Returns the number of pages, or -1 if the file is unreadable.
+// Once options.cancelToken is cancelled the remaining pages are reported
+// with STATUS_CANCELLED without being decoded.
+//
+// Must not be called from a thread of `pool` itself.
+int gradePages(const char *path, const char *outputPath, const EngineOptions &options, WorkerPool &pool,
+               const std::function<void(int page, const GradeResult &result)> &onPage);
+
+#endif // NATIVE_OPENCV_PAGE_STREAM_H
@@ -0,0 +1,50 @@
+#ifndef NATIVE_OPENCV_PIPELINE_H
+#define NATIVE_OPENCV_PIPELINE_H
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include "block_frame.h"
+#include "detection_ladder.h"
+
+// Internal stages of gradeImage, defined in native_opencv.cpp. Exposed so
+// native tools can exercise each step on its own; not part of the FFI.
+
+struct OptionalPoint {
+    bool hasValue;
+    cv::Point value;
+    // Inked fraction of the mark's bounding box; filled above 0.5
+    float fill;
+};
+
+// Resize to a fixed height, keeping the aspect ratio
+cv::Mat resizeImage(const cv::Mat &image, int targetHeight);
+
+// Deskew using near-vertical / near-horizontal line segments at least
+// minLengthPercentage of the image width / height long
+cv::Mat rotateImageVertically(const cv::Mat &inputImage, double minLengthPercentage = 20.0);
+cv::Mat rotateImageHorizontally(const cv::Mat &inputImage, double minLengthPercentage = 20.0);
+
+// Binary mask of the block borders for the full sheet and for the part 3 crop
+cv::Mat preprocessOriginImage(const cv::Mat &image, const BlockParams &params = BlockParams());
+cv::Mat preprocessPart3(const cv::Mat &image, const BlockParams &params = BlockParams());
+
+// Block rectangles from a preprocessed mask, in reading order
+std::vector<cv::Rect> findContoursOrigin(const cv::Mat &image, const BlockParams &params = BlockParams());
+std::vector<cv::Rect> findContoursPart3(const cv::Mat &image, const BlockParams &params = BlockParams());
+
+// The 14 answer blocks of a resized sheet: 4 part 1, 4 part 2, 6 part 3.
+// `params` picks a rung of the retry ladder (see detectionVariant).
+std::vector<cv::Rect> extractBoundingBoxes(const cv::Mat &originalImage, bool coarseToFine = false,
+                                           const BlockParams &params = BlockParams());
+std::vector<BlockFrame> extractBlockFrames(const cv::Mat &originalImage, const BlockParams &params = BlockParams());
+
+// Bubble in a single cell; hasValue is set when it is filled in
+OptionalPoint detectChoiceCircle(const cv::Mat &choiceImage, int binaryThreshold = 200);
+
+// Mark the answer key from `json` into pre-sized one-hot tables
+// ([40][4], [8][4][2], [6][12][4])
+void parseCorrectAnswers(const char *json, std::vector<std::vector<int>> &part1CorrectChoices,
+                         std::vector<std::vector<std::vector<int>>> &part2CorrectChoices,
+                         std::vector<std::vector<std::vector<int>>> &part3CorrectChoices);
+
+#endif // NATIVE_OPENCV_PIPELINE_H
@@ -0,0 +1,294 @@
+#include "result_cache.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#include "grade_result.h"
+
+using namespace std;
+
+static const uint64_t kPrime1 = 11400714785074694791ULL;
+static const uint64_t kPrime2 = 14029467366897019727ULL;
+static const uint64_t kPrime3 = 1609587929392839161ULL;
+static const uint64_t kPrime4 = 9650029242287828579ULL;
+static const uint64_t kPrime5 = 2870177450012600261ULL;
+
+static inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input) {
+    acc += input * kPrime2;
+    acc = rotl(acc, 31);
+    return acc * kPrime1;
+}
+
+static inline uint64_t mergeRound(uint64_t acc, uint64_t val) {
+    acc ^= round64(0, val);
+    return acc * kPrime1 + kPrime4;
+}
+
+// Little-endian reads; every target we ship (arm64, x86_64) is little endian
+uint64_t hashBytes(const void *data, size_t length, uint64_t seed) {
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    const unsigned char *end = p + length;
+    uint64_t h;
+
+    if (length >= 32) {
+        uint64_t v1 = seed + kPrime1 + kPrime2;
+        uint64_t v2 = seed + kPrime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - kPrime1;
+        const unsigned char *limit = end - 32;
+        do {
+            v1 = round64(v1, read64(p));
+            v2 = round64(v2, read64(p + 8));
+            v3 = round64(v3, read64(p + 16));
+            v4 = round64(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = mergeRound(h, v1);
+        h = mergeRound(h, v2);
+        h = mergeRound(h, v3);
+        h = mergeRound(h, v4);
+    } else {
+        h = seed + kPrime5;
+    }
+    h += static_cast<uint64_t>(length);
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= round64(0, read64(p));
+        h = rotl(h, 27) * kPrime1 + kPrime4;
+    }
+    if (p + 4 <= end) {
+        h ^= static_cast<uint64_t>(read32(p)) * kPrime1;
+        h = rotl(h, 23) * kPrime2 + kPrime3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= (*p) * kPrime5;
+        h = rotl(h, 11) * kPrime1;
+    }
+
+    h ^= h >> 33;
+    h *= kPrime2;
+    h ^= h >> 29;
+    h *= kPrime3;
+    h ^= h >> 32;
+    return h;
+}
+
+static string extensionOf(const char *path) {
+    string name(path);
+    size_t slash = name.find_last_of("/\\");
+    size_t dot = name.find_last_of('.');
+    if (dot == string::npos || (slash != string::npos && dot < slash)) {
+        return "";
+    }
+    return name.substr(dot);
+}
+
+static bool readFile(const string &path, string &data) {
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    data.clear();
+    char chunk[16384];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        data.append(chunk, n);
+    }
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+static long long fileSize(const string &path) {
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 ? static_cast<long long>(info.st_size) : 0;
+}
+
+ResultCache::ResultCache(const string &dir, long long maxBytes)
+        : dir_(dir), maxBytes_(maxBytes), totalBytes_(0), valid_(false) {
+    while (dir_.size() > 1 && dir_.back() == '/') {
+        dir_.pop_back();
+    }
+    if (mkdir(dir_.c_str(), 0755) != 0 && errno != EEXIST) {
+        return;
+    }
+    DIR *handle = opendir(dir_.c_str());
+    if (handle == nullptr) {
+        return;
+    }
+    while (struct dirent *entry = readdir(handle)) {
+        if (entry->d_name[0] != '.') {
+            totalBytes_ += fileSize(dir_ + "/" + entry->d_name);
+        }
+    }
+    closedir(handle);
+    valid_ = true;
+}
+
+string ResultCache::key(const vector<unsigned char> &imageBytes, const EngineOptions &options) const {
+    char salt[96];
+    snprintf(salt, sizeof(salt), "%s/%d/%d%d%d/%lld/%d", ENGINE_VERSION, RESULT_CACHE_LAYOUT_VERSION,
+             options.precheck ? 1 : 0, options.coarseToFine ? 1 : 0, options.warpFree ? 1 : 0, options.memoryBudget,
+             options.retryBudgetMs);
+    uint64_t seed = hashBytes(salt, strlen(salt));
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx",
+             static_cast<unsigned long long>(hashBytes(imageBytes.data(), imageBytes.size(), seed)));
+    return hex;
+}
+
+string ResultCache::entryPath(const string &key, const string &suffix) const {
+    return dir_ + "/" + key + suffix;
+}
+
+long long ResultCache::sizeBytes() const {
+    lock_guard<mutex> lock(mutex_);
+    return totalBytes_;
+}
+
+// Entry file: one state byte and a newline, then the JSON
+#define ENTRY_WITH_IMAGE 'I'     // graded, annotated image stored alongside
+#define ENTRY_WITHOUT_IMAGE 'G'  // graded without an output path
+#define ENTRY_NOT_GRADED 'N'     // no annotated image exists for this result
+
+bool ResultCache::lookup(const string &key, const char *outputPath, string &json) {
+    string jsonPath = entryPath(key, ".json");
+    string data;
+    if (!readFile(jsonPath, data) || data.size() < 2 || data[1] != '\n') {
+        return false;
+    }
+    if (outputPath != nullptr && outputPath[0] != '\0') {
+        if (data[0] == ENTRY_WITHOUT_IMAGE) {
+            return false;
+        }
+        if (data[0] == ENTRY_WITH_IMAGE) {
+            string image;
+            string imagePath = entryPath(key, extensionOf(outputPath));
+            if (!readFile(imagePath, image)) {
+                return false;
+            }
+            FILE *file = fopen(outputPath, "wb");
+            if (file == nullptr) {
+                return false;
+            }
+            bool ok = fwrite(image.data(), 1, image.size(), file) == image.size();
+            ok = fclose(file) == 0 && ok;
+            if (!ok) {
+                return false;
+            }
+            utime(imagePath.c_str(), nullptr);
+        }
+    }
+    utime(jsonPath.c_str(), nullptr);
+    json.assign(data, 2, string::npos);
+    return true;
+}
+
+void ResultCache::store(const string &key, const char *outputPath, bool graded, const string &json) {
+    char state = graded ? ENTRY_WITHOUT_IMAGE : ENTRY_NOT_GRADED;
+    long long added = 0;
+    if (graded && outputPath != nullptr && outputPath[0] != '\0') {
+        string image;
+        string imagePath = entryPath(key, extensionOf(outputPath));
+        if (readFile(outputPath, image) && writeFile(imagePath, image.data(), image.size())) {
+            state = ENTRY_WITH_IMAGE;
+            added += static_cast<long long>(image.size());
+        }
+    }
+    string data = string(1, state) + "\n" + json;
+    if (!writeFile(entryPath(key, ".json"), data.data(), data.size())) {
+        return;
+    }
+    added += static_cast<long long>(data.size());
+
+    lock_guard<mutex> lock(mutex_);
+    totalBytes_ += added;
+    if (maxBytes_ > 0 && totalBytes_ > maxBytes_) {
+        evict();
+    }
+}
+
+bool ResultCache::writeFile(const string &path, const char *data, size_t length) {
+    // Unique per thread and process, renamed over the final name when complete
+    char suffix[48];
+    snprintf(suffix, sizeof(suffix), ".tmp%ld.%p", static_cast<long>(getpid()), static_cast<void *>(&suffix));
+    string temp = path + suffix;
+    FILE *file = fopen(temp.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    bool ok = fwrite(data, 1, length, file) == length;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(temp.c_str(), path.c_str()) != 0) {
+        remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Called with mutex_ held. Rescans the directory so entries added by other
+// processes sharing it are accounted for too.
+void ResultCache::evict() {
+    struct Entry {
+        string path;
+        long long size;
+        time_t used;
+    };
+    vector<Entry> entries;
+    long long total = 0;
+    DIR *handle = opendir(dir_.c_str());
+    if (handle == nullptr) {
+        return;
+    }
+    while (struct dirent *entry = readdir(handle)) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        Entry item;
+        item.path = dir_ + "/" + entry->d_name;
+        struct stat info;
+        if (stat(item.path.c_str(), &info) != 0) {
+            continue;
+        }
+        item.size = static_cast<long long>(info.st_size);
+        item.used = info.st_mtime;
+        total += item.size;
+        entries.push_back(item);
+    }
+    closedir(handle);
+
+    sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.used < b.used; });
+    long long target = maxBytes_ / 100 * RESULT_CACHE_EVICT_TARGET;
+    for (const auto &entry: entries) {
+        if (total <= target) {
+            break;
+        }
+        if (remove(entry.path.c_str()) == 0) {
+            total -= entry.size;
+        }
+    }
+    totalBytes_ = total;
+}
@@ -0,0 +1,65 @@
+#ifndef NATIVE_OPENCV_RESULT_CACHE_H
+#define NATIVE_OPENCV_RESULT_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "engine_options.h"
+
+// Bump whenever the sheet layout or cell geometry changes in a way that
+// alters results without an ENGINE_VERSION bump
+#define RESULT_CACHE_LAYOUT_VERSION 2
+// Eviction trims the cache to this percentage of its byte budget
+#define RESULT_CACHE_EVICT_TARGET 90
+
+// 64-bit xxHash (XXH64) of a byte range
+uint64_t hashBytes(const void *data, size_t length, uint64_t seed = 0);
+
+// Persistent cache of result JSON keyed by the content of the input image.
+//
+// Each entry is a "<key>.json" file in `dir`, plus "<key><ext>" holding the
+// annotated image when one was written. Keys hash the encoded image bytes
+// together with ENGINE_VERSION, RESULT_CACHE_LAYOUT_VERSION and the engine
+// options, so the same photo re-uploaded under any name hits and an engine
+// upgrade never serves stale answers. Files are written to a temporary name
+// and renamed into place, so several processes may share one directory.
+// Once the total size passes maxBytes the least recently used entries
+// (by file modification time, refreshed on every hit) are removed.
+// All methods are thread-safe.
+class ResultCache {
+public:
+    ResultCache(const std::string &dir, long long maxBytes);
+
+    ResultCache(const ResultCache &) = delete;
+    ResultCache &operator=(const ResultCache &) = delete;
+
+    // False when the directory cannot be created
+    bool valid() const { return valid_; }
+
+    std::string key(const std::vector<unsigned char> &imageBytes, const EngineOptions &options) const;
+
+    // Cached result JSON for `key`. With a non-empty outputPath the cached
+    // annotated image is copied there, and an entry without one (or with a
+    // different image type) is a miss.
+    bool lookup(const std::string &key, const char *outputPath, std::string &json);
+
+    // Record `json`, and the annotated image at outputPath when `graded`
+    void store(const std::string &key, const char *outputPath, bool graded, const std::string &json);
+
+    long long sizeBytes() const;
+
+private:
+    std::string entryPath(const std::string &key, const std::string &suffix) const;
+    bool writeFile(const std::string &path, const char *data, size_t length);
+    void evict();
+
+    std::string dir_;
+    long long maxBytes_;
+    long long totalBytes_;
+    bool valid_;
+    mutable std::mutex mutex_;
+};
+
+#endif // NATIVE_OPENCV_RESULT_CACHE_H
@@ -0,0 +1,68 @@
+#include "result_struct.h"
+
+#include <cstdlib>
+#include <cstring>
+
+// The Dart Struct definitions mirror this layout byte for byte
+static_assert(sizeof(OmrCell) == 16, "OmrCell layout changed");
+static_assert(sizeof(OmrResult) == 8720, "OmrResult layout changed; bump OMR_RESULT_ABI_VERSION");
+
+static void copyText(char *dest, size_t capacity, const std::string &text) {
+    size_t length = text.size() < capacity - 1 ? text.size() : capacity - 1;
+    memcpy(dest, text.data(), length);
+    dest[length] = '\0';
+}
+
+static void copyCell(OmrCell &dest, const CellMark &mark) {
+    dest.filled = mark.filled ? 1 : 0;
+    dest.fill = mark.fill;
+    dest.x = mark.x;
+    dest.y = mark.y;
+}
+
+void fillOmrResult(const GradeResult &result, OmrResult *out) {
+    memset(out, 0, sizeof(OmrResult));
+    out->abiVersion = OMR_RESULT_ABI_VERSION;
+    out->statusCode = result.statusCode;
+    out->reasonCode = result.statusCode == STATUS_REJECTED && result.checked ? result.capture.reason : -1;
+    out->graded = result.graded ? 1 : 0;
+    if (result.statusCode != STATUS_OK) {
+        copyText(out->error, sizeof(out->error), result.error);
+    }
+    if (!result.graded) {
+        return;
+    }
+
+    for (const auto &answer: result.part1Answers) {
+        int question = atoi(answer.questionNumber.c_str()) - 1;
+        int choice = answer.userChoiceResult.empty() ? -1 : answer.userChoiceResult[0] - 'A';
+        if (question >= 0 && question < OMR_PART1_QUESTIONS && choice >= 0 && choice < OMR_PART1_CHOICES) {
+            out->part1[question] |= static_cast<uint8_t>(1 << choice);
+        }
+    }
+    for (const auto &answer: result.part2Answers) {
+        int question = atoi(answer.questionNumber.c_str()) - 1;
+        int sub = answer.subName.empty() ? -1 : answer.subName[0] - 'a';
+        if (question >= 0 && question < OMR_PART2_QUESTIONS && sub >= 0 && sub < OMR_PART2_SUBS) {
+            out->part2[question][sub] |= answer.userChoiceResult ? 1 : 2;
+        }
+    }
+    for (const auto &answer: result.part3Answers) {
+        int question = atoi(answer.questionNumber.c_str()) - 1;
+        if (question >= 0 && question < OMR_PART3_QUESTIONS) {
+            copyText(out->part3[question], OMR_PART3_TEXT, answer.userResult);
+        }
+    }
+
+    for (int q = 0; q < OMR_PART1_QUESTIONS; q++)
+        for (int c = 0; c < OMR_PART1_CHOICES; c++)
+            copyCell(out->part1Cells[q][c], result.part1Cells[q][c]);
+    for (int q = 0; q < OMR_PART2_QUESTIONS; q++)
+        for (int s = 0; s < OMR_PART2_SUBS; s++)
+            for (int c = 0; c < 2; c++)
+                copyCell(out->part2Cells[q][s][c], result.part2Cells[q][s][c]);
+    for (int q = 0; q < OMR_PART3_QUESTIONS; q++)
+        for (int r = 0; r < OMR_PART3_SYMBOLS; r++)
+            for (int d = 0; d < OMR_PART3_DIGITS; d++)
+                copyCell(out->part3Cells[q][r][d], result.part3Cells[q][r][d]);
+}
@@ -0,0 +1,11 @@
+#ifndef NATIVE_OPENCV_RESULT_STRUCT_H
+#define NATIVE_OPENCV_RESULT_STRUCT_H
+
+#include "../omr_result.h"
+#include "grade_result.h"
+
+// Fill the fixed-layout result from a grading result. Every field of `out`
+// is written, so the caller may reuse one struct across calls.
+void fillOmrResult(const GradeResult &result, OmrResult *out);
+
+#endif // NATIVE_OPENCV_RESULT_STRUCT_H
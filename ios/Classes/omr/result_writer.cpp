@@ -0,0 +1,360 @@
+#include "result_writer.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "alloc_tracking.h"
+#include "detection_ladder.h"
+
+ResultWriter::ResultWriter()
+        : buffer_(nullptr), capacity_(0), length_(0), ownsBuffer_(true), depth_(0), afterKey_(false) {
+    first_[0] = true;
+    // Typical full result is well under 1 KB, so this rarely grows
+    reserve(1024);
+}
+
+ResultWriter::ResultWriter(char *buffer, size_t capacity)
+        : buffer_(buffer), capacity_(buffer ? capacity : 0), length_(0), ownsBuffer_(false), depth_(0),
+          afterKey_(false) {
+    first_[0] = true;
+    if (capacity_ > 0) {
+        buffer_[0] = '\0';
+    }
+}
+
+ResultWriter::~ResultWriter() {
+    if (ownsBuffer_) {
+        free(buffer_);
+    }
+}
+
+char *ResultWriter::release() {
+    if (!ownsBuffer_) {
+        return nullptr;
+    }
+    char *out = buffer_;
+    buffer_ = nullptr;
+    capacity_ = 0;
+    return out;
+}
+
+bool ResultWriter::reserve(size_t extra) {
+    if (length_ + extra + 1 <= capacity_) {
+        return true;
+    }
+    if (!ownsBuffer_) {
+        return false;
+    }
+    size_t newCapacity = capacity_ ? capacity_ : 64;
+    while (newCapacity < length_ + extra + 1) {
+        newCapacity *= 2;
+    }
+    char *grown = static_cast<char *>(realloc(buffer_, newCapacity));
+    if (grown == nullptr) {
+        return false;
+    }
+    buffer_ = grown;
+    capacity_ = newCapacity;
+    return true;
+}
+
+void ResultWriter::put(char c) {
+    put(&c, 1);
+}
+
+void ResultWriter::put(const char *s, size_t n) {
+    reserve(n);
+    // Copy whatever still fits, but always account for the full length
+    if (length_ + 1 < capacity_) {
+        size_t room = capacity_ - length_ - 1;
+        memcpy(buffer_ + length_, s, n < room ? n : room);
+        buffer_[length_ + (n < room ? n : room)] = '\0';
+    }
+    length_ += n;
+}
+
+void ResultWriter::separator() {
+    if (afterKey_) {
+        afterKey_ = false;
+        return;
+    }
+    if (!first_[depth_]) {
+        put(',');
+    }
+    first_[depth_] = false;
+}
+
+void ResultWriter::beginObject() {
+    separator();
+    put('{');
+    if (depth_ + 1 < kMaxDepth) {
+        first_[++depth_] = true;
+    }
+}
+
+void ResultWriter::endObject() {
+    put('}');
+    if (depth_ > 0) {
+        depth_--;
+    }
+}
+
+void ResultWriter::beginArray() {
+    separator();
+    put('[');
+    if (depth_ + 1 < kMaxDepth) {
+        first_[++depth_] = true;
+    }
+}
+
+void ResultWriter::endArray() {
+    put(']');
+    if (depth_ > 0) {
+        depth_--;
+    }
+}
+
+void ResultWriter::key(const char *name) {
+    string(name);
+    put(':');
+    afterKey_ = true;
+}
+
+void ResultWriter::string(const char *value) {
+    separator();
+    put('"');
+    const char *run = value;
+    for (const char *p = value; *p != '\0'; p++) {
+        unsigned char c = static_cast<unsigned char>(*p);
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        put(run, p - run);
+        run = p + 1;
+        switch (c) {
+            case '"': put("\\\"", 2); break;
+            case '\\': put("\\\\", 2); break;
+            case '\n': put("\\n", 2); break;
+            case '\r': put("\\r", 2); break;
+            case '\t': put("\\t", 2); break;
+            default: {
+                char escaped[7];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                put(escaped, 6);
+            }
+        }
+    }
+    put(run, strlen(run));
+    put('"');
+}
+
+void ResultWriter::number(long long value) {
+    separator();
+    char digits[24];
+    int n = snprintf(digits, sizeof(digits), "%lld", value);
+    put(digits, n);
+}
+
+void ResultWriter::number(double value) {
+    if (!std::isfinite(value)) {
+        null();
+        return;
+    }
+    separator();
+    char digits[32];
+    int n = snprintf(digits, sizeof(digits), "%.6g", value);
+    put(digits, n);
+}
+
+void ResultWriter::boolean(bool value) {
+    separator();
+    if (value) {
+        put("true", 4);
+    } else {
+        put("false", 5);
+    }
+}
+
+void ResultWriter::null() {
+    separator();
+    put("null", 4);
+}
+
+void ResultWriter::raw(const char *json, size_t length) {
+    separator();
+    put(json, length);
+}
+
+void writeGradeResult(ResultWriter &writer, const GradeResult &result) {
+    writer.beginObject();
+    writer.key("version");
+    writer.string(ENGINE_VERSION);
+
+    writer.key("answers");
+    writer.beginObject();
+    if (result.graded) {
+        writer.key("1");
+        writer.beginObject();
+        for (const auto &answer: result.part1Answers) {
+            writer.key(answer.questionNumber.c_str());
+            writer.string(answer.userChoiceResult.c_str());
+        }
+        writer.endObject();
+
+        // Part 2 answers arrive sorted by question, so each question's
+        // sub-answers are adjacent and can be grouped in a single pass
+        writer.key("2");
+        writer.beginObject();
+        const std::string *openQuestion = nullptr;
+        for (const auto &answer: result.part2Answers) {
+            if (openQuestion == nullptr || *openQuestion != answer.questionNumber) {
+                if (openQuestion != nullptr) {
+                    writer.endObject();
+                }
+                writer.key(answer.questionNumber.c_str());
+                writer.beginObject();
+                openQuestion = &answer.questionNumber;
+            }
+            writer.key(answer.subName.c_str());
+            writer.boolean(answer.userChoiceResult);
+        }
+        if (openQuestion != nullptr) {
+            writer.endObject();
+        }
+        writer.endObject();
+
+        writer.key("3");
+        writer.beginObject();
+        for (const auto &answer: result.part3Answers) {
+            writer.key(answer.questionNumber.c_str());
+            writer.string(answer.userResult.c_str());
+        }
+        writer.endObject();
+    }
+    writer.endObject();
+
+    if (result.headerRead) {
+        writer.key("header");
+        writer.beginObject();
+        writer.key("student_id");
+        writer.string(result.studentId.c_str());
+        writer.key("exam_code");
+        writer.string(result.examCode.c_str());
+        writer.endObject();
+    }
+
+    if (result.memory.budgetBytes > 0) {
+        writer.key("memory");
+        writer.beginObject();
+        writer.key("budget_bytes");
+        writer.number(result.memory.budgetBytes);
+        writer.key("modelled_peak_bytes");
+        writer.number(result.memory.modelledPeakBytes);
+        writer.key("scale");
+        writer.number(result.memory.scale);
+        writer.key("over_budget");
+        writer.boolean(result.memory.overBudget);
+        writer.endObject();
+    }
+    if (result.allocations.tracked) {
+        const AllocReport &report = result.allocations;
+        writer.key("allocations");
+        writer.beginObject();
+        for (int stage = 0; stage < ALLOC_STAGE_COUNT; stage++) {
+            writer.key(allocStageName(stage));
+            writer.beginObject();
+            writer.key("bytes");
+            writer.number(report.stages[stage].bytes);
+            writer.key("count");
+            writer.number(report.stages[stage].count);
+            writer.key("peak_bytes");
+            writer.number(report.stages[stage].peakBytes);
+            writer.endObject();
+        }
+        writer.key("peak_bytes");
+        writer.number(report.peakBytes);
+        writer.endObject();
+    }
+    if (result.detection.attempts > 1) {
+        const DetectionReport &detection = result.detection;
+        writer.key("detection");
+        writer.beginObject();
+        writer.key("variant");
+        if (detection.variant >= 0) {
+            writer.string(detectionVariant(detection.variant).name);
+        } else {
+            writer.null();
+        }
+        writer.key("attempts");
+        writer.number(static_cast<long long>(detection.attempts));
+        writer.key("retry_ms");
+        writer.number(detection.retryMs);
+        writer.key("budget_exhausted");
+        writer.boolean(detection.budgetExhausted);
+        writer.endObject();
+    }
+
+    writer.key("status_code");
+    writer.number(static_cast<long long>(result.statusCode));
+    if (result.statusCode != STATUS_OK) {
+        writer.key("error");
+        writer.string(result.error.c_str());
+    }
+    if (result.statusCode == STATUS_REJECTED && result.checked) {
+        writer.key("reason_code");
+        writer.number(static_cast<long long>(result.capture.reason));
+        writer.key("capture");
+        writeCaptureCheck(writer, result.capture);
+    }
+    writer.endObject();
+}
+
+void writeSheetResults(ResultWriter &writer, const std::vector<SheetResult> &sheets, int statusCode,
+                       const std::string &error) {
+    writer.beginObject();
+    writer.key("version");
+    writer.string(ENGINE_VERSION);
+    writer.key("sheets");
+    writer.beginArray();
+    for (const auto &sheet: sheets) {
+        writer.beginObject();
+        writer.key("region");
+        writer.beginObject();
+        writer.key("x");
+        writer.number(static_cast<long long>(sheet.x));
+        writer.key("y");
+        writer.number(static_cast<long long>(sheet.y));
+        writer.key("width");
+        writer.number(static_cast<long long>(sheet.width));
+        writer.key("height");
+        writer.number(static_cast<long long>(sheet.height));
+        writer.endObject();
+        writer.key("result");
+        writeGradeResult(writer, sheet.result);
+        writer.endObject();
+    }
+    writer.endArray();
+    writer.key("status_code");
+    writer.number(static_cast<long long>(statusCode));
+    if (statusCode != STATUS_OK) {
+        writer.key("error");
+        writer.string(error.c_str());
+    }
+    writer.endObject();
+}
+
+void writeCaptureCheck(ResultWriter &writer, const CaptureCheck &check) {
+    writer.beginObject();
+    writer.key("focus");
+    writer.number(check.focus);
+    writer.key("brightness");
+    writer.number(check.brightness);
+    writer.key("clipped");
+    writer.number(check.clipped);
+    writer.key("sheet_coverage");
+    writer.number(check.sheetCoverage);
+    writer.key("block_count");
+    writer.number(static_cast<long long>(check.blockCount));
+    writer.endObject();
+}
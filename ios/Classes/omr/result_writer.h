@@ -0,0 +1,79 @@
+#ifndef NATIVE_OPENCV_RESULT_WRITER_H
+#define NATIVE_OPENCV_RESULT_WRITER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "grade_result.h"
+
+// Buffer size for process_image_into that holds any single-sheet result:
+// every bubble of all 40/8/6 questions marked plus the header, memory,
+// allocations, detection and capture objects stays under 4 KB
+#define RESULT_JSON_CAPACITY 8192
+
+// Compact JSON writer that appends straight into its output buffer.
+//
+// With a caller-owned buffer the output is truncated to fit (always NUL
+// terminated when capacity > 0) and length() still reports the full size,
+// like snprintf. Without one the writer grows a malloc'd buffer that is
+// handed out by release() and must be freed with free_result().
+class ResultWriter {
+public:
+    ResultWriter();
+    ResultWriter(char *buffer, size_t capacity);
+    ~ResultWriter();
+
+    ResultWriter(const ResultWriter &) = delete;
+    ResultWriter &operator=(const ResultWriter &) = delete;
+
+    void beginObject();
+    void endObject();
+    void beginArray();
+    void endArray();
+    void key(const char *name);
+    void string(const char *value);
+    void number(long long value);
+    void number(double value);
+    void boolean(bool value);
+    void null();
+    // Append an already serialized JSON value as-is
+    void raw(const char *json, size_t length);
+
+    // Bytes needed for the whole document, excluding the terminating NUL
+    size_t length() const { return length_; }
+    bool truncated() const { return length_ + 1 > capacity_; }
+
+    // Take ownership of the engine-owned buffer (nullptr for caller buffers)
+    char *release();
+
+private:
+    static const int kMaxDepth = 16;
+
+    void separator();
+    void put(char c);
+    void put(const char *s, size_t n);
+    bool reserve(size_t extra);
+
+    char *buffer_;
+    size_t capacity_;
+    size_t length_;
+    bool ownsBuffer_;
+    int depth_;
+    bool first_[kMaxDepth];
+    bool afterKey_;
+};
+
+// Serialize a grading result in the shape process_image has always returned:
+// {"version":...,"answers":{"1":{...},"2":{...},"3":{...}}[,"header":{"student_id":...,"exam_code":...}],
+//  [,"memory":{...}][,"allocations":{...}][,"detection":{...}],"status_code":...,"error":...}
+void writeGradeResult(ResultWriter &writer, const GradeResult &result);
+
+// Serialize a multi-sheet result:
+// {"version":...,"sheets":[{"region":{...},"result":{...}},...],"status_code":...,"error":...}
+void writeSheetResults(ResultWriter &writer, const std::vector<SheetResult> &sheets, int statusCode,
+                       const std::string &error);
+
+// Serialize pre-check measurements as a JSON object
+void writeCaptureCheck(ResultWriter &writer, const CaptureCheck &check);
+
+#endif // NATIVE_OPENCV_RESULT_WRITER_H
@@ -0,0 +1,235 @@
+#include "ring_log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+static_assert((LOG_RING_RECORDS & (LOG_RING_RECORDS - 1)) == 0, "LOG_RING_RECORDS must be a power of two");
+
+struct LogRecord {
+    long long timeMicros;
+    const char *format;
+    int level;
+    int thread;
+    int count;
+    // String arguments hold an offset into text instead of a pointer
+    LogArg args[LOG_MAX_ARGS];
+    char text[LOG_TEXT_BYTES];
+};
+
+// Single producer (the owning thread), single consumer (drainLog, under
+// registryMutex). head is only written by the producer and tail only by
+// the consumer, so neither side ever waits for the other.
+struct LogRing {
+    LogRecord records[LOG_RING_RECORDS];
+    atomic<unsigned> head;
+    atomic<unsigned> tail;
+    atomic<long long> dropped;
+    // Set when the owning thread exits; the next drain frees the ring
+    atomic<bool> orphaned;
+    int thread;
+};
+
+// Never destroyed, so threads still logging during process exit stay safe
+static mutex &registryMutex = *new mutex();
+static vector<LogRing *> &rings = *new vector<LogRing *>();
+static int nextThread = 1;
+
+struct RingOwner {
+    LogRing *ring = nullptr;
+
+    ~RingOwner() {
+        if (ring != nullptr) {
+            ring->orphaned.store(true, memory_order_release);
+        }
+    }
+};
+
+static thread_local RingOwner owner;
+
+static LogRing *threadRing() {
+    if (owner.ring == nullptr) {
+        LogRing *ring = new LogRing();
+        ring->head.store(0);
+        ring->tail.store(0);
+        ring->dropped.store(0);
+        ring->orphaned.store(false);
+        lock_guard<mutex> lock(registryMutex);
+        ring->thread = nextThread++;
+        rings.push_back(ring);
+        owner.ring = ring;
+    }
+    return owner.ring;
+}
+
+void writeLogRecord(int level, const char *format, const LogArg *args, int count) {
+    LogRing *ring = threadRing();
+    unsigned head = ring->head.load(memory_order_relaxed);
+    if (head - ring->tail.load(memory_order_acquire) >= LOG_RING_RECORDS) {
+        ring->dropped.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+    LogRecord &record = ring->records[head & (LOG_RING_RECORDS - 1)];
+    record.timeMicros = chrono::duration_cast<chrono::microseconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+    record.format = format;
+    record.level = level;
+    record.thread = ring->thread;
+    record.count = count;
+    size_t used = 0;
+    for (int i = 0; i < count; i++) {
+        record.args[i] = args[i];
+        if (args[i].type == LOG_ARG_STRING) {
+            const char *value = args[i].s != nullptr ? args[i].s : "(null)";
+            size_t length = min(strlen(value), LOG_TEXT_BYTES - 1 - used);
+            memcpy(record.text + used, value, length);
+            record.text[used + length] = '\0';
+            record.args[i].i = static_cast<long long>(used);
+            used += length + (used + length < LOG_TEXT_BYTES - 1 ? 1 : 0);
+        }
+    }
+    ring->head.store(head + 1, memory_order_release);
+}
+
+static bool isOneOf(char c, const char *set) {
+    return c != '\0' && strchr(set, c) != nullptr;
+}
+
+// printf one converted argument. The format's flags, width and precision
+// are kept and its length modifier replaced by the one the stored type needs.
+static void appendArgument(string &out, const string &spec, char conversion, const LogArg &arg, const char *text) {
+    char buffer[128];
+    string format = spec;
+    int n = 0;
+    switch (arg.type) {
+        case LOG_ARG_INT:
+        case LOG_ARG_UINT:
+            if (isOneOf(conversion, "fFeEgGaA")) {
+                double value = arg.type == LOG_ARG_INT ? static_cast<double>(arg.i) : static_cast<double>(arg.u);
+                n = snprintf(buffer, sizeof(buffer), (format + conversion).c_str(), value);
+            } else if (conversion == 'c') {
+                n = snprintf(buffer, sizeof(buffer), (format + 'c').c_str(), static_cast<int>(arg.i));
+            } else {
+                char integer = isOneOf(conversion, "diuxXo") ? conversion : 'd';
+                if (arg.type == LOG_ARG_INT) {
+                    n = snprintf(buffer, sizeof(buffer), (format + "ll" + integer).c_str(), arg.i);
+                } else {
+                    char unsignedInteger = integer == 'd' || integer == 'i' ? 'u' : integer;
+                    n = snprintf(buffer, sizeof(buffer), (format + "ll" + unsignedInteger).c_str(), arg.u);
+                }
+            }
+            break;
+        case LOG_ARG_DOUBLE:
+            if (isOneOf(conversion, "diuxXoc")) {
+                n = snprintf(buffer, sizeof(buffer), (format + "lld").c_str(), static_cast<long long>(arg.d));
+            } else {
+                char floating = isOneOf(conversion, "fFeEgGaA") ? conversion : 'g';
+                n = snprintf(buffer, sizeof(buffer), (format + floating).c_str(), arg.d);
+            }
+            break;
+        case LOG_ARG_STRING:
+            n = snprintf(buffer, sizeof(buffer), (format + 's').c_str(), text + arg.i);
+            break;
+        case LOG_ARG_POINTER:
+            n = snprintf(buffer, sizeof(buffer), "%p", arg.p);
+            break;
+    }
+    if (n > 0) {
+        out.append(buffer, min(static_cast<size_t>(n), sizeof(buffer) - 1));
+    }
+}
+
+static void appendMessage(string &out, const LogRecord &record) {
+    int next = 0;
+    for (const char *p = record.format; *p != '\0'; p++) {
+        if (*p != '%') {
+            out += *p;
+            continue;
+        }
+        if (p[1] == '%') {
+            out += '%';
+            p++;
+            continue;
+        }
+        string spec = "%";
+        const char *q = p + 1;
+        while (isOneOf(*q, "-+ #0123456789.") && spec.size() < 16) {
+            spec += *q++;
+        }
+        while (isOneOf(*q, "hlLjzt")) {
+            q++;
+        }
+        if (*q == '\0') {
+            break;
+        }
+        p = q;
+        if (next < record.count) {
+            appendArgument(out, spec, *q, record.args[next++], record.text);
+        } else {
+            out += "<missing>";
+        }
+    }
+}
+
+static void appendLine(string &out, long long timeMicros, int level, int thread, const LogRecord *record,
+                       long long dropped) {
+    static const char kLevels[] = "TDIWE";
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "%lld.%06lld %c t%d ", timeMicros / 1000000, timeMicros % 1000000,
+             level >= 0 && level <= OMR_LOG_LEVEL_ERROR ? kLevels[level] : '?', thread);
+    out += prefix;
+    if (record != nullptr) {
+        appendMessage(out, *record);
+    } else {
+        out += "dropped " + to_string(dropped) + " log records (ring full)";
+    }
+    out += '\n';
+}
+
+string drainLog() {
+    vector<LogRecord> records;
+    vector<pair<int, long long>> dropped;
+    {
+        lock_guard<mutex> lock(registryMutex);
+        for (auto it = rings.begin(); it != rings.end();) {
+            LogRing *ring = *it;
+            // Read first: whatever an exited thread logged is published by then
+            bool orphaned = ring->orphaned.load(memory_order_acquire);
+            unsigned tail = ring->tail.load(memory_order_relaxed);
+            unsigned head = ring->head.load(memory_order_acquire);
+            for (; tail != head; tail++) {
+                records.push_back(ring->records[tail & (LOG_RING_RECORDS - 1)]);
+            }
+            ring->tail.store(tail, memory_order_release);
+            long long lost = ring->dropped.exchange(0, memory_order_relaxed);
+            if (lost > 0) {
+                dropped.push_back(make_pair(ring->thread, lost));
+            }
+            if (orphaned) {
+                delete ring;
+                it = rings.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    stable_sort(records.begin(), records.end(),
+                [](const LogRecord &a, const LogRecord &b) { return a.timeMicros < b.timeMicros; });
+    string out;
+    for (const auto &record: records) {
+        appendLine(out, record.timeMicros, record.level, record.thread, &record, 0);
+    }
+    long long now = chrono::duration_cast<chrono::microseconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+    for (const auto &entry: dropped) {
+        appendLine(out, now, OMR_LOG_LEVEL_WARN, entry.first, nullptr, entry.second);
+    }
+    return out;
+}
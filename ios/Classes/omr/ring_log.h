@@ -0,0 +1,148 @@
+#ifndef NATIVE_OPENCV_RING_LOG_H
+#define NATIVE_OPENCV_RING_LOG_H
+
+#include <string>
+#include <type_traits>
+
+#define OMR_LOG_LEVEL_TRACE 0
+#define OMR_LOG_LEVEL_DEBUG 1
+#define OMR_LOG_LEVEL_INFO 2
+#define OMR_LOG_LEVEL_WARN 3
+#define OMR_LOG_LEVEL_ERROR 4
+#define OMR_LOG_LEVEL_OFF 5
+
+// Records below this level compile to nothing, arguments included. Set it
+// per build, e.g. -DOMR_LOG_MIN_LEVEL=0 to keep per-cell traces.
+#ifndef OMR_LOG_MIN_LEVEL
+#define OMR_LOG_MIN_LEVEL OMR_LOG_LEVEL_INFO
+#endif
+
+// Records each thread buffers between drains (power of two). A thread whose
+// ring is full drops new records and counts them instead of waiting.
+#define LOG_RING_RECORDS 256
+#define LOG_MAX_ARGS 6
+// Per record, for copies of string arguments (truncated to fit)
+#define LOG_TEXT_BYTES 64
+
+enum LogArgType {
+    LOG_ARG_INT,
+    LOG_ARG_UINT,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_STRING,
+    LOG_ARG_POINTER
+};
+
+// One captured argument. Formatting happens at drain time, so logging only
+// stores the format pointer (always a string literal) and these values.
+struct LogArg {
+    LogArgType type;
+    union {
+        long long i;
+        unsigned long long u;
+        double d;
+        const char *s;
+        const void *p;
+    };
+};
+
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, LogArg>::type
+logArg(T value) {
+    LogArg arg;
+    arg.type = LOG_ARG_INT;
+    arg.i = value;
+    return arg;
+}
+
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value, LogArg>::type
+logArg(T value) {
+    LogArg arg;
+    arg.type = LOG_ARG_UINT;
+    arg.u = value;
+    return arg;
+}
+
+template<typename T>
+inline typename std::enable_if<std::is_enum<T>::value, LogArg>::type logArg(T value) {
+    return logArg(static_cast<long long>(value));
+}
+
+template<typename T>
+inline typename std::enable_if<std::is_floating_point<T>::value, LogArg>::type logArg(T value) {
+    LogArg arg;
+    arg.type = LOG_ARG_DOUBLE;
+    arg.d = value;
+    return arg;
+}
+
+// Strings are copied into the record when it is written
+inline LogArg logArg(const char *value) {
+    LogArg arg;
+    arg.type = LOG_ARG_STRING;
+    arg.s = value;
+    return arg;
+}
+
+inline LogArg logArg(char *value) {
+    return logArg(static_cast<const char *>(value));
+}
+
+inline LogArg logArg(const std::string &value) {
+    return logArg(value.c_str());
+}
+
+template<typename T>
+inline LogArg logArg(T *value) {
+    LogArg arg;
+    arg.type = LOG_ARG_POINTER;
+    arg.p = value;
+    return arg;
+}
+
+// Append a record to the calling thread's ring. Lock-free apart from the
+// first record of each thread, which registers its ring.
+void writeLogRecord(int level, const char *format, const LogArg *args, int count);
+
+template<typename... Args>
+inline void writeLog(int level, const char *format, const Args &... args) {
+    static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many log arguments");
+    const LogArg packed[sizeof...(Args) + 1] = {logArg(args)..., LogArg()};
+    writeLogRecord(level, format, packed, static_cast<int>(sizeof...(Args)));
+}
+
+// printf-style logging into the ring buffer. Conversions take their length
+// from the argument (no need for %lld or %zu), so "%d" fits any integer.
+// The format must be a string literal.
+#if OMR_LOG_MIN_LEVEL <= OMR_LOG_LEVEL_TRACE
+#define OMR_LOG_TRACE(...) writeLog(OMR_LOG_LEVEL_TRACE, "" __VA_ARGS__)
+#else
+#define OMR_LOG_TRACE(...) ((void) 0)
+#endif
+#if OMR_LOG_MIN_LEVEL <= OMR_LOG_LEVEL_DEBUG
+#define OMR_LOG_DEBUG(...) writeLog(OMR_LOG_LEVEL_DEBUG, "" __VA_ARGS__)
+#else
+#define OMR_LOG_DEBUG(...) ((void) 0)
+#endif
+#if OMR_LOG_MIN_LEVEL <= OMR_LOG_LEVEL_INFO
+#define OMR_LOG_INFO(...) writeLog(OMR_LOG_LEVEL_INFO, "" __VA_ARGS__)
+#else
+#define OMR_LOG_INFO(...) ((void) 0)
+#endif
+#if OMR_LOG_MIN_LEVEL <= OMR_LOG_LEVEL_WARN
+#define OMR_LOG_WARN(...) writeLog(OMR_LOG_LEVEL_WARN, "" __VA_ARGS__)
+#else
+#define OMR_LOG_WARN(...) ((void) 0)
+#endif
+#if OMR_LOG_MIN_LEVEL <= OMR_LOG_LEVEL_ERROR
+#define OMR_LOG_ERROR(...) writeLog(OMR_LOG_LEVEL_ERROR, "" __VA_ARGS__)
+#else
+#define OMR_LOG_ERROR(...) ((void) 0)
+#endif
+
+// Take every buffered record from all threads, oldest first, formatted one
+// per line as "<unix seconds.micros> <T|D|I|W|E> t<thread> <message>".
+// Threads that dropped records get a W line saying how many.
+std::string drainLog();
+
+#endif // NATIVE_OPENCV_RING_LOG_H
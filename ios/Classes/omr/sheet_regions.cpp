@@ -0,0 +1,88 @@
+#include "sheet_regions.h"
+
+#include "pipeline.h"
+
+using namespace cv;
+using namespace std;
+
+// Sheet rectangle implied by a part 3 frame, padded
+static Rect2d estimateSheet(const Rect &anchor) {
+    double width = anchor.width / SHEET_ANCHOR_WIDTH_RATIO;
+    double height = width * SHEET_ASPECT;
+    double bottom = anchor.y + anchor.height + SHEET_BOTTOM_MARGIN * height;
+    double left = anchor.x + anchor.width / 2.0 - width / 2.0;
+    return Rect2d(left - SHEET_REGION_PADDING * width, bottom - height - SHEET_REGION_PADDING * height,
+                  width * (1 + 2 * SHEET_REGION_PADDING), height * (1 + 2 * SHEET_REGION_PADDING));
+}
+
+vector<Rect> findSheetRegions(const Mat &image) {
+    Rect whole(0, 0, image.cols, image.rows);
+    Mat resized = resizeImage(image, 1280);
+    double scale = static_cast<double>(image.rows) / resized.rows;
+
+    vector<vector<Point>> contours;
+    findContours(preprocessOriginImage(resized), contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
+    double minWidth = SHEET_ANCHOR_MIN_WIDTH * min(resized.cols, resized.rows);
+    vector<Rect2d> estimates;
+    for (const auto &contour: contours) {
+        if (contourArea(contour) < 1000) continue;
+        vector<Point> approx;
+        approxPolyDP(contour, approx, 0.04 * arcLength(contour, true), true);
+        if (approx.size() != 4) continue;
+        Rect box = boundingRect(approx);
+        double aspect = static_cast<double>(box.width) / box.height;
+        if (aspect >= SHEET_ANCHOR_MIN_ASPECT && aspect <= SHEET_ANCHOR_MAX_ASPECT && box.width >= minWidth) {
+            estimates.push_back(estimateSheet(box));
+        }
+    }
+    if (estimates.size() <= 1) {
+        return {whole};
+    }
+
+    // Cut overlapping neighbours at the midpoint between their centres, along
+    // the axis on which they are further apart
+    vector<Rect2d> regions = estimates;
+    for (size_t i = 0; i < estimates.size(); i++) {
+        for (size_t j = 0; j < estimates.size(); j++) {
+            if (i == j || (estimates[i] & estimates[j]).area() <= 0) continue;
+            Point2d a = (estimates[i].tl() + estimates[i].br()) * 0.5;
+            Point2d b = (estimates[j].tl() + estimates[j].br()) * 0.5;
+            Rect2d &region = regions[i];
+            if (abs(a.x - b.x) >= abs(a.y - b.y)) {
+                double mid = (a.x + b.x) / 2;
+                double right = region.x + region.width;
+                if (a.x < b.x) right = min(right, mid);
+                else region.x = max(region.x, mid);
+                region.width = right - region.x;
+            } else {
+                double mid = (a.y + b.y) / 2;
+                double bottom = region.y + region.height;
+                if (a.y < b.y) bottom = min(bottom, mid);
+                else region.y = max(region.y, mid);
+                region.height = bottom - region.y;
+            }
+        }
+    }
+
+    vector<Rect> result;
+    for (const auto &region: regions) {
+        Rect scaled(static_cast<int>(region.x * scale), static_cast<int>(region.y * scale),
+                    static_cast<int>(region.width * scale), static_cast<int>(region.height * scale));
+        scaled &= whole;
+        if (scaled.area() > 0) {
+            result.push_back(scaled);
+        }
+    }
+    // Reading order: rows of sheets top to bottom, then left to right
+    auto centerY = [](const Rect &r) { return r.y + r.height / 2; };
+    sort(result.begin(), result.end(), [&](const Rect &a, const Rect &b) { return centerY(a) < centerY(b); });
+    for (size_t rowStart = 0; rowStart < result.size();) {
+        size_t rowEnd = rowStart + 1;
+        while (rowEnd < result.size() && centerY(result[rowEnd]) < result[rowStart].y + result[rowStart].height) {
+            rowEnd++;
+        }
+        sort(result.begin() + rowStart, result.begin() + rowEnd, [](const Rect &a, const Rect &b) { return a.x < b.x; });
+        rowStart = rowEnd;
+    }
+    return result;
+}
@@ -0,0 +1,27 @@
+#ifndef NATIVE_OPENCV_SHEET_REGIONS_H
+#define NATIVE_OPENCV_SHEET_REGIONS_H
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+// Part 3's outer frame is the one wide block on every sheet; it anchors the
+// sheet estimate. Aspect bounds (width / height) and minimum width as a
+// fraction of the shorter image side at working resolution.
+#define SHEET_ANCHOR_MIN_ASPECT 1.6
+#define SHEET_ANCHOR_MAX_ASPECT 3.2
+#define SHEET_ANCHOR_MIN_WIDTH 0.25
+// Sheet geometry relative to the anchor: frame width / sheet width, sheet
+// height / width, and the margin below the frame as a fraction of height
+#define SHEET_ANCHOR_WIDTH_RATIO 0.85
+#define SHEET_ASPECT 1.435
+#define SHEET_BOTTOM_MARGIN 0.06
+// Slack added around each estimate, as a fraction of the sheet size
+#define SHEET_REGION_PADDING 0.04
+
+// Split an image holding several answer sheets (side by side or stacked)
+// into one region per sheet, in reading order and in input pixels. Regions
+// never overlap; neighbours are cut at the midpoint between their
+// estimates. With no recognisable sheet the whole image is returned.
+std::vector<cv::Rect> findSheetRegions(const cv::Mat &image);
+
+#endif // NATIVE_OPENCV_SHEET_REGIONS_H
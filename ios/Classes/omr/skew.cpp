@@ -0,0 +1,102 @@
+#include "skew.h"
+
+using namespace cv;
+using namespace std;
+
+vector<Vec4i> detectLineSegments(const Mat &image) {
+    // 1. Chuyển đổi sang ảnh xám
+    Mat gray;
+    if (image.channels() == 1) {
+        gray = image;
+    } else {
+        cvtColor(image, gray, COLOR_BGR2GRAY);
+    }
+
+    // 2. Làm mờ ảnh (in place when gray is our own copy)
+    Mat blurred;
+    if (gray.data != image.data) {
+        blurred = gray;
+    }
+    GaussianBlur(gray, blurred, Size(5, 5), 0);
+    gray.release();
+
+    // 3. Phát hiện biên cạnh
+    Mat edges;
+    Canny(blurred, edges, 50, 150, 3);
+    blurred.release();
+
+    // 4. Tìm các đường thẳng
+    vector<Vec4i> lines;
+    HoughLinesP(edges, lines, 1, CV_PI / 180, 50, 50, 10);
+    return lines;
+}
+
+double verticalSkewAngle(const vector<Vec4i> &lines, double minLength) {
+    double angle = 0.0;
+    int numLines = 0;
+
+    for (const auto &line: lines) {
+        int x1 = line[0];
+        int y1 = line[1];
+        int x2 = line[2];
+        int y2 = line[3];
+
+        // Tính toán độ dài đường thẳng
+        double length = sqrt(pow(x2 - x1, 2) + pow(y2 - y1, 2));
+
+        // Lọc theo độ dài và hướng của đường thẳng (chọn đường thẳng đứng)
+        if (length >= minLength && abs(y2 - y1) > abs(x2 - x1)) {
+            double currentAngle = atan2(y2 - y1, x2 - x1) * 180.0 / CV_PI;
+
+            // Điều chỉnh góc
+            if (currentAngle > 0) {
+                currentAngle -= 90.0;
+            } else {
+                currentAngle += 90.0;
+            }
+
+            angle += currentAngle;
+            numLines++;
+        }
+    }
+    if (numLines > 0) {
+        angle /= numLines;
+    }
+
+    // Nếu góc xoay quá nhỏ, có thể coi là 0
+    if (abs(angle) < SKEW_MIN_ANGLE) {
+        angle = 0.0;
+    }
+    return angle;
+}
+
+double horizontalSkewAngle(const vector<Vec4i> &lines, double minLength) {
+    double angle = 0.0;
+    int numLines = 0;
+
+    for (const auto &line: lines) {
+        int x1 = line[0];
+        int y1 = line[1];
+        int x2 = line[2];
+        int y2 = line[3];
+
+        // Tính toán độ dài đường thẳng
+        double length = sqrt(pow(x2 - x1, 2) + pow(y2 - y1, 2));
+
+        // Lọc theo độ dài và hướng của đường thẳng (chọn đường nằm ngang)
+        if (length >= minLength && abs(y2 - y1) < abs(x2 - x1)) {
+            double currentAngle = atan2(y2 - y1, x2 - x1) * 180.0 / CV_PI;
+            angle += currentAngle;
+            numLines++;
+        }
+    }
+    if (numLines > 0) {
+        angle /= numLines;
+    }
+
+    // Nếu góc xoay quá nhỏ, có thể coi là 0
+    if (abs(angle) < SKEW_MIN_ANGLE) {
+        angle = 0.0;
+    }
+    return angle;
+}
@@ -0,0 +1,21 @@
+#ifndef NATIVE_OPENCV_SKEW_H
+#define NATIVE_OPENCV_SKEW_H
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+// Angles below this many degrees are treated as already straight
+#define SKEW_MIN_ANGLE 0.2
+
+// Gray -> blur -> Canny -> probabilistic Hough line segments.
+// Accepts BGR or single-channel input.
+std::vector<cv::Vec4i> detectLineSegments(const cv::Mat &image);
+
+// Mean deviation from vertical (degrees) of the near-vertical segments at
+// least minLength long; 0 when none qualify or the angle is negligible.
+double verticalSkewAngle(const std::vector<cv::Vec4i> &lines, double minLength);
+
+// Mean angle (degrees) of the near-horizontal segments at least minLength long
+double horizontalSkewAngle(const std::vector<cv::Vec4i> &lines, double minLength);
+
+#endif // NATIVE_OPENCV_SKEW_H
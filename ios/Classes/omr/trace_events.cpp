@@ -0,0 +1,300 @@
+#include "trace_events.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+#include "result_writer.h"
+
+using namespace std;
+
+atomic<bool> traceRecording(false);
+// Bumped when a recording ends, so spans still open then are not kept for
+// the next one
+static atomic<unsigned> traceGeneration(0);
+
+struct TraceEvent {
+    const char *name;
+    int tid;
+    long long start;
+    long long duration;
+    long long id;
+    string detail;
+    const char *argKey;
+    long long argValue;
+};
+
+// Spans of one thread. Only its own thread appends, so the lock is only
+// ever contended by a trace file write.
+struct ThreadTrace {
+    mutex guard;
+    vector<TraceEvent> events;
+    long long dropped = 0;
+    int tid = 0;
+    string name;
+    atomic<bool> exited;
+};
+
+// Never destroyed, so threads still tracing during process exit stay safe
+static mutex &registryMutex = *new mutex();
+static vector<ThreadTrace *> &threadTraces = *new vector<ThreadTrace *>();
+static int activeCalls = 0;
+static int nextTid = 1;
+static const chrono::steady_clock::time_point traceEpoch = chrono::steady_clock::now();
+
+struct ThreadState {
+    ThreadTrace *trace = nullptr;
+    string name;
+    int depth = 0;
+    // Traced calls that ended inside a span, written once it ends
+    vector<string> pendingPaths;
+
+    ~ThreadState() {
+        if (trace != nullptr) {
+            trace->exited.store(true, memory_order_release);
+        }
+    }
+};
+
+static thread_local ThreadState state;
+
+static long long nowMicros() {
+    return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - traceEpoch).count();
+}
+
+static ThreadTrace *threadTrace() {
+    if (state.trace == nullptr) {
+        ThreadTrace *trace = new ThreadTrace();
+        trace->exited.store(false);
+        trace->name = state.name;
+        lock_guard<mutex> lock(registryMutex);
+        trace->tid = nextTid++;
+        threadTraces.push_back(trace);
+        state.trace = trace;
+    }
+    return state.trace;
+}
+
+void traceNameThread(const string &name) {
+    state.name = name;
+    if (state.trace != nullptr) {
+        lock_guard<mutex> lock(state.trace->guard);
+        state.trace->name = name;
+    }
+}
+
+// Called with registryMutex held
+static void writeTraceFile(const string &path) {
+    vector<TraceEvent> events;
+    ResultWriter writer;
+    writer.beginObject();
+    writer.key("traceEvents");
+    writer.beginArray();
+    writer.beginObject();
+    writer.key("name");
+    writer.string("process_name");
+    writer.key("ph");
+    writer.string("M");
+    writer.key("pid");
+    writer.number(1LL);
+    writer.key("args");
+    writer.beginObject();
+    writer.key("name");
+    writer.string("native_opencv");
+    writer.endObject();
+    writer.endObject();
+
+    long long dropped = 0;
+    for (ThreadTrace *trace: threadTraces) {
+        lock_guard<mutex> lock(trace->guard);
+        events.insert(events.end(), trace->events.begin(), trace->events.end());
+        dropped += trace->dropped;
+        writer.beginObject();
+        writer.key("name");
+        writer.string("thread_name");
+        writer.key("ph");
+        writer.string("M");
+        writer.key("pid");
+        writer.number(1LL);
+        writer.key("tid");
+        writer.number(static_cast<long long>(trace->tid));
+        writer.key("args");
+        writer.beginObject();
+        writer.key("name");
+        writer.string(trace->name.empty() ? ("thread " + to_string(trace->tid)).c_str() : trace->name.c_str());
+        writer.endObject();
+        writer.endObject();
+    }
+    // Sorted so viewers that stream the file see a monotonic timeline
+    stable_sort(events.begin(), events.end(),
+                [](const TraceEvent &a, const TraceEvent &b) { return a.start < b.start; });
+    for (const auto &event: events) {
+        writer.beginObject();
+        writer.key("name");
+        writer.string(event.name);
+        writer.key("cat");
+        writer.string("omr");
+        writer.key("ph");
+        writer.string("X");
+        writer.key("ts");
+        writer.number(event.start);
+        writer.key("dur");
+        writer.number(event.duration);
+        writer.key("pid");
+        writer.number(1LL);
+        writer.key("tid");
+        writer.number(static_cast<long long>(event.tid));
+        if (event.id >= 0 || !event.detail.empty() || event.argKey != nullptr) {
+            writer.key("args");
+            writer.beginObject();
+            if (event.id >= 0) {
+                writer.key("id");
+                writer.number(event.id);
+            }
+            if (!event.detail.empty()) {
+                writer.key("detail");
+                writer.string(event.detail.c_str());
+            }
+            if (event.argKey != nullptr) {
+                writer.key(event.argKey);
+                writer.number(event.argValue);
+            }
+            writer.endObject();
+        }
+        writer.endObject();
+    }
+    writer.endArray();
+    writer.key("displayTimeUnit");
+    writer.string("ms");
+    writer.key("otherData");
+    writer.beginObject();
+    writer.key("dropped_events");
+    writer.number(dropped);
+    writer.endObject();
+    writer.endObject();
+
+    char *json = writer.release();
+    string temp = path + ".tmp";
+    FILE *file = fopen(temp.c_str(), "wb");
+    if (file != nullptr) {
+        bool ok = fwrite(json, 1, writer.length(), file) == writer.length();
+        ok = fclose(file) == 0 && ok;
+        if (!ok || rename(temp.c_str(), path.c_str()) != 0) {
+            remove(temp.c_str());
+        }
+    }
+    free(json);
+}
+
+// Called with registryMutex held, once recording is off
+static void discardTraces() {
+    for (auto it = threadTraces.begin(); it != threadTraces.end();) {
+        ThreadTrace *trace = *it;
+        if (trace->exited.load(memory_order_acquire)) {
+            delete trace;
+            it = threadTraces.erase(it);
+            continue;
+        }
+        lock_guard<mutex> traceLock(trace->guard);
+        trace->events.clear();
+        trace->dropped = 0;
+        ++it;
+    }
+}
+
+// Write the files of the traced calls that ended on this thread, and end
+// the recording after the last one
+static void flushPendingCalls() {
+    vector<string> paths;
+    paths.swap(state.pendingPaths);
+    lock_guard<mutex> lock(registryMutex);
+    for (const auto &path: paths) {
+        writeTraceFile(path);
+        activeCalls--;
+    }
+    if (activeCalls == 0) {
+        traceRecording.store(false, memory_order_relaxed);
+        traceGeneration.fetch_add(1, memory_order_relaxed);
+        discardTraces();
+    }
+}
+
+TraceSpan::TraceSpan(const char *name, long long id)
+        : name_(name), id_(id), argKey_(nullptr), argValue_(0), start_(0), generation_(0), active_(false) {
+    begin();
+}
+
+TraceSpan::TraceSpan(const char *name, const string &detail)
+        : name_(name), id_(-1), argKey_(nullptr), argValue_(0), start_(0), generation_(0), active_(false) {
+    begin();
+    if (active_) {
+        detail_ = detail;
+    }
+}
+
+void TraceSpan::begin() {
+    state.depth++;
+    active_ = traceEnabled();
+    if (active_) {
+        generation_ = traceGeneration.load(memory_order_relaxed);
+        start_ = nowMicros();
+    }
+}
+
+void TraceSpan::arg(const char *key, long long value) {
+    argKey_ = key;
+    argValue_ = value;
+}
+
+TraceSpan::~TraceSpan() {
+    if (active_) {
+        TraceEvent event;
+        event.name = name_;
+        event.start = start_;
+        event.duration = nowMicros() - start_;
+        event.id = id_;
+        event.detail = std::move(detail_);
+        event.argKey = argKey_;
+        event.argValue = argValue_;
+        ThreadTrace *trace = threadTrace();
+        event.tid = trace->tid;
+        lock_guard<mutex> lock(trace->guard);
+        // Checked under the lock discardTraces() clears with, so a span
+        // outliving its recording is never kept for the next one
+        if (generation_ == traceGeneration.load(memory_order_relaxed)) {
+            if (trace->events.size() < TRACE_MAX_EVENTS_PER_THREAD) {
+                trace->events.push_back(std::move(event));
+            } else {
+                trace->dropped++;
+            }
+        }
+    }
+    state.depth--;
+    if (state.depth == 0 && !state.pendingPaths.empty()) {
+        flushPendingCalls();
+    }
+}
+
+TraceCall::TraceCall(const string &path) : path_(path) {
+    if (path_.empty()) {
+        return;
+    }
+    lock_guard<mutex> lock(registryMutex);
+    if (activeCalls++ == 0) {
+        traceRecording.store(true, memory_order_relaxed);
+    }
+}
+
+TraceCall::~TraceCall() {
+    if (path_.empty()) {
+        return;
+    }
+    // Nested in a span (a worker-pool task, say): wait for it to end so it
+    // is in the file. Also covers a nested traced call that deferred to this one.
+    state.pendingPaths.push_back(path_);
+    if (state.depth == 0) {
+        flushPendingCalls();
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef NATIVE_OPENCV_TRACE_EVENTS_H
+#define NATIVE_OPENCV_TRACE_EVENTS_H
+
+#include <atomic>
+#include <string>
+
+// Spans kept per thread while a trace records; later ones are counted and
+// dropped
+#define TRACE_MAX_EVENTS_PER_THREAD 100000
+
+// Span recorder for chrome://tracing and ui.perfetto.dev.
+//
+// A grading call whose options carry "trace_path" opens a TraceCall, which
+// turns recording on for the whole process until the call ends. Every
+// TraceSpan beginning meanwhile on any thread (grading stages, worker-pool
+// tasks, pipeline stages) is recorded as a complete ("X") event with its
+// thread, and when the call ends its file is written with those spans in
+// Trace Event Format JSON. Traced calls that overlap share one recording,
+// each writing everything recorded so far to its own path, and spans of
+// untraced calls running alongside are included too. Once the last of
+// them has written its file recording stops and the spans are discarded.
+//
+// While no traced call is running a span costs one relaxed atomic load.
+extern std::atomic<bool> traceRecording;
+
+inline bool traceEnabled() {
+    return traceRecording.load(std::memory_order_relaxed);
+}
+
+// Name shown for the calling thread's track ("worker 2", "register 1", ...)
+void traceNameThread(const std::string &name);
+
+class TraceSpan {
+public:
+    // `name` must be a string literal. `id` (e.g. a sheet or page index) is
+    // shown in the span's args when >= 0, `detail` when not empty.
+    explicit TraceSpan(const char *name, long long id = -1);
+    TraceSpan(const char *name, const std::string &detail);
+    ~TraceSpan();
+
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+    // Extra numeric argument, e.g. time the task spent queued
+    void arg(const char *key, long long value);
+
+private:
+    void begin();
+
+    const char *name_;
+    long long id_;
+    std::string detail_;
+    const char *argKey_;
+    long long argValue_;
+    long long start_;
+    unsigned generation_;
+    bool active_;
+};
+
+// Scope of one traced call. Writes the trace to `path` once the outermost
+// span open on this thread (e.g. the worker-pool task running the call)
+// has ended; spans that began before the call opened are recorded only if
+// another traced call was already running. No-op for an empty path.
+class TraceCall {
+public:
+    explicit TraceCall(const std::string &path);
+    ~TraceCall();
+
+    TraceCall(const TraceCall &) = delete;
+    TraceCall &operator=(const TraceCall &) = delete;
+
+private:
+    std::string path_;
+};
+
+#endif // NATIVE_OPENCV_TRACE_EVENTS_H
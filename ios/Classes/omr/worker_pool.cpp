@@ -0,0 +1,63 @@
+#include "worker_pool.h"
+
+#include <string>
+#include "trace_events.h"
+
+WorkerPool::WorkerPool(int threads) : stopping_(false) {
+    if (threads <= 0) {
+        threads = static_cast<int>(std::thread::hardware_concurrency());
+    }
+    if (threads <= 0) {
+        threads = 1;
+    }
+    threads_.reserve(threads);
+    for (int i = 0; i < threads; i++) {
+        threads_.emplace_back(&WorkerPool::run, this, i);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    available_.notify_all();
+    for (auto &thread: threads_) {
+        thread.join();
+    }
+}
+
+void WorkerPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(Task{std::move(task), std::chrono::steady_clock::now()});
+    }
+    available_.notify_one();
+}
+
+size_t WorkerPool::pending() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.size();
+}
+
+void WorkerPool::run(int index) {
+    traceNameThread("worker " + std::to_string(index + 1));
+    for (;;) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            available_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                return;
+            }
+            task = std::move(queue_.front());
+            queue_.pop_front();
+        }
+        TraceSpan span("task");
+        if (traceEnabled()) {
+            span.arg("queued_us", std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - task.queued).count());
+        }
+        task.run();
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef NATIVE_OPENCV_WORKER_POOL_H
+#define NATIVE_OPENCV_WORKER_POOL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size thread pool fed from a FIFO request queue.
+// Threads live until the pool is destroyed; queued tasks are drained first.
+class WorkerPool {
+public:
+    // threads <= 0 picks one thread per hardware core
+    explicit WorkerPool(int threads);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    void submit(std::function<void()> task);
+
+    // Tasks waiting in the queue (not counting running ones)
+    size_t pending() const;
+    int size() const { return static_cast<int>(threads_.size()); }
+
+private:
+    struct Task {
+        std::function<void()> run;
+        std::chrono::steady_clock::time_point queued;
+    };
+
+    void run(int index);
+
+    std::vector<std::thread> threads_;
+    std::deque<Task> queue_;
+    mutable std::mutex mutex_;
+    std::condition_variable available_;
+    bool stopping_;
+};
+
+#endif // NATIVE_OPENCV_WORKER_POOL_H
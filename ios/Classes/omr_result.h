@@ -0,0 +1,53 @@
+#ifndef NATIVE_OPENCV_OMR_RESULT_H
+#define NATIVE_OPENCV_OMR_RESULT_H
+
+#include <stdint.h>
+
+// Fixed-layout grading result filled by process_image_struct. The struct
+// holds no pointers, so it can be read in place from Dart through
+// dart:ffi Struct definitions (lib/omr_result.dart) without any JSON in
+// between. Bump OMR_RESULT_ABI_VERSION whenever the layout changes.
+
+#define OMR_RESULT_ABI_VERSION 1
+
+#define OMR_PART1_QUESTIONS 40
+#define OMR_PART1_CHOICES 4
+#define OMR_PART2_QUESTIONS 8
+#define OMR_PART2_SUBS 4
+#define OMR_PART3_QUESTIONS 6
+#define OMR_PART3_SYMBOLS 12
+#define OMR_PART3_DIGITS 4
+#define OMR_PART3_TEXT 52
+#define OMR_ERROR_TEXT 128
+
+// One bubble. Coordinates are pixels of the 1280 px high working image.
+typedef struct {
+    uint8_t filled;      // 1 when the bubble is marked
+    uint8_t reserved[3];
+    float fill;          // inked fraction of the bubble's box, 0-1
+    int32_t x;
+    int32_t y;
+} OmrCell;
+
+typedef struct {
+    int32_t abiVersion;  // OMR_RESULT_ABI_VERSION
+    int32_t statusCode;  // same values as "status_code" in the JSON result
+    int32_t reasonCode;  // capture pre-check reason, -1 when not reported
+    int32_t graded;      // 1 when the answer and cell fields below are valid
+
+    // Marked choices as bit masks: part 1 bit n = choice A+n; part 2
+    // bit 0 = yes (true), bit 1 = no (false). 0 means left blank.
+    uint8_t part1[OMR_PART1_QUESTIONS];
+    uint8_t part2[OMR_PART2_QUESTIONS][OMR_PART2_SUBS];
+    // Part 3 answers as NUL-terminated text, identical to the JSON strings
+    char part3[OMR_PART3_QUESTIONS][OMR_PART3_TEXT];
+
+    OmrCell part1Cells[OMR_PART1_QUESTIONS][OMR_PART1_CHOICES];
+    OmrCell part2Cells[OMR_PART2_QUESTIONS][OMR_PART2_SUBS][2];
+    OmrCell part3Cells[OMR_PART3_QUESTIONS][OMR_PART3_SYMBOLS][OMR_PART3_DIGITS];
+
+    // NUL-terminated, empty when statusCode is 0
+    char error[OMR_ERROR_TEXT];
+} OmrResult;
+
+#endif // NATIVE_OPENCV_OMR_RESULT_H
@@ -1,11 +1,17 @@
 import 'dart:async';
+import 'dart:convert';
 import 'dart:ffi' as ffi;
 import 'dart:io';
 import 'dart:isolate';
+import 'dart:typed_data';
 
 import 'package:ffi/ffi.dart';
 import 'package:flutter/services.dart';
 
+import 'omr_result.dart';
+
+export 'omr_result.dart';
+
 class NativeOpencv {
   static const MethodChannel _channel = MethodChannel('native_opencv');
 
@@ -20,16 +26,83 @@ typedef _CVersionFunc = ffi.Pointer<Utf8> Function();
 typedef _CProcessImageFunc = ffi.Pointer<Utf8> Function(
   ffi.Pointer<Utf8>,
   ffi.Pointer<Utf8>,
-  ffi.Pointer<Utf8>?,
+  ffi.Pointer<Utf8>,
+);
+typedef _CProcessImageStructFunc = ffi.Int32 Function(
+  ffi.Pointer<Utf8>,
+  ffi.Pointer<Utf8>,
+  ffi.Pointer<Utf8>,
+  ffi.Pointer<OmrResult>,
 );
+typedef _CProcessSheetsFunc = ffi.Pointer<Utf8> Function(
+  ffi.Pointer<Utf8>,
+  ffi.Pointer<Utf8>,
+  ffi.Pointer<Utf8>,
+);
+typedef _CCheckCaptureFunc = ffi.Pointer<Utf8> Function(ffi.Pointer<Utf8>);
+typedef _CAnalyzeFrameFunc = ffi.Pointer<Utf8> Function(
+  ffi.Pointer<ffi.Uint8>,
+  ffi.Int64,
+  ffi.Int32,
+  ffi.Int32,
+  ffi.Int32,
+  ffi.Int32,
+  ffi.Int32,
+);
+typedef _CFreeResultFunc = ffi.Void Function(ffi.Pointer<Utf8>);
+typedef _CWorkerStartFunc = ffi.Int32 Function(ffi.Pointer<ffi.Void>, ffi.Int32);
+typedef _CWorkerSubmitFunc = ffi.Int64 Function(
+  ffi.Int64,
+  ffi.Pointer<Utf8>,
+  ffi.Pointer<Utf8>,
+  ffi.Pointer<Utf8>,
+);
+typedef _CWorkerPendingFunc = ffi.Int32 Function();
+typedef _CResultCacheOpenFunc = ffi.Int32 Function(ffi.Pointer<Utf8>, ffi.Int64);
+typedef _CResultCacheCloseFunc = ffi.Void Function();
+typedef _CLogDrainFunc = ffi.Pointer<Utf8> Function();
+typedef _CGetStatsFunc = ffi.Pointer<Utf8> Function(ffi.Int32);
+typedef _CCancelTokenCreateFunc = ffi.Int64 Function();
+typedef _CCancelTokenFunc = ffi.Void Function(ffi.Int64);
 
 // Dart function signatures
 typedef _VersionFunc = ffi.Pointer<Utf8> Function();
 typedef _ProcessImageFunc = ffi.Pointer<Utf8> Function(
   ffi.Pointer<Utf8>,
   ffi.Pointer<Utf8>,
-  ffi.Pointer<Utf8>?,
+  ffi.Pointer<Utf8>,
+);
+typedef _ProcessImageStructFunc = int Function(
+  ffi.Pointer<Utf8>,
+  ffi.Pointer<Utf8>,
+  ffi.Pointer<Utf8>,
+  ffi.Pointer<OmrResult>,
 );
+typedef _CheckCaptureFunc = ffi.Pointer<Utf8> Function(ffi.Pointer<Utf8>);
+typedef _AnalyzeFrameFunc = ffi.Pointer<Utf8> Function(
+  ffi.Pointer<ffi.Uint8>,
+  int,
+  int,
+  int,
+  int,
+  int,
+  int,
+);
+typedef _FreeResultFunc = void Function(ffi.Pointer<Utf8>);
+typedef _WorkerStartFunc = int Function(ffi.Pointer<ffi.Void>, int);
+typedef _WorkerSubmitFunc = int Function(
+  int,
+  ffi.Pointer<Utf8>,
+  ffi.Pointer<Utf8>,
+  ffi.Pointer<Utf8>,
+);
+typedef _WorkerPendingFunc = int Function();
+typedef _ResultCacheOpenFunc = int Function(ffi.Pointer<Utf8>, int);
+typedef _ResultCacheCloseFunc = void Function();
+typedef _LogDrainFunc = ffi.Pointer<Utf8> Function();
+typedef _GetStatsFunc = ffi.Pointer<Utf8> Function(int);
+typedef _CancelTokenCreateFunc = int Function();
+typedef _CancelTokenFunc = void Function(int);
 
 // Getting a library that holds needed symbols
 ffi.DynamicLibrary _openDynamicLibrary() {
@@ -50,31 +123,430 @@ final _VersionFunc _version =
 final _ProcessImageFunc _processImage = _lib
     .lookup<ffi.NativeFunction<_CProcessImageFunc>>('process_image')
     .asFunction();
+final _ProcessImageStructFunc _processImageStruct = _lib
+    .lookup<ffi.NativeFunction<_CProcessImageStructFunc>>(
+        'process_image_struct')
+    .asFunction();
+final _ProcessImageFunc _processSheets = _lib
+    .lookup<ffi.NativeFunction<_CProcessSheetsFunc>>('process_sheets')
+    .asFunction();
+final _CheckCaptureFunc _checkCapture = _lib
+    .lookup<ffi.NativeFunction<_CCheckCaptureFunc>>('check_capture')
+    .asFunction();
+final _AnalyzeFrameFunc _analyzeFrame = _lib
+    .lookup<ffi.NativeFunction<_CAnalyzeFrameFunc>>('analyze_frame')
+    .asFunction();
+final _freeResultPtr =
+    _lib.lookup<ffi.NativeFunction<_CFreeResultFunc>>('free_result');
+final _FreeResultFunc _freeResult = _freeResultPtr.asFunction();
+final _WorkerStartFunc _workerStart = _lib
+    .lookup<ffi.NativeFunction<_CWorkerStartFunc>>('worker_start')
+    .asFunction();
+final _WorkerSubmitFunc _workerSubmit = _lib
+    .lookup<ffi.NativeFunction<_CWorkerSubmitFunc>>('worker_submit')
+    .asFunction();
+final _WorkerSubmitFunc _workerSubmitPages = _lib
+    .lookup<ffi.NativeFunction<_CWorkerSubmitFunc>>('worker_submit_pages')
+    .asFunction();
+final _WorkerPendingFunc _workerPending = _lib
+    .lookup<ffi.NativeFunction<_CWorkerPendingFunc>>('worker_pending')
+    .asFunction();
+final _ResultCacheOpenFunc _resultCacheOpen = _lib
+    .lookup<ffi.NativeFunction<_CResultCacheOpenFunc>>('result_cache_open')
+    .asFunction();
+final _ResultCacheCloseFunc _resultCacheClose = _lib
+    .lookup<ffi.NativeFunction<_CResultCacheCloseFunc>>('result_cache_close')
+    .asFunction();
+final _LogDrainFunc _logDrain =
+    _lib.lookup<ffi.NativeFunction<_CLogDrainFunc>>('log_drain').asFunction();
+final _GetStatsFunc _getStats =
+    _lib.lookup<ffi.NativeFunction<_CGetStatsFunc>>('get_stats').asFunction();
+final _CancelTokenCreateFunc _cancelTokenCreate = _lib
+    .lookup<ffi.NativeFunction<_CCancelTokenCreateFunc>>('cancel_token_create')
+    .asFunction();
+final _CancelTokenFunc _cancelTokenCancel = _lib
+    .lookup<ffi.NativeFunction<_CCancelTokenFunc>>('cancel_token_cancel')
+    .asFunction();
+final _CancelTokenFunc _cancelTokenRelease = _lib
+    .lookup<ffi.NativeFunction<_CCancelTokenFunc>>('cancel_token_release')
+    .asFunction();
+
+// Releases native results that were never disposed explicitly
+final ffi.NativeFinalizer _resultFinalizer =
+    ffi.NativeFinalizer(_freeResultPtr.cast());
+
+/// A result string owned by the native engine.
+///
+/// The memory is released by [dispose], or by a finalizer once the handle
+/// becomes unreachable if [dispose] was never called.
+class NativeResult implements ffi.Finalizable {
+  ffi.Pointer<Utf8> _pointer;
+
+  NativeResult._(this._pointer) {
+    _resultFinalizer.attach(this, _pointer.cast(), detach: this);
+  }
+
+  bool get isDisposed => _pointer == ffi.nullptr;
+
+  /// Copies the native string into a Dart string.
+  String toDartString() {
+    if (isDisposed) {
+      throw StateError('NativeResult used after dispose');
+    }
+    return _pointer.toDartString();
+  }
+
+  /// Frees the native string now instead of waiting for the finalizer.
+  void dispose() {
+    if (isDisposed) return;
+    _resultFinalizer.detach(this);
+    _freeResult(_pointer);
+    _pointer = ffi.nullptr;
+  }
+}
 
 String opencvVersion() {
   return _version().toDartString();
 }
 
+/// Runs the native grader and returns the raw result handle.
+///
+/// Arguments are marshalled into an arena that is freed as soon as the
+/// native call returns.
+NativeResult processImageNative(ProcessImageArguments args) {
+  return using((arena) {
+    final jsonArgs = args._nativeJsonArgs;
+    return NativeResult._(_processImage(
+      args.inputPath.toNativeUtf8(allocator: arena),
+      args.outputPath.toNativeUtf8(allocator: arena),
+      jsonArgs == null ? ffi.nullptr : jsonArgs.toNativeUtf8(allocator: arena),
+    ));
+  });
+}
+
+/// Runs the native grader and returns the result JSON.
+String processImageSync(ProcessImageArguments args) {
+  final result = processImageNative(args);
+  try {
+    return result.toDartString();
+  } finally {
+    result.dispose();
+  }
+}
+
+/// Keeps grading results on disk in [directory], keyed by the image content.
+///
+/// Once open, [processImageSync] and [NativeOpencvWorker.processImage]
+/// answer a photo that was graded before with the same options from the
+/// cache, restoring the annotated image too, without running the
+/// pipeline. The least recently used entries are removed once the cache
+/// grows past [maxBytes] (0 for no limit). Returns false if [directory]
+/// cannot be used.
+bool openResultCache(String directory, {int maxBytes = 256 << 20}) {
+  return using((arena) =>
+      _resultCacheOpen(directory.toNativeUtf8(allocator: arena), maxBytes) ==
+      1);
+}
+
+/// Stops using the result cache. Cached files are left on disk.
+void closeResultCache() => _resultCacheClose();
+
+/// Takes the engine's buffered log lines from every native thread, oldest
+/// first, e.g. `1760000000.123456 W t3 register: Found 12 bounding boxes`.
+///
+/// Each thread buffers its records in a ring and formats nothing until
+/// drained; call this periodically. Levels below the plugin's compile-time
+/// `OMR_LOG_MIN_LEVEL` (info by default) are never recorded.
+List<String> drainNativeLog() {
+  final result = NativeResult._(_logDrain());
+  try {
+    final text = result.toDartString();
+    return text.isEmpty ? const [] : text.trimRight().split('\n');
+  } finally {
+    result.dispose();
+  }
+}
+
+/// Process-wide grading statistics since start-up (or the last reset), for
+/// shipping with app analytics.
+///
+/// Holds per-stage latency percentiles (`stages.total.p95_ms`, ...), counts
+/// per `status_code` and capture `reason_code`, failure reasons such as
+/// `failures.block_count` and how many blocks those sheets showed
+/// (`blocks_found`). With [reset] the counters restart from zero, so
+/// periodic calls report deltas.
+Map<String, dynamic> getNativeStats({bool reset = false}) {
+  final result = NativeResult._(_getStats(reset ? 1 : 0));
+  try {
+    return jsonDecode(result.toDartString()) as Map<String, dynamic>;
+  } finally {
+    result.dispose();
+  }
+}
+
+/// Runs the native grader straight into [result], skipping JSON entirely.
+///
+/// [result] is caller-owned and can be reused across scans, e.g.
+/// `final result = calloc<OmrResult>();` once and `calloc.free(result)`
+/// when done. Every field is overwritten. Returns the status code.
+int processImageStruct(
+    ProcessImageArguments args, ffi.Pointer<OmrResult> result) {
+  return using((arena) {
+    final jsonArgs = args._nativeJsonArgs;
+    return _processImageStruct(
+      args.inputPath.toNativeUtf8(allocator: arena),
+      args.outputPath.toNativeUtf8(allocator: arena),
+      jsonArgs == null ? ffi.nullptr : jsonArgs.toNativeUtf8(allocator: arena),
+      result,
+    );
+  });
+}
+
+/// Grades every answer sheet found in one image, e.g. two sheets
+/// photographed side by side or an A3 scan of two A4 sheets.
+///
+/// Returns JSON with a `sheets` array in reading order; each entry has the
+/// sheet's `region` in input pixels and a `result` shaped like
+/// [processImageSync]'s. Annotated images are written next to
+/// `outputPath` as `<name>_1.jpg`, `<name>_2.jpg`, ...
+String processSheetsSync(ProcessImageArguments args) {
+  final result = using((arena) {
+    final jsonArgs = args._nativeJsonArgs;
+    return NativeResult._(_processSheets(
+      args.inputPath.toNativeUtf8(allocator: arena),
+      args.outputPath.toNativeUtf8(allocator: arena),
+      jsonArgs == null ? ffi.nullptr : jsonArgs.toNativeUtf8(allocator: arena),
+    ));
+  });
+  try {
+    return result.toDartString();
+  } finally {
+    result.dispose();
+  }
+}
+
+/// Runs only the fast capture pre-check on [inputPath].
+///
+/// Returns JSON with `status_code` 3 and a `reason_code` when the photo
+/// should be retaken, plus the measured `capture` metrics.
+String checkCapture(String inputPath) {
+  final result = using((arena) =>
+      NativeResult._(_checkCapture(inputPath.toNativeUtf8(allocator: arena))));
+  try {
+    return result.toDartString();
+  } finally {
+    result.dispose();
+  }
+}
+
+/// Pixel layouts accepted by [analyzeFrame].
+enum FrameFormat {
+  /// 8-bit luma, e.g. the Y plane of a YUV420 camera image.
+  gray,
+  bgra,
+  rgba,
+  bgr,
+}
+
+/// Measures capture quality of one camera preview frame.
+///
+/// Returns JSON whose `frame` object holds a `hint` ("too_dark",
+/// "hold_steady", "move_closer", "tilted", "ok", or "measuring" when the
+/// budget ran out before every metric was taken) together with skew,
+/// perspective, focus, brightness and sheet coverage. Analysis stops after
+/// [budgetMs] milliseconds, in which case `complete` is false.
+///
+/// [pixels] must hold [height] rows [bytesPerRow] apart (the last one may
+/// be unpadded); otherwise `status_code` is 1 and nothing is read.
+String analyzeFrame(
+  Uint8List pixels,
+  int width,
+  int height, {
+  required int bytesPerRow,
+  FrameFormat format = FrameFormat.gray,
+  int budgetMs = 15,
+}) {
+  const channels = [1, 4, 4, 3];
+  final rowBytes = width * channels[format.index];
+  final valid = width > 0 &&
+      height > 0 &&
+      bytesPerRow >= rowBytes &&
+      pixels.length >= bytesPerRow * (height - 1) + rowBytes;
+  final result = using((arena) {
+    // An invalid layout is not copied; the native side reports why
+    var buffer = ffi.nullptr.cast<ffi.Uint8>();
+    if (valid) {
+      buffer = arena<ffi.Uint8>(pixels.length);
+      buffer.asTypedList(pixels.length).setAll(0, pixels);
+    }
+    return NativeResult._(_analyzeFrame(buffer, pixels.length, width, height,
+        bytesPerRow, format.index, budgetMs));
+  });
+  try {
+    return result.toDartString();
+  } finally {
+    result.dispose();
+  }
+}
+
 void processImage(SendPort sendPort, ProcessImageArguments args) {
   // Call the native function and get the result
-  final res = _processImage(
-    args.inputPath.toNativeUtf8(),
-    args.outputPath.toNativeUtf8(),
-    args.jsonArgs?.toNativeUtf8(),
-  ).toDartString();
+  final res = processImageSync(args);
 
   // Send the result back to the main isolate
   sendPort.send(res);
 }
 
+/// Grades images on a long-lived native thread pool.
+///
+/// Requests are queued natively and results are posted straight back to
+/// this isolate, so no isolate has to be spawned per scan.
+class NativeOpencvWorker {
+  static NativeOpencvWorker? _instance;
+
+  /// The shared worker, started on first use.
+  static NativeOpencvWorker get instance =>
+      _instance ??= NativeOpencvWorker._(0);
+
+  /// Starts the shared worker with an explicit thread count
+  /// (0 uses one thread per core). Has no effect once started.
+  static NativeOpencvWorker start({int threads = 0}) =>
+      _instance ??= NativeOpencvWorker._(threads);
+
+  final ReceivePort _port = ReceivePort();
+  final Map<int, Completer<String>> _pending = {};
+  final Map<int, StreamController<PageResult>> _streams = {};
+  late final int threads;
+
+  NativeOpencvWorker._(int threads) {
+    this.threads = _workerStart(ffi.NativeApi.postCObject.cast(), threads);
+    _port.listen(_onResult);
+  }
+
+  /// Requests waiting natively for a free thread.
+  int get queueLength => _workerPending();
+
+  /// Queues [args] and completes with the result JSON.
+  Future<String> processImage(ProcessImageArguments args) {
+    final requestId = using((arena) {
+      final jsonArgs = args._nativeJsonArgs;
+      return _workerSubmit(
+        _port.sendPort.nativePort,
+        args.inputPath.toNativeUtf8(allocator: arena),
+        args.outputPath.toNativeUtf8(allocator: arena),
+        jsonArgs == null ? ffi.nullptr : jsonArgs.toNativeUtf8(allocator: arena),
+      );
+    });
+    if (requestId < 0) {
+      return Future.error(StateError('Native worker is not running'));
+    }
+    final completer = Completer<String>();
+    _pending[requestId] = completer;
+    return completer.future;
+  }
+
+  /// Grades every page of the multi-page TIFF at `args.inputPath`.
+  ///
+  /// Pages are read one at a time while earlier ones are being graded, and
+  /// each result is emitted as soon as it is ready, so pages may arrive out
+  /// of order. Annotated pages are written to `args.outputPath` with the
+  /// page index before the extension. The stream closes after the last page;
+  /// it fails if the file cannot be read.
+  Stream<PageResult> processPages(ProcessImageArguments args) {
+    final requestId = using((arena) {
+      final jsonArgs = args._nativeJsonArgs;
+      return _workerSubmitPages(
+        _port.sendPort.nativePort,
+        args.inputPath.toNativeUtf8(allocator: arena),
+        args.outputPath.toNativeUtf8(allocator: arena),
+        jsonArgs == null ? ffi.nullptr : jsonArgs.toNativeUtf8(allocator: arena),
+      );
+    });
+    if (requestId < 0) {
+      return Stream.error(StateError('Native worker is not running'));
+    }
+    final controller = StreamController<PageResult>();
+    _streams[requestId] = controller;
+    return controller.stream;
+  }
+
+  void _onResult(dynamic message) {
+    final reply = message as List;
+    final requestId = reply[0] as int;
+    if (reply.length == 2) {
+      _pending.remove(requestId)?.complete(reply[1] as String);
+      return;
+    }
+
+    final page = reply[1] as int;
+    final json = reply[2] as String;
+    if (page >= 0) {
+      _streams[requestId]?.add(PageResult(page, json));
+      return;
+    }
+    // Page -1 carries the summary of the whole file
+    final controller = _streams.remove(requestId);
+    if (controller == null) return;
+    final summary = jsonDecode(json) as Map<String, dynamic>;
+    if (summary['status_code'] != 0) {
+      controller.addError(StateError(summary['error'] as String? ?? json));
+    }
+    controller.close();
+  }
+}
+
+/// Result of one page of a multi-page file.
+class PageResult {
+  /// Zero-based page index in the file.
+  final int page;
+
+  /// Result JSON, in the same shape as [NativeOpencvWorker.processImage].
+  final String json;
+
+  PageResult(this.page, this.json);
+}
+
+/// Stops native grading calls that are no longer needed.
+///
+/// Pass it in [ProcessImageArguments.cancelToken]; after [cancel] the
+/// calls using it return with `status_code` 4 at their next check (between
+/// stages and between answer blocks) instead of running to completion. One
+/// token may cover many calls, e.g. a whole batch. Only the [id] is kept,
+/// so tokens can be sent to other isolates.
+class NativeCancelToken {
+  final int id;
+
+  NativeCancelToken() : id = _cancelTokenCreate();
+
+  /// Cancels every call using this token, including ones not started yet.
+  void cancel() => _cancelTokenCancel(id);
+
+  /// Frees the native token. Calls already started or queued keep working
+  /// with it, and [cancel] before [release] still reaches them.
+  void release() => _cancelTokenRelease(id);
+}
+
 class ProcessImageArguments {
   final String inputPath;
   final String outputPath;
   final String? jsonArgs;
+  final NativeCancelToken? cancelToken;
 
   ProcessImageArguments(
     this.inputPath,
     this.outputPath, {
     this.jsonArgs,
+    this.cancelToken,
   });
+
+  // jsonArgs with the token's id added as "cancel_token"
+  String? get _nativeJsonArgs {
+    final token = cancelToken;
+    if (token == null) return jsonArgs;
+    final args = jsonArgs == null
+        ? <String, dynamic>{}
+        : jsonDecode(jsonArgs!) as Map<String, dynamic>;
+    args['cancel_token'] = token.id;
+    return jsonEncode(args);
+  }
 }
@@ -0,0 +1,114 @@
+import 'dart:ffi' as ffi;
+
+// Mirrors ios/Classes/omr_result.h; keep both in sync and bump
+// omrResultAbiVersion with OMR_RESULT_ABI_VERSION.
+
+const int omrResultAbiVersion = 1;
+
+const int omrPart1Questions = 40;
+const int omrPart1Choices = 4;
+const int omrPart2Questions = 8;
+const int omrPart2Subs = 4;
+const int omrPart3Questions = 6;
+const int omrPart3Symbols = 12;
+const int omrPart3Digits = 4;
+const int omrPart3Text = 52;
+const int omrErrorText = 128;
+
+/// Symbols of the part 3 rows, top to bottom.
+const List<String> omrPart3SymbolNames = [
+  '-', ',', '0', '1', '2', '3', '4', '5', '6', '7', '8', '9' //
+];
+
+/// One bubble, in pixels of the 1280 px high working image.
+class OmrCell extends ffi.Struct {
+  /// 1 when the bubble is marked.
+  @ffi.Uint8()
+  external int filled;
+
+  @ffi.Array(3)
+  external ffi.Array<ffi.Uint8> reserved;
+
+  /// Inked fraction of the bubble's box, 0-1.
+  @ffi.Float()
+  external double fill;
+
+  @ffi.Int32()
+  external int x;
+
+  @ffi.Int32()
+  external int y;
+}
+
+/// Grading result filled in place by `process_image_struct`.
+class OmrResult extends ffi.Struct {
+  @ffi.Int32()
+  external int abiVersion;
+
+  /// Same values as `status_code` in the JSON result.
+  @ffi.Int32()
+  external int statusCode;
+
+  /// Capture pre-check reason, -1 when not reported.
+  @ffi.Int32()
+  external int reasonCode;
+
+  /// 1 when the answer and cell fields are valid.
+  @ffi.Int32()
+  external int graded;
+
+  /// Marked choices per question, bit n = choice A+n.
+  @ffi.Array(omrPart1Questions)
+  external ffi.Array<ffi.Uint8> part1;
+
+  /// Per sub-question: bit 0 = yes (true), bit 1 = no (false).
+  @ffi.Array(omrPart2Questions, omrPart2Subs)
+  external ffi.Array<ffi.Array<ffi.Uint8>> part2;
+
+  /// NUL-terminated part 3 answers; see [part3Answer].
+  @ffi.Array(omrPart3Questions, omrPart3Text)
+  external ffi.Array<ffi.Array<ffi.Uint8>> part3;
+
+  @ffi.Array(omrPart1Questions, omrPart1Choices)
+  external ffi.Array<ffi.Array<OmrCell>> part1Cells;
+
+  @ffi.Array(omrPart2Questions, omrPart2Subs, 2)
+  external ffi.Array<ffi.Array<ffi.Array<OmrCell>>> part2Cells;
+
+  @ffi.Array(omrPart3Questions, omrPart3Symbols, omrPart3Digits)
+  external ffi.Array<ffi.Array<ffi.Array<OmrCell>>> part3Cells;
+
+  @ffi.Array(omrErrorText)
+  external ffi.Array<ffi.Uint8> errorText;
+}
+
+String _readText(ffi.Array<ffi.Uint8> bytes, int capacity) {
+  final codes = <int>[];
+  for (var i = 0; i < capacity && bytes[i] != 0; i++) {
+    codes.add(bytes[i]);
+  }
+  return String.fromCharCodes(codes);
+}
+
+extension OmrResultAccess on OmrResult {
+  /// Error message, empty when [statusCode] is 0.
+  String get error => _readText(errorText, omrErrorText);
+
+  /// Part 1 answer for [question] (1-based) as the JSON result reports the
+  /// last marked choice, or null when left blank.
+  String? part1Answer(int question) {
+    final mask = part1[question - 1];
+    if (mask == 0) return null;
+    var choice = omrPart1Choices - 1;
+    while (mask & (1 << choice) == 0) {
+      choice--;
+    }
+    return String.fromCharCode(0x41 + choice);
+  }
+
+  /// Part 3 answer for [question] (1-based), or null when left blank.
+  String? part3Answer(int question) {
+    final text = _readText(part3[question - 1], omrPart3Text);
+    return text.isEmpty ? null : text;
+  }
+}
@@ -0,0 +1,290 @@
+// Accuracy + throughput benchmark on synthetic answer sheets.
+//
+//   omr-bench --count 200 --threads 4 --rotation 3 --perspective 0.03 --blur 1.5
+//             --noise 8 --shadow 0.4 --height 1600 --options '{"warp_free":true}'
+//
+// Sheets are rendered and written to --work-dir first, each image with its
+// ground truth as sheet_NNNNN.json in process_image's shape, then graded with
+// gradeImage on --threads workers. A human summary goes to stderr and one
+// JSON summary line to stdout, so speed and correctness are always
+// reported together. With --options '{"alloc_stats":true}' both also carry
+// per-stage allocation bytes, counts and high-water marks.
+//
+// --tilt rotates every sheet by exactly that many degrees, and --min-exact
+// makes the exit status 1 when fewer sheets are read exactly, so a tilt of
+// each sign doubles as a regression check of warp-free block order:
+//
+//   omr-bench --count 20 --tilt 4 --options '{"warp_free":true}' --min-exact 0.95
+//   omr-bench --count 20 --tilt -4 --options '{"warp_free":true}' --min-exact 0.95
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "omr/alloc_tracking.h"
+#include "omr/engine.h"
+#include "omr/result_writer.h"
+#include "omr/worker_pool.h"
+#include "sheet_synth.h"
+
+using namespace cv;
+using namespace std;
+namespace fs = std::filesystem;
+
+struct BenchConfig {
+    int count = 50;
+    unsigned seed = 1;
+    int threads = 1;
+    string workDir = "/tmp/omr-bench";
+    string options;
+    double minExact = 0;
+    SynthParams synth;
+};
+
+// Answers flattened per question so results can be compared cell by cell
+struct AnswerSheet {
+    string part1[40];
+    string part2[8][4];
+    string part3[6];
+};
+
+static AnswerSheet flatten(const GradeResult &result) {
+    AnswerSheet sheet;
+    if (!result.graded) {
+        return sheet;
+    }
+    for (const auto &answer: result.part1Answers) {
+        int question = atoi(answer.questionNumber.c_str()) - 1;
+        if (question >= 0 && question < 40) sheet.part1[question] += answer.userChoiceResult;
+    }
+    for (const auto &answer: result.part2Answers) {
+        int question = atoi(answer.questionNumber.c_str()) - 1;
+        int sub = answer.subName.empty() ? -1 : answer.subName[0] - 'a';
+        if (question >= 0 && question < 8 && sub >= 0 && sub < 4) {
+            sheet.part2[question][sub] += answer.userChoiceResult ? "T" : "F";
+        }
+    }
+    for (const auto &answer: result.part3Answers) {
+        int question = atoi(answer.questionNumber.c_str()) - 1;
+        if (question >= 0 && question < 6) sheet.part3[question] = answer.userResult;
+    }
+    return sheet;
+}
+
+struct SheetScore {
+    int part1 = 0, part2 = 0, part3 = 0;
+    bool header = false;
+    bool exact() const { return part1 == 40 && part2 == 32 && part3 == 6; }
+};
+
+static SheetScore score(const GradeResult &truth, const GradeResult &detected) {
+    AnswerSheet expected = flatten(truth), actual = flatten(detected);
+    SheetScore s;
+    for (int i = 0; i < 40; i++) s.part1 += expected.part1[i] == actual.part1[i];
+    for (int i = 0; i < 8; i++)
+        for (int j = 0; j < 4; j++) s.part2 += expected.part2[i][j] == actual.part2[i][j];
+    for (int i = 0; i < 6; i++) s.part3 += expected.part3[i] == actual.part3[i];
+    s.header = detected.headerRead && detected.studentId == truth.studentId && detected.examCode == truth.examCode;
+    return s;
+}
+
+static bool parseArgs(int argc, char **argv, BenchConfig &config) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Missing value for %s\n", arg.c_str());
+            return false;
+        }
+        const char *value = argv[++i];
+        if (arg == "--count") config.count = atoi(value);
+        else if (arg == "--seed") config.seed = static_cast<unsigned>(strtoul(value, nullptr, 10));
+        else if (arg == "--threads") config.threads = atoi(value);
+        else if (arg == "--work-dir") config.workDir = value;
+        else if (arg == "--options") config.options = value;
+        else if (arg == "--rotation") config.synth.rotation = atof(value);
+        else if (arg == "--tilt") {
+            config.synth.rotation = atof(value);
+            config.synth.exactRotation = true;
+        } else if (arg == "--min-exact") config.minExact = atof(value);
+        else if (arg == "--perspective") config.synth.perspective = atof(value);
+        else if (arg == "--blur") config.synth.blur = atof(value);
+        else if (arg == "--noise") config.synth.noise = atof(value);
+        else if (arg == "--shadow") config.synth.shadow = atof(value);
+        else if (arg == "--height") config.synth.height = atoi(value);
+        else if (arg == "--blank-rate") config.synth.blankRate = atof(value);
+        else {
+            fprintf(stderr, "Unknown option %s\n", arg.c_str());
+            return false;
+        }
+    }
+    return config.count > 0;
+}
+
+static double percentile(vector<double> values, double p) {
+    if (values.empty()) return 0;
+    size_t index = static_cast<size_t>(p * (values.size() - 1) + 0.5);
+    nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+int main(int argc, char **argv) {
+    BenchConfig config;
+    if (!parseArgs(argc, argv, config)) {
+        fprintf(stderr, "usage: omr-bench [--count N] [--seed S] [--threads T] [--work-dir DIR] [--options JSON]\n"
+                        "                 [--rotation DEG | --tilt DEG] [--perspective F] [--blur SIGMA] [--noise SD]\n"
+                        "                 [--shadow F] [--height PX] [--blank-rate P] [--min-exact F]\n");
+        return 2;
+    }
+    error_code ec;
+    fs::create_directories(config.workDir, ec);
+    if (ec) {
+        fprintf(stderr, "Cannot create %s: %s\n", config.workDir.c_str(), ec.message().c_str());
+        return 1;
+    }
+
+    // Render every sheet up front so rendering never counts towards throughput
+    mt19937 rng(config.seed);
+    vector<GradeResult> truths(config.count);
+    vector<string> inputs(config.count), outputs(config.count);
+    for (int i = 0; i < config.count; i++) {
+        SynthSheet sheet = renderSheet(config.synth, rng);
+        char name[32];
+        snprintf(name, sizeof(name), "/sheet_%05d", i);
+        inputs[i] = config.workDir + name + ".jpg";
+        outputs[i] = config.workDir + name + ".out.jpg";
+        if (!writeSynthSheet(sheet, config.workDir + name)) {
+            fprintf(stderr, "Cannot write %s\n", inputs[i].c_str());
+            return 1;
+        }
+        truths[i] = sheet.truth;
+    }
+
+    EngineOptions options = parseEngineOptions(config.options.empty() ? nullptr : config.options.c_str());
+    vector<GradeResult> detected(config.count);
+    vector<double> latencies(config.count);
+    auto start = chrono::steady_clock::now();
+    {
+        WorkerPool pool(config.threads);
+        for (int i = 0; i < config.count; i++) {
+            pool.submit([&, i]() {
+                auto begin = chrono::steady_clock::now();
+                gradeImage(inputs[i].c_str(), outputs[i].c_str(), options, detected[i]);
+                latencies[i] = chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count();
+            });
+        }
+    }
+    double wallSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    long long part1 = 0, part2 = 0, part3 = 0;
+    int exact = 0, failed = 0, header = 0;
+    map<int, int> statusCounts;
+    int tracked = 0;
+    double allocBytes[ALLOC_STAGE_COUNT] = {}, allocCount[ALLOC_STAGE_COUNT] = {};
+    long long allocPeak[ALLOC_STAGE_COUNT] = {}, peakBytes = 0;
+    for (int i = 0; i < config.count; i++) {
+        const AllocReport &allocations = detected[i].allocations;
+        if (allocations.tracked) {
+            tracked++;
+            for (int stage = 0; stage < ALLOC_STAGE_COUNT; stage++) {
+                allocBytes[stage] += allocations.stages[stage].bytes;
+                allocCount[stage] += allocations.stages[stage].count;
+                allocPeak[stage] = max(allocPeak[stage], allocations.stages[stage].peakBytes);
+            }
+            peakBytes = max(peakBytes, allocations.peakBytes);
+        }
+        SheetScore s = score(truths[i], detected[i]);
+        part1 += s.part1;
+        part2 += s.part2;
+        part3 += s.part3;
+        exact += s.exact();
+        header += s.header;
+        failed += detected[i].statusCode != truths[i].statusCode;
+        statusCounts[detected[i].statusCode]++;
+    }
+
+    double n = config.count;
+    double sheetsPerSecond = n / wallSeconds;
+    fprintf(stderr, "%d sheets on %d threads: %.2f sheets/s, p50 %.1f ms, p95 %.1f ms\n",
+            config.count, config.threads, sheetsPerSecond, percentile(latencies, 0.5), percentile(latencies, 0.95));
+    fprintf(stderr, "accuracy: part1 %.4f, part2 %.4f, part3 %.4f, header %.4f, exact sheets %.4f, "
+                    "status mismatches %d\n",
+            part1 / (40 * n), part2 / (32 * n), part3 / (6 * n), header / n, exact / n, failed);
+    for (int stage = 0; tracked > 0 && stage < ALLOC_STAGE_COUNT; stage++) {
+        fprintf(stderr, "alloc %-8s %8.2f MB in %6.1f allocations per sheet, peak %.2f MB\n", allocStageName(stage),
+                allocBytes[stage] / tracked / (1 << 20), allocCount[stage] / tracked, allocPeak[stage] / double(1 << 20));
+    }
+
+    ResultWriter writer;
+    writer.beginObject();
+    writer.key("sheets");
+    writer.number(static_cast<long long>(config.count));
+    writer.key("threads");
+    writer.number(static_cast<long long>(config.threads));
+    writer.key("sheets_per_second");
+    writer.number(sheetsPerSecond);
+    writer.key("latency_ms");
+    writer.beginObject();
+    writer.key("p50");
+    writer.number(percentile(latencies, 0.5));
+    writer.key("p95");
+    writer.number(percentile(latencies, 0.95));
+    writer.key("max");
+    writer.number(percentile(latencies, 1.0));
+    writer.endObject();
+    writer.key("accuracy");
+    writer.beginObject();
+    writer.key("part1");
+    writer.number(part1 / (40 * n));
+    writer.key("part2");
+    writer.number(part2 / (32 * n));
+    writer.key("part3");
+    writer.number(part3 / (6 * n));
+    writer.key("header");
+    writer.number(header / n);
+    writer.key("exact_sheets");
+    writer.number(exact / n);
+    writer.endObject();
+    writer.key("status_codes");
+    writer.beginObject();
+    for (const auto &entry: statusCounts) {
+        writer.key(to_string(entry.first).c_str());
+        writer.number(static_cast<long long>(entry.second));
+    }
+    writer.endObject();
+    writer.key("status_mismatches");
+    writer.number(static_cast<long long>(failed));
+    if (tracked > 0) {
+        writer.key("allocations");
+        writer.beginObject();
+        for (int stage = 0; stage < ALLOC_STAGE_COUNT; stage++) {
+            writer.key(allocStageName(stage));
+            writer.beginObject();
+            writer.key("bytes_per_sheet");
+            writer.number(allocBytes[stage] / tracked);
+            writer.key("count_per_sheet");
+            writer.number(allocCount[stage] / tracked);
+            writer.key("peak_bytes");
+            writer.number(allocPeak[stage]);
+            writer.endObject();
+        }
+        writer.key("peak_bytes");
+        writer.number(peakBytes);
+        writer.endObject();
+    }
+    writer.endObject();
+    char *json = writer.release();
+    puts(json);
+    free(json);
+    if (exact / n < config.minExact) {
+        fprintf(stderr, "exact sheets %.4f below --min-exact %.4f\n", exact / n, config.minExact);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,530 @@
+// Long-running grading daemon on a Unix domain socket.
+//
+//   omr-daemon --socket /run/omr.sock --threads 8 --batch-window-ms 2
+//
+// The protocol is newline-delimited JSON and any number of requests may be
+// in flight per connection; responses carry the request's "id" and can
+// come back out of order.
+//
+//   {"id":1,"op":"grade","path":"/scans/a.jpg"[,"output":"/out/a.jpg"][,"options":{...}]}
+//   {"id":2,"op":"grade","bytes":123456}   followed by 123456 bytes of encoded image
+//   {"id":3,"op":"stats"}
+//
+// A grade response is {"id":..,"queue_ms":..,"latency_ms":..,"batch":..,
+// "result":{...}}, with result exactly as process_image returns it. Requests
+// that arrive while the workers are busy are dispatched together as one
+// batch once workers free up; an idle daemon waits up to the batch window
+// for company before dispatching.
+//
+// With --cache DIR, results are kept on disk keyed by the image content
+// (see ResultCache), so a re-uploaded photo or an unchanged regrade is
+// answered without running the pipeline. --cache-mb bounds the directory.
+//
+//   echo '{"id":1,"path":"a.jpg"}' | socat - UNIX-CONNECT:/tmp/omr-daemon.sock
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <opencv2/opencv.hpp>
+
+#include "cjson/cJSON.h"
+#include "omr/engine.h"
+#include "omr/result_writer.h"
+#include "omr/worker_pool.h"
+
+using namespace cv;
+using namespace std;
+
+#define STATS_WINDOW 1024
+#define MAX_LINE_BYTES (64 << 10)
+
+struct DaemonConfig {
+    string socketPath = "/tmp/omr-daemon.sock";
+    int threads = 0;
+    int batchWindowMs = 2;
+    long long maxRequestBytes = 64LL << 20;
+    string cacheDir;
+    long long cacheMb = 1024;
+};
+
+static volatile sig_atomic_t stopping = 0;
+
+static void onStop(int) {
+    stopping = 1;
+}
+
+// One client socket. Shared by the reader and every request it queued so
+// the descriptor stays open until the last response is written.
+class Connection {
+public:
+    explicit Connection(int fd) : fd_(fd) {}
+    ~Connection() { close(fd_); }
+
+    int fd() const { return fd_; }
+
+    void send(const char *json) {
+        lock_guard<mutex> lock(writeMutex_);
+        if (!writeAll(json, strlen(json))) return;
+        writeAll("\n", 1);
+    }
+
+private:
+    bool writeAll(const char *data, size_t length) {
+        while (length > 0) {
+            ssize_t n = ::send(fd_, data, length, MSG_NOSIGNAL);
+            if (n <= 0) return false;
+            data += n;
+            length -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    int fd_;
+    mutex writeMutex_;
+};
+
+struct Request {
+    shared_ptr<Connection> connection;
+    string id = "null"; // serialized JSON value, echoed back verbatim
+    string path;
+    string output;
+    vector<uchar> bytes;
+    EngineOptions options;
+    chrono::steady_clock::time_point received;
+};
+
+static double percentile(vector<double> values, double p) {
+    if (values.empty()) return 0;
+    size_t index = static_cast<size_t>(p * (values.size() - 1) + 0.5);
+    nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+// Rolling latency window plus lifetime counters
+class DaemonStats {
+public:
+    void batch(size_t size) {
+        lock_guard<mutex> lock(mutex_);
+        batches_++;
+        batched_ += size;
+    }
+
+    void completed(double queueMs, double latencyMs) {
+        lock_guard<mutex> lock(mutex_);
+        if (queueMs_.size() < STATS_WINDOW) {
+            queueMs_.push_back(queueMs);
+            latencyMs_.push_back(latencyMs);
+        } else {
+            queueMs_[completed_ % STATS_WINDOW] = queueMs;
+            latencyMs_[completed_ % STATS_WINDOW] = latencyMs;
+        }
+        completed_++;
+    }
+
+    void write(ResultWriter &writer, size_t queueDepth, int inFlight) {
+        lock_guard<mutex> lock(mutex_);
+        writer.beginObject();
+        writer.key("queue_depth");
+        writer.number(static_cast<long long>(queueDepth));
+        writer.key("in_flight");
+        writer.number(static_cast<long long>(inFlight));
+        writer.key("completed");
+        writer.number(completed_);
+        writer.key("batches");
+        writer.number(batches_);
+        writer.key("mean_batch_size");
+        writer.number(batches_ > 0 ? static_cast<double>(batched_) / batches_ : 0.0);
+        writeWindow(writer, "queue_ms", queueMs_);
+        writeWindow(writer, "latency_ms", latencyMs_);
+        writer.key("uptime_s");
+        writer.number(chrono::duration<double>(chrono::steady_clock::now() - started_).count());
+        writer.endObject();
+    }
+
+private:
+    static void writeWindow(ResultWriter &writer, const char *name, const vector<double> &values) {
+        writer.key(name);
+        writer.beginObject();
+        writer.key("p50");
+        writer.number(percentile(values, 0.5));
+        writer.key("p95");
+        writer.number(percentile(values, 0.95));
+        writer.key("p99");
+        writer.number(percentile(values, 0.99));
+        writer.key("max");
+        writer.number(percentile(values, 1.0));
+        writer.endObject();
+    }
+
+    mutex mutex_;
+    long long completed_ = 0;
+    long long batches_ = 0;
+    long long batched_ = 0;
+    vector<double> queueMs_;
+    vector<double> latencyMs_;
+    chrono::steady_clock::time_point started_ = chrono::steady_clock::now();
+};
+
+// Pending requests. Hands out batches sized to the idle workers, so work
+// that piles up while every worker is busy goes out together.
+class RequestQueue {
+public:
+    RequestQueue(int capacity, int windowMs) : capacity_(capacity), window_(windowMs) {}
+
+    void push(unique_ptr<Request> request) {
+        {
+            lock_guard<mutex> lock(mutex_);
+            queue_.push_back(move(request));
+        }
+        changed_.notify_all();
+    }
+
+    // Blocks until at least one worker is idle and a request is waiting.
+    // Returns an empty batch once stop() is called and the queue is empty.
+    vector<unique_ptr<Request>> nextBatch() {
+        unique_lock<mutex> lock(mutex_);
+        changed_.wait(lock, [this] { return stopped_ || (!queue_.empty() && inFlight_ < capacity_); });
+        if (!stopped_ && window_.count() > 0 && inFlight_ == 0 && static_cast<int>(queue_.size()) < capacity_) {
+            changed_.wait_for(lock, window_, [this] {
+                return stopped_ || static_cast<int>(queue_.size()) >= capacity_ - inFlight_;
+            });
+        }
+        vector<unique_ptr<Request>> batch;
+        size_t take = min(queue_.size(), static_cast<size_t>(max(1, capacity_ - inFlight_)));
+        for (size_t i = 0; i < take; i++) {
+            batch.push_back(move(queue_.front()));
+            queue_.pop_front();
+        }
+        inFlight_ += static_cast<int>(batch.size());
+        return batch;
+    }
+
+    void finished() {
+        {
+            lock_guard<mutex> lock(mutex_);
+            inFlight_--;
+        }
+        changed_.notify_all();
+    }
+
+    void stop() {
+        {
+            lock_guard<mutex> lock(mutex_);
+            stopped_ = true;
+        }
+        changed_.notify_all();
+    }
+
+    size_t depth() {
+        lock_guard<mutex> lock(mutex_);
+        return queue_.size();
+    }
+
+    int inFlight() {
+        lock_guard<mutex> lock(mutex_);
+        return inFlight_;
+    }
+
+private:
+    mutex mutex_;
+    condition_variable changed_;
+    deque<unique_ptr<Request>> queue_;
+    int capacity_;
+    int inFlight_ = 0;
+    bool stopped_ = false;
+    chrono::milliseconds window_;
+};
+
+static void sendError(Connection &connection, const string &id, const char *message) {
+    ResultWriter writer;
+    writer.beginObject();
+    writer.key("id");
+    writer.raw(id.c_str(), id.size());
+    writer.key("error");
+    writer.string(message);
+    writer.endObject();
+    char *json = writer.release();
+    connection.send(json);
+    free(json);
+}
+
+// Buffered reads of newline-terminated headers and raw payloads
+class SocketReader {
+public:
+    explicit SocketReader(int fd) : fd_(fd) {}
+
+    bool readLine(string &line) {
+        while (true) {
+            size_t newline = buffer_.find('\n', offset_);
+            if (newline != string::npos) {
+                line.assign(buffer_, offset_, newline - offset_);
+                offset_ = newline + 1;
+                return true;
+            }
+            if (buffer_.size() - offset_ > MAX_LINE_BYTES || !fill()) return false;
+        }
+    }
+
+    bool readBytes(vector<uchar> &out, size_t length) {
+        out.clear();
+        out.reserve(length);
+        while (out.size() < length) {
+            if (offset_ == buffer_.size() && !fill()) return false;
+            size_t n = min(length - out.size(), buffer_.size() - offset_);
+            out.insert(out.end(), buffer_.begin() + offset_, buffer_.begin() + offset_ + n);
+            offset_ += n;
+        }
+        return true;
+    }
+
+private:
+    bool fill() {
+        if (offset_ > 0) {
+            buffer_.erase(0, offset_);
+            offset_ = 0;
+        }
+        char chunk[16384];
+        ssize_t n = recv(fd_, chunk, sizeof(chunk), 0);
+        if (n <= 0) return false;
+        buffer_.append(chunk, static_cast<size_t>(n));
+        return true;
+    }
+
+    int fd_;
+    string buffer_;
+    size_t offset_ = 0;
+};
+
+static void serveConnection(shared_ptr<Connection> connection, RequestQueue &queue, DaemonStats &stats,
+                            const DaemonConfig &config) {
+    SocketReader reader(connection->fd());
+    string line;
+    while (reader.readLine(line)) {
+        if (line.empty()) continue;
+        cJSON *json = cJSON_Parse(line.c_str());
+        if (json == nullptr) {
+            sendError(*connection, "null", "Invalid JSON");
+            continue;
+        }
+        string id = "null";
+        const cJSON *idItem = cJSON_GetObjectItem(json, "id");
+        if (idItem != nullptr) {
+            char *printed = cJSON_PrintUnformatted(idItem);
+            id = printed;
+            cJSON_free(printed);
+        }
+        const cJSON *op = cJSON_GetObjectItem(json, "op");
+        const char *opName = cJSON_IsString(op) ? op->valuestring : "grade";
+
+        if (strcmp(opName, "stats") == 0) {
+            ResultWriter writer;
+            writer.beginObject();
+            writer.key("id");
+            writer.raw(id.c_str(), id.size());
+            writer.key("stats");
+            stats.write(writer, queue.depth(), queue.inFlight());
+            writer.endObject();
+            char *response = writer.release();
+            connection->send(response);
+            free(response);
+            cJSON_Delete(json);
+            continue;
+        }
+        if (strcmp(opName, "grade") != 0) {
+            sendError(*connection, id, "Unknown op");
+            cJSON_Delete(json);
+            continue;
+        }
+
+        auto request = unique_ptr<Request>(new Request());
+        request->connection = connection;
+        request->id = id;
+        const cJSON *path = cJSON_GetObjectItem(json, "path");
+        const cJSON *output = cJSON_GetObjectItem(json, "output");
+        const cJSON *bytes = cJSON_GetObjectItem(json, "bytes");
+        const cJSON *options = cJSON_GetObjectItem(json, "options");
+        if (cJSON_IsString(path)) request->path = path->valuestring;
+        if (cJSON_IsString(output)) request->output = output->valuestring;
+        if (cJSON_IsObject(options)) {
+            char *printed = cJSON_PrintUnformatted(options);
+            request->options = parseEngineOptions(printed);
+            cJSON_free(printed);
+        }
+        bool hasBytes = cJSON_IsNumber(bytes);
+        double length = hasBytes ? bytes->valuedouble : 0;
+        cJSON_Delete(json);
+
+        if (hasBytes) {
+            if (length <= 0 || length > config.maxRequestBytes) {
+                // The payload cannot be skipped reliably; drop the connection
+                sendError(*connection, id, "Invalid image size");
+                break;
+            }
+            if (!reader.readBytes(request->bytes, static_cast<size_t>(length))) break;
+        } else if (request->path.empty()) {
+            sendError(*connection, id, "Missing path or bytes");
+            continue;
+        }
+        request->received = chrono::steady_clock::now();
+        queue.push(move(request));
+    }
+}
+
+static void gradeRequest(Request &request, size_t batchSize, DaemonStats &stats) {
+    auto begin = chrono::steady_clock::now();
+    // Answered from the result cache when --cache is set and the image was seen before
+    ResultWriter resultWriter;
+    if (request.bytes.empty()) {
+        gradeImageJson(request.path.c_str(), request.output.c_str(), request.options, resultWriter);
+    } else {
+        gradeEncodedJson(request.bytes, request.output.c_str(), request.options, resultWriter);
+    }
+    char *result = resultWriter.release();
+    auto end = chrono::steady_clock::now();
+    double queueMs = chrono::duration<double, milli>(begin - request.received).count();
+    double latencyMs = chrono::duration<double, milli>(end - request.received).count();
+    stats.completed(queueMs, latencyMs);
+
+    ResultWriter writer;
+    writer.beginObject();
+    writer.key("id");
+    writer.raw(request.id.c_str(), request.id.size());
+    writer.key("queue_ms");
+    writer.number(queueMs);
+    writer.key("latency_ms");
+    writer.number(latencyMs);
+    writer.key("batch");
+    writer.number(static_cast<long long>(batchSize));
+    writer.key("result");
+    writer.raw(result, strlen(result));
+    writer.endObject();
+    free(result);
+    char *json = writer.release();
+    request.connection->send(json);
+    free(json);
+}
+
+// Run every stage once so OpenCV's lazy initialisation (thread pool, IPP
+// dispatch, CLAHE) happens before the first client is waiting
+static void warmUp() {
+    Mat blank(1600, 1131, CV_8UC3, Scalar::all(245));
+    rectangle(blank, Rect(100, 400, 900, 900), Scalar::all(30), 3);
+    EngineOptions options;
+    GradeResult result;
+    gradeImage(blank, "", options, result);
+}
+
+static bool parseArgs(int argc, char **argv, DaemonConfig &config) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Missing value for %s\n", arg.c_str());
+            return false;
+        }
+        const char *value = argv[++i];
+        if (arg == "--socket") config.socketPath = value;
+        else if (arg == "--threads") config.threads = atoi(value);
+        else if (arg == "--batch-window-ms") config.batchWindowMs = atoi(value);
+        else if (arg == "--max-request-bytes") config.maxRequestBytes = atoll(value);
+        else if (arg == "--cache") config.cacheDir = value;
+        else if (arg == "--cache-mb") config.cacheMb = atoll(value);
+        else {
+            fprintf(stderr, "Unknown option %s\n", arg.c_str());
+            return false;
+        }
+    }
+    return !config.socketPath.empty();
+}
+
+int main(int argc, char **argv) {
+    DaemonConfig config;
+    if (!parseArgs(argc, argv, config)) {
+        fprintf(stderr, "usage: omr-daemon [--socket PATH] [--threads N] [--batch-window-ms MS] "
+                        "[--max-request-bytes N]\n"
+                        "                  [--cache DIR] [--cache-mb N]\n");
+        return 2;
+    }
+
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (config.socketPath.size() >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path too long\n");
+        return 1;
+    }
+    strncpy(address.sun_path, config.socketPath.c_str(), sizeof(address.sun_path) - 1);
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(config.socketPath.c_str());
+    if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+        listen(listener, 64) != 0) {
+        fprintf(stderr, "Cannot listen on %s: %s\n", config.socketPath.c_str(), strerror(errno));
+        return 1;
+    }
+
+    signal(SIGINT, onStop);
+    signal(SIGTERM, onStop);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (!config.cacheDir.empty() && !setResultCache(config.cacheDir, config.cacheMb << 20)) {
+        fprintf(stderr, "Cannot use cache directory %s\n", config.cacheDir.c_str());
+        return 1;
+    }
+    warmUp();
+    // Never freed: detached connection readers may still hold references
+    // while the process exits
+    auto *stats = new DaemonStats();
+    RequestQueue *queue = nullptr;
+    {
+        WorkerPool pool(config.threads);
+        queue = new RequestQueue(pool.size(), config.batchWindowMs);
+        fprintf(stderr, "omr-daemon listening on %s with %d workers\n", config.socketPath.c_str(), pool.size());
+
+        thread dispatcher([&]() {
+            while (true) {
+                vector<unique_ptr<Request>> batch = queue->nextBatch();
+                if (batch.empty()) break;
+                stats->batch(batch.size());
+                size_t batchSize = batch.size();
+                for (auto &request: batch) {
+                    shared_ptr<Request> owned(move(request));
+                    pool.submit([owned, batchSize, stats, queue]() {
+                        gradeRequest(*owned, batchSize, *stats);
+                        queue->finished();
+                    });
+                }
+            }
+        });
+
+        while (!stopping) {
+            pollfd pending = {listener, POLLIN, 0};
+            if (poll(&pending, 1, 250) <= 0) continue;
+            int client = accept(listener, nullptr, nullptr);
+            if (client < 0) continue;
+            auto connection = make_shared<Connection>(client);
+            thread(serveConnection, connection, ref(*queue), ref(*stats), cref(config)).detach();
+        }
+
+        // Stop accepting, then finish everything already queued
+        close(listener);
+        unlink(config.socketPath.c_str());
+        queue->stop();
+        dispatcher.join();
+    }
+    fprintf(stderr, "omr-daemon stopped\n");
+    return 0;
+}
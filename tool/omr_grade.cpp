@@ -0,0 +1,365 @@
+// Batch grader for scanner dumps.
+//
+//   omr-grade [options] <dir | glob | file | @list>...
+//
+//   --threads N       cores to use (default: all)
+//   --stages D,R,G,E  threads for the decode, register, grade and encode
+//                     stages (default: split from --threads)
+//   --output FILE     append NDJSON results to FILE instead of stdout
+//   --annotated DIR   also write annotated images to DIR
+//   --options JSON    engine options, as passed to process_image
+//   --resume          skip inputs already recorded in --output
+//   --multi-sheet     grade every sheet in each image (process_sheets shape)
+//
+// Directories are searched recursively for images, globs are expanded and
+// "@list" reads one path per line ("@-" for stdin). Each result line is
+// {"file":...,"latency_ms":...,["annotated":...,]"result":{...}} where
+// result is exactly what process_image returns for that image. Lines are
+// flushed as sheets finish, so an interrupted run can be picked up again
+// with --resume.
+//
+// Single-sheet runs go through BatchPipeline, so decoding and encoding
+// overlap with grading; per-stage utilization is printed at the end.
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include <glob.h>
+
+#include "cjson/cJSON.h"
+#include "omr/engine.h"
+#include "omr/batch_pipeline.h"
+#include "omr/result_writer.h"
+#include "omr/worker_pool.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+struct GradeConfig {
+    int threads = 0;
+    string stages;
+    string output;
+    string annotatedDir;
+    string options;
+    bool resume = false;
+    bool multiSheet = false;
+    vector<string> inputs;
+};
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void onInterrupt(int) {
+    interrupted = 1;
+}
+
+static bool isImagePath(const fs::path &path) {
+    string ext = path.extension().string();
+    for (auto &c: ext) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    return ext == ".jpg" || ext == ".jpeg" || ext == ".png" || ext == ".bmp" || ext == ".tif" || ext == ".tiff" ||
+           ext == ".webp";
+}
+
+static bool parseArgs(int argc, char **argv, GradeConfig &config) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--resume") {
+            config.resume = true;
+            continue;
+        }
+        if (arg == "--multi-sheet") {
+            config.multiSheet = true;
+            continue;
+        }
+        if (arg.rfind("--", 0) != 0) {
+            config.inputs.push_back(arg);
+            continue;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Missing value for %s\n", arg.c_str());
+            return false;
+        }
+        const char *value = argv[++i];
+        if (arg == "--threads") config.threads = atoi(value);
+        else if (arg == "--stages") config.stages = value;
+        else if (arg == "--output") config.output = value;
+        else if (arg == "--annotated") config.annotatedDir = value;
+        else if (arg == "--options") config.options = value;
+        else {
+            fprintf(stderr, "Unknown option %s\n", arg.c_str());
+            return false;
+        }
+    }
+    if (config.resume && config.output.empty()) {
+        fprintf(stderr, "--resume needs --output\n");
+        return false;
+    }
+    return !config.inputs.empty();
+}
+
+// Expand directories, globs and @lists into image paths, in a stable order
+static void collectInputs(const string &input, vector<string> &paths) {
+    if (input.size() > 1 && input[0] == '@') {
+        string listPath = input.substr(1);
+        ifstream file;
+        istream *in = &cin;
+        if (listPath != "-") {
+            file.open(listPath);
+            if (!file) {
+                fprintf(stderr, "Cannot read list %s\n", listPath.c_str());
+                return;
+            }
+            in = &file;
+        }
+        string line;
+        while (getline(*in, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (!line.empty()) paths.push_back(line);
+        }
+        return;
+    }
+
+    error_code ec;
+    if (fs::is_directory(input, ec)) {
+        vector<string> found;
+        for (auto it = fs::recursive_directory_iterator(input, fs::directory_options::skip_permission_denied, ec);
+             it != fs::recursive_directory_iterator(); it.increment(ec)) {
+            if (ec) break;
+            if (it->is_regular_file(ec) && isImagePath(it->path())) {
+                found.push_back(it->path().string());
+            }
+        }
+        sort(found.begin(), found.end());
+        paths.insert(paths.end(), found.begin(), found.end());
+        return;
+    }
+
+    if (input.find_first_of("*?[") != string::npos) {
+        glob_t matches;
+        if (glob(input.c_str(), 0, nullptr, &matches) == 0) {
+            for (size_t i = 0; i < matches.gl_pathc; i++) {
+                paths.push_back(matches.gl_pathv[i]);
+            }
+        }
+        globfree(&matches);
+        return;
+    }
+
+    paths.push_back(input);
+}
+
+// Files already graded by a previous run. A line cut short by the
+// interruption is dropped from the file so appending stays valid NDJSON.
+static set<string> loadCompleted(const string &outputPath) {
+    set<string> completed;
+    ifstream in(outputPath, ios::binary);
+    if (!in) {
+        return completed;
+    }
+    string line;
+    streamoff validEnd = 0;
+    while (getline(in, line)) {
+        if (in.eof()) {
+            break; // no trailing newline: partial write
+        }
+        cJSON *entry = cJSON_Parse(line.c_str());
+        const cJSON *file = cJSON_GetObjectItem(entry, "file");
+        if (cJSON_IsString(file)) {
+            completed.insert(file->valuestring);
+        }
+        cJSON_Delete(entry);
+        validEnd = in.tellg();
+    }
+    in.close();
+    error_code ec;
+    if (static_cast<uintmax_t>(validEnd) != fs::file_size(outputPath, ec) && !ec) {
+        fs::resize_file(outputPath, static_cast<uintmax_t>(validEnd), ec);
+    }
+    return completed;
+}
+
+// "D,R,G,E" thread counts over the defaults
+static bool parseStages(const string &spec, PipelineConfig &config) {
+    int counts[4];
+    if (sscanf(spec.c_str(), "%d,%d,%d,%d", &counts[0], &counts[1], &counts[2], &counts[3]) != 4) {
+        return false;
+    }
+    for (int count: counts) {
+        if (count <= 0) return false;
+    }
+    config.decodeThreads = counts[0];
+    config.registerThreads = counts[1];
+    config.gradeThreads = counts[2];
+    config.encodeThreads = counts[3];
+    return true;
+}
+
+// Annotated image names follow the input basename, numbered on collision
+static vector<string> annotatedPaths(const vector<string> &inputs, const string &dir) {
+    vector<string> paths(inputs.size());
+    if (dir.empty()) {
+        return paths;
+    }
+    map<string, int> seen;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        string stem = fs::path(inputs[i]).stem().string();
+        int count = seen[stem]++;
+        if (count > 0) stem += "_" + to_string(count);
+        paths[i] = (fs::path(dir) / (stem + ".jpg")).string();
+    }
+    return paths;
+}
+
+int main(int argc, char **argv) {
+    GradeConfig config;
+    if (!parseArgs(argc, argv, config)) {
+        fprintf(stderr, "usage: omr-grade [--threads N] [--output FILE] [--annotated DIR] [--options JSON] [--resume]\n"
+                        "                 [--multi-sheet] [--stages D,R,G,E]\n"
+                        "                 <dir | glob | file | @list>...\n");
+        return 2;
+    }
+
+    vector<string> inputs;
+    for (const auto &input: config.inputs) {
+        collectInputs(input, inputs);
+    }
+    vector<string> annotated = annotatedPaths(inputs, config.annotatedDir);
+    if (!config.annotatedDir.empty()) {
+        error_code ec;
+        fs::create_directories(config.annotatedDir, ec);
+        if (ec) {
+            fprintf(stderr, "Cannot create %s: %s\n", config.annotatedDir.c_str(), ec.message().c_str());
+            return 1;
+        }
+    }
+
+    set<string> completed;
+    if (config.resume) {
+        completed = loadCompleted(config.output);
+    }
+    FILE *out = stdout;
+    if (!config.output.empty()) {
+        out = fopen(config.output.c_str(), "ab");
+        if (out == nullptr) {
+            fprintf(stderr, "Cannot open %s\n", config.output.c_str());
+            return 1;
+        }
+    }
+
+    signal(SIGINT, onInterrupt);
+    signal(SIGTERM, onInterrupt);
+
+    EngineOptions options = parseEngineOptions(config.options.empty() ? nullptr : config.options.c_str());
+    PipelineConfig stages = defaultPipelineConfig(config.threads);
+    if (!config.stages.empty() && !parseStages(config.stages, stages)) {
+        fprintf(stderr, "Invalid --stages %s, expected four positive counts\n", config.stages.c_str());
+        return 2;
+    }
+    mutex outMutex;
+    atomic<int> graded(0);
+    map<int, int> statusCounts;
+    int skipped = 0;
+
+    // Called from worker threads as sheets finish
+    auto record = [&](size_t i, double latency, const GradeResult &result, const vector<SheetResult> &sheets) {
+        ResultWriter writer;
+        writer.beginObject();
+        writer.key("file");
+        writer.string(inputs[i].c_str());
+        writer.key("latency_ms");
+        writer.number(latency);
+        // Multi-sheet annotations are numbered per sheet, see gradeSheets
+        if (!annotated[i].empty() && result.graded && !config.multiSheet) {
+            writer.key("annotated");
+            writer.string(annotated[i].c_str());
+        }
+        writer.key("result");
+        if (config.multiSheet) {
+            writeSheetResults(writer, sheets, result.statusCode, result.error);
+        } else {
+            writeGradeResult(writer, result);
+        }
+        writer.endObject();
+        char *json = writer.release();
+
+        lock_guard<mutex> lock(outMutex);
+        fputs(json, out);
+        fputc('\n', out);
+        fflush(out);
+        free(json);
+        statusCounts[result.statusCode]++;
+        graded++;
+    };
+
+    vector<StageStats> stageStats;
+    auto start = chrono::steady_clock::now();
+    if (config.multiSheet) {
+        WorkerPool pool(config.threads);
+        fprintf(stderr, "Grading %zu files on %d threads\n", inputs.size(), pool.size());
+        for (size_t i = 0; i < inputs.size(); i++) {
+            if (completed.count(inputs[i])) {
+                skipped++;
+                continue;
+            }
+            pool.submit([&, i]() {
+                if (interrupted) {
+                    return;
+                }
+                GradeResult result;
+                vector<SheetResult> sheets;
+                auto begin = chrono::steady_clock::now();
+                result.statusCode = gradeSheets(inputs[i].c_str(), annotated[i].c_str(), options, sheets,
+                                                result.error);
+                result.graded = result.statusCode == STATUS_OK;
+                record(i, chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count(), result,
+                       sheets);
+            });
+        }
+    } else {
+        const vector<SheetResult> noSheets;
+        BatchPipeline pipeline(options, stages, [&](PipelineJob &job) {
+            record(job.index, job.latencyMs, job.result, noSheets);
+        });
+        fprintf(stderr, "Grading %zu files, stage threads %d/%d/%d/%d (decode/register/grade/encode)\n",
+                inputs.size(), stages.decodeThreads, stages.registerThreads, stages.gradeThreads,
+                stages.encodeThreads);
+        // submit blocks while the pipeline is full, so an interrupt stops
+        // intake within a few sheets
+        for (size_t i = 0; i < inputs.size() && !interrupted; i++) {
+            if (completed.count(inputs[i])) {
+                skipped++;
+                continue;
+            }
+            pipeline.submit(i, inputs[i], annotated[i]);
+        }
+        pipeline.finish();
+        stageStats = pipeline.stats();
+    }
+    double wallSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    fprintf(stderr, "%d graded, %d already done%s in %.1f s (%.2f sheets/s)\n", graded.load(), skipped,
+            interrupted ? ", interrupted" : "", wallSeconds, wallSeconds > 0 ? graded / wallSeconds : 0.0);
+    for (const auto &entry: statusCounts) {
+        fprintf(stderr, "  status %d: %d\n", entry.first, entry.second);
+    }
+    for (const auto &stage: stageStats) {
+        fprintf(stderr, "  %-8s %2d threads, %5.1f%% busy\n", stage.name, stage.threads,
+                wallSeconds > 0 ? 100.0 * stage.busySeconds / (stage.threads * wallSeconds) : 0.0);
+    }
+    return interrupted ? 130 : 0;
+}
@@ -0,0 +1,218 @@
+// Per-stage micro-benchmarks for the grading pipeline.
+//
+//   omr-microbench --warm 50 --cold 10 --height 2400 --filter Contours
+//
+// Every stage runs on the input it sees inside gradeImage, prepared once
+// from a synthetic sheet photo of --height pixels. "warm" repeats a stage
+// back to back; "cold" streams a buffer larger than the last-level cache
+// through the CPU before each run so input and tables come from memory.
+// One JSON line per stage and mode goes to stdout, a table to stderr.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "omr/pipeline.h"
+#include "omr/result_writer.h"
+#include "sheet_synth.h"
+
+using namespace cv;
+using namespace std;
+
+#define EVICT_BYTES (64 << 20)
+
+struct MicroConfig {
+    int warm = 50;
+    int cold = 10;
+    unsigned seed = 1;
+    int height = 2400;
+    string filter;
+};
+
+struct Stage {
+    const char *name;
+    Size input;
+    function<void()> run;
+};
+
+struct Timing {
+    double min = 0, median = 0, mean = 0, p95 = 0;
+};
+
+static bool parseArgs(int argc, char **argv, MicroConfig &config) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Missing value for %s\n", arg.c_str());
+            return false;
+        }
+        const char *value = argv[++i];
+        if (arg == "--warm") config.warm = atoi(value);
+        else if (arg == "--cold") config.cold = atoi(value);
+        else if (arg == "--seed") config.seed = static_cast<unsigned>(strtoul(value, nullptr, 10));
+        else if (arg == "--height") config.height = atoi(value);
+        else if (arg == "--filter") config.filter = value;
+        else {
+            fprintf(stderr, "Unknown option %s\n", arg.c_str());
+            return false;
+        }
+    }
+    return config.warm >= 0 && config.cold >= 0;
+}
+
+static volatile unsigned char evictSink;
+
+// Write every cache line of a buffer bigger than the caches so that the
+// next stage starts with its data evicted
+static void evictCaches() {
+    static vector<unsigned char> buffer(EVICT_BYTES);
+    for (size_t i = 0; i < buffer.size(); i += 64) {
+        buffer[i]++;
+    }
+    evictSink = buffer[buffer.size() / 2];
+}
+
+static Timing measure(const Stage &stage, int iterations, bool cold) {
+    vector<double> samples;
+    samples.reserve(iterations);
+    if (!cold) {
+        stage.run(); // one untimed run to fault in buffers and lazy state
+    }
+    for (int i = 0; i < iterations; i++) {
+        if (cold) {
+            evictCaches();
+        }
+        auto begin = chrono::steady_clock::now();
+        stage.run();
+        samples.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - begin).count());
+    }
+
+    Timing timing;
+    if (samples.empty()) {
+        return timing;
+    }
+    sort(samples.begin(), samples.end());
+    timing.min = samples.front();
+    timing.median = samples[samples.size() / 2];
+    timing.p95 = samples[static_cast<size_t>(0.95 * (samples.size() - 1) + 0.5)];
+    for (double sample: samples) {
+        timing.mean += sample;
+    }
+    timing.mean /= samples.size();
+    return timing;
+}
+
+static void writeTiming(const Stage &stage, const char *mode, int iterations, const Timing &timing) {
+    ResultWriter writer;
+    writer.beginObject();
+    writer.key("name");
+    writer.string(stage.name);
+    writer.key("mode");
+    writer.string(mode);
+    writer.key("width");
+    writer.number(static_cast<long long>(stage.input.width));
+    writer.key("height");
+    writer.number(static_cast<long long>(stage.input.height));
+    writer.key("iterations");
+    writer.number(static_cast<long long>(iterations));
+    writer.key("min_ms");
+    writer.number(timing.min);
+    writer.key("median_ms");
+    writer.number(timing.median);
+    writer.key("mean_ms");
+    writer.number(timing.mean);
+    writer.key("p95_ms");
+    writer.number(timing.p95);
+    writer.endObject();
+    char *json = writer.release();
+    puts(json);
+    free(json);
+}
+
+int main(int argc, char **argv) {
+    MicroConfig config;
+    if (!parseArgs(argc, argv, config)) {
+        fprintf(stderr, "usage: omr-microbench [--warm N] [--cold N] [--seed S] [--height PX] [--filter NAME]\n");
+        return 2;
+    }
+
+    // Build each stage's input by running the pipeline up to it once
+    mt19937 rng(config.seed);
+    SynthParams params;
+    params.height = config.height;
+    params.rotation = 1.0;
+    SynthSheet sheet = renderSheet(params, rng);
+    const Mat photo = sheet.image;
+
+    const Mat verticallyRotated = rotateImageVertically(photo);
+    const Mat rotated = rotateImageHorizontally(verticallyRotated);
+    const Mat resized = resizeImage(rotated, 1280);
+    const Mat mask = preprocessOriginImage(resized);
+    const vector<Rect> blocks = findContoursOrigin(mask);
+    if (blocks.size() <= 8) {
+        fprintf(stderr, "Synthetic sheet produced %zu blocks; cannot stage part 3 inputs\n", blocks.size());
+        return 1;
+    }
+    Rect part3Roi(blocks[8].x - 10, blocks[8].y - 10, blocks[8].width + 20, blocks[8].height + 20);
+    part3Roi &= Rect(0, 0, resized.cols, resized.rows);
+    const Mat part3Crop = resized(part3Roi).clone();
+    const Mat part3Mask = preprocessPart3(part3Crop);
+
+    // First part 1 cell, cut the way the part 1 loop does
+    const Rect &part1Block = blocks[0];
+    int yOffset = part1Block.height * 0.09, xOffset = part1Block.width * 0.2;
+    Rect cellRect(part1Block.x + static_cast<int>(part1Block.width * 0.154) + 1,
+                  part1Block.y + static_cast<int>(part1Block.height * 0.095) + 1, xOffset + 1, yOffset + 1);
+    const Mat cell = resized(cellRect & Rect(0, 0, resized.cols, resized.rows)).clone();
+
+    ResultWriter keyWriter;
+    writeGradeResult(keyWriter, sheet.truth);
+    char *answerKey = keyWriter.release();
+    vector<vector<int>> part1Key(40, vector<int>(4, 0));
+    vector<vector<vector<int>>> part2Key(8, vector<vector<int>>(4, vector<int>(2, 0)));
+    vector<vector<vector<int>>> part3Key(6, vector<vector<int>>(12, vector<int>(4, 0)));
+
+    vector<Stage> stages = {
+            {"resizeImage", rotated.size(), [&]() { resizeImage(rotated, 1280); }},
+            {"rotateImageVertically", photo.size(), [&]() { rotateImageVertically(photo); }},
+            {"rotateImageHorizontally", verticallyRotated.size(), [&]() { rotateImageHorizontally(verticallyRotated); }},
+            {"preprocessOriginImage", resized.size(), [&]() { preprocessOriginImage(resized); }},
+            {"preprocessPart3", part3Crop.size(), [&]() { preprocessPart3(part3Crop); }},
+            {"findContoursOrigin", mask.size(), [&]() { findContoursOrigin(mask); }},
+            {"findContoursPart3", part3Mask.size(), [&]() { findContoursPart3(part3Mask); }},
+            {"extractBoundingBoxes", resized.size(), [&]() { extractBoundingBoxes(resized); }},
+            {"detectChoiceCircle", cell.size(), [&]() { detectChoiceCircle(cell); }},
+            {"parseCorrectAnswers", Size(static_cast<int>(strlen(answerKey)), 1),
+                    [&]() { parseCorrectAnswers(answerKey, part1Key, part2Key, part3Key); }},
+    };
+
+    fprintf(stderr, "%-26s %-5s %10s %10s %10s\n", "stage", "mode", "min ms", "median ms", "p95 ms");
+    for (const Stage &stage: stages) {
+        if (!config.filter.empty() && strstr(stage.name, config.filter.c_str()) == nullptr) {
+            continue;
+        }
+        const struct {
+            const char *name;
+            int iterations;
+            bool cold;
+        } modes[] = {{"warm", config.warm, false}, {"cold", config.cold, true}};
+        for (const auto &mode: modes) {
+            if (mode.iterations == 0) {
+                continue;
+            }
+            Timing timing = measure(stage, mode.iterations, mode.cold);
+            fprintf(stderr, "%-26s %-5s %10.3f %10.3f %10.3f\n", stage.name, mode.name,
+                    timing.min, timing.median, timing.p95);
+            writeTiming(stage, mode.name, mode.iterations, timing);
+        }
+    }
+
+    free(answerKey);
+    return 0;
+}
@@ -0,0 +1,172 @@
+// Concurrency soak for the grading engine.
+//
+//   omr-soak --count 32 --threads 8 --rounds 20 --options '{"coarse_to_fine":true}'
+//
+// Synthetic sheets are rendered to --work-dir and graded once on the main
+// thread for reference JSON. Then --threads threads grade all of them
+// --rounds times each, in a different order per thread, and every result
+// must be byte-identical to its reference. Any difference means state is
+// shared between concurrent grades. Mismatches are listed on stderr, a JSON
+// summary line goes to stdout, and the exit status is 1 when any were found.
+// Leave "alloc_stats" out of the options: its counts may legitimately vary.
+// So may "detection" for sheets that need block retries under load, where
+// the retry budget can run out at different rungs; pass a large
+// "retry_budget_ms" to rule that out.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "omr/engine.h"
+#include "omr/result_writer.h"
+#include "sheet_synth.h"
+
+using namespace cv;
+using namespace std;
+namespace fs = std::filesystem;
+
+// Mismatches printed in full; the rest are only counted
+#define SOAK_REPORTED_MISMATCHES 5
+
+struct SoakConfig {
+    int count = 32;
+    int threads = 8;
+    int rounds = 10;
+    unsigned seed = 1;
+    string workDir = "/tmp/omr-soak";
+    string options;
+    SynthParams synth;
+};
+
+static bool parseArgs(int argc, char **argv, SoakConfig &config) {
+    config.synth.rotation = 3;
+    config.synth.noise = 6;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Missing value for %s\n", arg.c_str());
+            return false;
+        }
+        const char *value = argv[++i];
+        if (arg == "--count") config.count = atoi(value);
+        else if (arg == "--threads") config.threads = atoi(value);
+        else if (arg == "--rounds") config.rounds = atoi(value);
+        else if (arg == "--seed") config.seed = static_cast<unsigned>(strtoul(value, nullptr, 10));
+        else if (arg == "--work-dir") config.workDir = value;
+        else if (arg == "--options") config.options = value;
+        else if (arg == "--rotation") config.synth.rotation = atof(value);
+        else if (arg == "--noise") config.synth.noise = atof(value);
+        else if (arg == "--height") config.synth.height = atoi(value);
+        else {
+            fprintf(stderr, "Unknown option %s\n", arg.c_str());
+            return false;
+        }
+    }
+    return config.count > 0 && config.threads > 0 && config.rounds > 0;
+}
+
+static string gradeToJson(const string &input, const string &output, const EngineOptions &options) {
+    ResultWriter writer;
+    gradeImageJson(input.c_str(), output.c_str(), options, writer);
+    char *json = writer.release();
+    string result(json);
+    free(json);
+    return result;
+}
+
+int main(int argc, char **argv) {
+    SoakConfig config;
+    if (!parseArgs(argc, argv, config)) {
+        fprintf(stderr, "usage: omr-soak [--count N] [--threads T] [--rounds R] [--seed S] [--work-dir DIR]\n"
+                        "                [--options JSON] [--rotation DEG] [--noise SD] [--height PX]\n");
+        return 2;
+    }
+    error_code ec;
+    fs::create_directories(config.workDir, ec);
+    if (ec) {
+        fprintf(stderr, "Cannot create %s: %s\n", config.workDir.c_str(), ec.message().c_str());
+        return 1;
+    }
+
+    mt19937 rng(config.seed);
+    vector<string> inputs(config.count);
+    for (int i = 0; i < config.count; i++) {
+        SynthSheet sheet = renderSheet(config.synth, rng);
+        char name[32];
+        snprintf(name, sizeof(name), "/sheet_%05d.jpg", i);
+        inputs[i] = config.workDir + name;
+        imwrite(inputs[i], sheet.image);
+    }
+
+    EngineOptions options = parseEngineOptions(config.options.empty() ? nullptr : config.options.c_str());
+    // References write an annotated image too: with a memory budget the
+    // modelled peak counts the annotated copy, so both sides must make one
+    vector<string> expected(config.count);
+    string referenceOutput = config.workDir + "/reference.out.jpg";
+    for (int i = 0; i < config.count; i++) {
+        expected[i] = gradeToJson(inputs[i], referenceOutput, options);
+    }
+
+    atomic<long long> grades(0), mismatches(0);
+    mutex reportMutex;
+    auto start = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (int t = 0; t < config.threads; t++) {
+        threads.emplace_back([&, t]() {
+            mt19937 order(config.seed + 1000 + t);
+            vector<int> sheets(config.count);
+            for (int i = 0; i < config.count; i++) sheets[i] = i;
+            // Every thread also writes its own annotated images, so encoding runs concurrently too
+            string output = config.workDir + "/thread_" + to_string(t) + ".out.jpg";
+            for (int round = 0; round < config.rounds; round++) {
+                shuffle(sheets.begin(), sheets.end(), order);
+                for (int i: sheets) {
+                    string json = gradeToJson(inputs[i], output, options);
+                    grades.fetch_add(1, memory_order_relaxed);
+                    if (json == expected[i]) continue;
+                    long long seen = mismatches.fetch_add(1, memory_order_relaxed);
+                    if (seen < SOAK_REPORTED_MISMATCHES) {
+                        lock_guard<mutex> lock(reportMutex);
+                        fprintf(stderr, "mismatch: sheet %d, thread %d, round %d\n  expected %s\n  got      %s\n",
+                                i, t, round, expected[i].c_str(), json.c_str());
+                    }
+                }
+            }
+        });
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    double wallSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    long long total = grades.load(), failed = mismatches.load();
+    fprintf(stderr, "%lld grades of %d sheets on %d threads in %.1f s (%.2f sheets/s): %lld mismatches\n",
+            total, config.count, config.threads, wallSeconds, total / wallSeconds, failed);
+
+    ResultWriter writer;
+    writer.beginObject();
+    writer.key("sheets");
+    writer.number(static_cast<long long>(config.count));
+    writer.key("threads");
+    writer.number(static_cast<long long>(config.threads));
+    writer.key("grades");
+    writer.number(total);
+    writer.key("sheets_per_second");
+    writer.number(total / wallSeconds);
+    writer.key("mismatches");
+    writer.number(failed);
+    writer.endObject();
+    char *json = writer.release();
+    puts(json);
+    free(json);
+    return failed == 0 ? 0 : 1;
+}
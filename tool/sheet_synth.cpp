@@ -0,0 +1,259 @@
+#include "sheet_synth.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "omr/header_grids.h"
+#include "omr/result_writer.h"
+
+using namespace cv;
+using namespace std;
+
+// Canonical layout at the engine's 1280 px working height. Block sizes keep
+// the part 3 columns inside findContoursPart3's area and aspect bounds, and
+// the columns share borders like the printed table so each one yields a
+// single contour.
+static const int kSheetWidth = 905;
+static const int kSheetHeight = 1280;
+static const int kRenderScale = 2;
+
+static Rect part1Block(int i) { return Rect(40 + i * 210, 250, 190, 330); }
+static Rect part2Block(int i) { return Rect(40 + i * 210, 600, 190, 200); }
+static const Rect kPart3Outer(30, 830, 845, 420);
+static Rect part3Column(int i) { return Rect(50 + i * 128, 870, 128, 320); }
+static const Rect kStudentIdGrid(570, 20, 120, 220);
+static const Rect kExamCodeGrid(720, 20, 60, 220);
+
+static const char *kPart1Choices[] = {"A", "B", "C", "D"};
+static const char *kPart2Subs[] = {"a", "b", "c", "d"};
+static const char *kPart3Symbols[] = {"-", ",", "0", "1", "2", "3", "4", "5", "6", "7", "8", "9"};
+
+// Cell grid of a block, using the same fractions as the part loops in gradeImage
+struct CellGrid {
+    double xPadding, yPadding, xOffset, yOffset;
+};
+static const CellGrid kPart1Grid = {0.154, 0.095, 0.2, 0.09};
+static const CellGrid kPart2Grid = {0.123, 0.347, 0.21, 0.15};
+static const CellGrid kPart3Grid = {0.18, 0.1625, 0.19, 0.07};
+
+static Point cellCenter(const Rect &block, const CellGrid &grid, int col, int row) {
+    int xOffset = block.width * grid.xOffset;
+    int yOffset = block.height * grid.yOffset;
+    int x = block.x + static_cast<int>(block.width * grid.xPadding) + xOffset * col + 1;
+    int y = block.y + static_cast<int>(block.height * grid.yPadding) + yOffset * row + 1;
+    return Point(x + (xOffset + 1) / 2, y + (yOffset + 1) / 2);
+}
+
+static int cellRadius(const Rect &block, const CellGrid &grid) {
+    int w = block.width * grid.xOffset, h = block.height * grid.yOffset;
+    return max(3, static_cast<int>(0.3 * min(w, h)));
+}
+
+static void drawBlock(Mat &sheet, const Rect &block) {
+    rectangle(sheet, Rect(block.x * kRenderScale, block.y * kRenderScale,
+                          block.width * kRenderScale, block.height * kRenderScale),
+              Scalar(30, 30, 30), kRenderScale);
+}
+
+static void drawBubble(Mat &sheet, const Point &center, int radius, bool filled) {
+    Point at(center.x * kRenderScale, center.y * kRenderScale);
+    if (filled) {
+        circle(sheet, at, radius * kRenderScale, Scalar(40, 40, 40), FILLED, LINE_AA);
+    } else {
+        // Printed bubbles are light; dark rings read as filled once blurred
+        circle(sheet, at, radius * kRenderScale, Scalar(150, 150, 150), kRenderScale, LINE_AA);
+    }
+}
+
+// Draw the sheet with random answers and record them as ground truth
+static Mat drawSheet(const SynthParams &params, mt19937 &rng, GradeResult &truth) {
+    uniform_real_distribution<double> unit(0.0, 1.0);
+    Mat sheet(kSheetHeight * kRenderScale, kSheetWidth * kRenderScale, CV_8UC3, Scalar(245, 245, 245));
+
+    putText(sheet, "PHIEU TRA LOI TRAC NGHIEM", Point(180 * kRenderScale, 90 * kRenderScale),
+            FONT_HERSHEY_SIMPLEX, 1.0 * kRenderScale, Scalar(30, 30, 30), 2 * kRenderScale, LINE_AA);
+
+    // Header: student number and exam code, every column filled in
+    const Rect *grids[] = {&kStudentIdGrid, &kExamCodeGrid};
+    const int gridColumns[] = {HEADER_ID_DIGITS, HEADER_CODE_DIGITS};
+    for (int grid = 0; grid < 2; grid++) {
+        drawBlock(sheet, *grids[grid]);
+        string digits;
+        for (int col = 0; col < gridColumns[grid]; col++) {
+            int chosen = static_cast<int>(unit(rng) * HEADER_GRID_ROWS) % HEADER_GRID_ROWS;
+            for (int row = 0; row < HEADER_GRID_ROWS; row++) {
+                Rect cell = headerCell(*grids[grid], gridColumns[grid], col, row);
+                int radius = max(3, static_cast<int>(0.35 * min(cell.width, cell.height)));
+                drawBubble(sheet, Point(cell.x + cell.width / 2, cell.y + cell.height / 2), radius, row == chosen);
+            }
+            digits += static_cast<char>('0' + chosen);
+        }
+        (grid == 0 ? truth.studentId : truth.examCode) = digits;
+    }
+    truth.headerRead = true;
+
+    // Part 1: 4 blocks x 10 questions, choices A-D
+    for (int block = 0; block < 4; block++) {
+        Rect box = part1Block(block);
+        drawBlock(sheet, box);
+        int radius = cellRadius(box, kPart1Grid);
+        for (int row = 0; row < 10; row++) {
+            int chosen = unit(rng) < params.blankRate ? -1 : static_cast<int>(unit(rng) * 4) % 4;
+            for (int col = 0; col < 4; col++) {
+                drawBubble(sheet, cellCenter(box, kPart1Grid, col, row), radius, col == chosen);
+            }
+            if (chosen >= 0) {
+                truth.part1Answers.push_back({to_string(block * 10 + row + 1), kPart1Choices[chosen]});
+            }
+        }
+    }
+
+    // Part 2: 4 blocks x 2 questions, sub-questions a-d answered yes/no
+    for (int block = 0; block < 4; block++) {
+        Rect box = part2Block(block);
+        drawBlock(sheet, box);
+        int radius = cellRadius(box, kPart2Grid);
+        for (int question = 0; question < 2; question++) {
+            for (int row = 0; row < 4; row++) {
+                int chosen = unit(rng) < params.blankRate ? -1 : static_cast<int>(unit(rng) * 2) % 2;
+                for (int choice = 0; choice < 2; choice++) {
+                    drawBubble(sheet, cellCenter(box, kPart2Grid, question * 2 + choice, row), radius, choice == chosen);
+                }
+                if (chosen >= 0) {
+                    truth.part2Answers.push_back({to_string(block * 2 + question + 1), kPart2Subs[row], chosen == 0});
+                }
+            }
+        }
+    }
+    sort(truth.part2Answers.begin(), truth.part2Answers.end(), [](const part2Answer &a, const part2Answer &b) {
+        if (a.questionNumber != b.questionNumber) {
+            return a.questionNumber < b.questionNumber;
+        }
+        return a.subName < b.subName;
+    });
+
+    // Part 3: 6 columns of 4 digit positions x 12 symbols
+    drawBlock(sheet, kPart3Outer);
+    for (int block = 0; block < 6; block++) {
+        Rect box = part3Column(block);
+        drawBlock(sheet, box);
+        int radius = cellRadius(box, kPart3Grid);
+        int digits = unit(rng) < params.blankRate ? 0 : 1 + static_cast<int>(unit(rng) * 4) % 4;
+        string answer;
+        for (int col = 0; col < 4; col++) {
+            int chosen = col < digits ? static_cast<int>(unit(rng) * 12) % 12 : -1;
+            for (int row = 0; row < 12; row++) {
+                drawBubble(sheet, cellCenter(box, kPart3Grid, col, row), radius, row == chosen);
+            }
+            if (chosen >= 0) {
+                answer += kPart3Symbols[chosen];
+            }
+        }
+        if (!answer.empty()) {
+            truth.part3Answers.push_back({to_string(block + 1), answer});
+        }
+    }
+
+    truth.statusCode = STATUS_OK;
+    truth.graded = true;
+    if (truth.part1Answers.empty() && truth.part2Answers.empty() && truth.part3Answers.empty()) {
+        truth.statusCode = STATUS_NO_ANSWERS;
+        truth.error = "No answers detected";
+        truth.graded = false;
+    }
+    return sheet;
+}
+
+SynthSheet renderSheet(const SynthParams &params, mt19937 &rng) {
+    uniform_real_distribution<double> unit(0.0, 1.0);
+    auto upTo = [&](double limit) { return limit * unit(rng); };
+    auto either = [&](double limit) { return limit * (2 * unit(rng) - 1); };
+
+    SynthSheet out;
+    Mat sheet = drawSheet(params, rng, out.truth);
+
+    // The sheet fills the frame as in app captures; a visible paper edge on a
+    // dark background would become one contour enclosing every block.
+    // Rotation and perspective expose the darker background at the corners.
+    int height = max(320, params.height);
+    int width = height * kSheetWidth / kSheetHeight;
+    Mat photo(height, width, CV_8UC3, Scalar(70, 80, 90));
+
+    double sheetHeight = height;
+    double sheetWidth = width;
+    Point2f center(width / 2.0f, height / 2.0f);
+    double theta = (params.exactRotation ? params.rotation : either(params.rotation)) * CV_PI / 180.0;
+    Point2f corners[4] = {
+            Point2f(static_cast<float>(-sheetWidth / 2), static_cast<float>(-sheetHeight / 2)),
+            Point2f(static_cast<float>(sheetWidth / 2), static_cast<float>(-sheetHeight / 2)),
+            Point2f(static_cast<float>(sheetWidth / 2), static_cast<float>(sheetHeight / 2)),
+            Point2f(static_cast<float>(-sheetWidth / 2), static_cast<float>(sheetHeight / 2))};
+    Point2f target[4];
+    for (int i = 0; i < 4; i++) {
+        double jitterX = either(params.perspective) * sheetWidth;
+        double jitterY = either(params.perspective) * sheetHeight;
+        double x = corners[i].x * cos(theta) - corners[i].y * sin(theta) + jitterX;
+        double y = corners[i].x * sin(theta) + corners[i].y * cos(theta) + jitterY;
+        target[i] = Point2f(static_cast<float>(center.x + x), static_cast<float>(center.y + y));
+    }
+    // Downscale with area averaging first; warpPerspective has no INTER_AREA
+    Mat scaled;
+    resize(sheet, scaled, Size(static_cast<int>(sheetWidth), static_cast<int>(sheetHeight)), 0, 0, INTER_AREA);
+    Point2f source[4] = {Point2f(0, 0), Point2f(static_cast<float>(scaled.cols), 0),
+                         Point2f(static_cast<float>(scaled.cols), static_cast<float>(scaled.rows)),
+                         Point2f(0, static_cast<float>(scaled.rows))};
+    Mat transform = getPerspectiveTransform(source, target);
+    warpPerspective(scaled, photo, transform, photo.size(), INTER_LINEAR, BORDER_TRANSPARENT);
+
+    // Shadow: linear darkening gradient across the photo in a random direction
+    double shadow = upTo(params.shadow);
+    if (shadow > 0) {
+        double direction = unit(rng) * 2 * CV_PI;
+        double dx = cos(direction), dy = sin(direction);
+        double extent = abs(dx) * width + abs(dy) * height;
+        for (int y = 0; y < photo.rows; y++) {
+            Vec3b *row = photo.ptr<Vec3b>(y);
+            for (int x = 0; x < photo.cols; x++) {
+                double along = ((x - width / 2.0) * dx + (y - height / 2.0) * dy) / extent + 0.5;
+                double factor = 1.0 - shadow * min(1.0, max(0.0, along));
+                for (int c = 0; c < 3; c++) {
+                    row[x][c] = static_cast<unsigned char>(row[x][c] * factor);
+                }
+            }
+        }
+    }
+
+    double blurSigma = upTo(params.blur);
+    if (blurSigma > 0.1) {
+        GaussianBlur(photo, photo, Size(0, 0), blurSigma);
+    }
+
+    double noise = upTo(params.noise);
+    if (noise > 0) {
+        Mat grain(photo.size(), CV_16SC3);
+        randn(grain, Scalar::all(0), Scalar::all(noise));
+        Mat noisy;
+        photo.convertTo(noisy, CV_16SC3);
+        add(noisy, grain, noisy);
+        noisy.convertTo(photo, CV_8UC3);
+    }
+
+    out.image = photo;
+    return out;
+}
+
+bool writeSynthSheet(const SynthSheet &sheet, const string &stem) {
+    if (!imwrite(stem + ".jpg", sheet.image)) {
+        return false;
+    }
+    ResultWriter writer;
+    writeGradeResult(writer, sheet.truth);
+    char *json = writer.release();
+    FILE *file = fopen((stem + ".json").c_str(), "wb");
+    bool ok = file != nullptr && fwrite(json, 1, writer.length(), file) == writer.length();
+    if (file != nullptr) {
+        ok = fclose(file) == 0 && ok;
+    }
+    free(json);
+    return ok;
+}
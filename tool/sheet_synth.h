@@ -0,0 +1,38 @@
+#ifndef NATIVE_OPENCV_SHEET_SYNTH_H
+#define NATIVE_OPENCV_SHEET_SYNTH_H
+
+#include <opencv2/opencv.hpp>
+#include <random>
+#include <string>
+#include "omr/grade_result.h"
+
+// Capture conditions applied to a rendered sheet. Each value is the
+// maximum; the generator draws uniformly up to it per sheet.
+struct SynthParams {
+    double rotation = 0;      // degrees, either direction
+    bool exactRotation = false;  // rotate by exactly `rotation`, sign included
+    double perspective = 0;   // corner displacement as a fraction of sheet size
+    double blur = 0;          // Gaussian sigma in output pixels
+    double noise = 0;         // Gaussian noise standard deviation in gray levels
+    double shadow = 0;        // strongest darkening of the shadow gradient, 0-1
+    int height = 1600;        // output photo height in pixels
+    double blankRate = 0.1;   // probability a question is left unanswered
+};
+
+struct SynthSheet {
+    cv::Mat image;
+    // Expected answers, in the shape process_image returns them
+    GradeResult truth;
+};
+
+// Render a 40/8/6 answer sheet with a filled-in student number and exam
+// code and random filled bubbles and photograph it
+// under random conditions bounded by `params`
+SynthSheet renderSheet(const SynthParams &params, std::mt19937 &rng);
+
+// Write the photo to <stem>.jpg and the truth to <stem>.json, the JSON
+// process_image would return for it, so the corpus can be reused by other
+// tools and regression scripts. False when either file cannot be written.
+bool writeSynthSheet(const SynthSheet &sheet, const std::string &stem);
+
+#endif // NATIVE_OPENCV_SHEET_SYNTH_H